@@ -0,0 +1,150 @@
+defmodule Pythonx.Bench do
+  @moduledoc false
+
+  # Minimal benchmark runner, results are kept in the calling process until `report/1`.
+
+  @sample_ns 50_000_000
+  @samples 5
+
+  @doc """
+  Measures `fun`, called with no arguments, and records the time per call.
+
+  The number of calls per sample is calibrated so that each sample takes about 50ms,
+  and the median and minimum of #{@samples} samples are recorded.
+  """
+  def measure(group, name, fun, meta \\ %{}) do
+    iterations = calibrate(fun, 1)
+
+    samples =
+      for _ <- 1..@samples do
+        :erlang.garbage_collect()
+        {elapsed, _} = timed(fun, iterations)
+        elapsed / iterations
+      end
+      |> Enum.sort()
+
+    record(
+      Map.merge(meta, %{
+        group: group,
+        name: name,
+        iterations: iterations,
+        ns_per_op: Enum.at(samples, div(@samples, 2)),
+        min_ns_per_op: hd(samples)
+      })
+    )
+  end
+
+  @doc """
+  Runs `fun` `count` times in each of `processes` concurrent processes and records the
+  throughput and the latency percentiles of single calls.
+  """
+  def measure_concurrent(group, name, processes, count, fun, meta \\ %{}) do
+    fun.()
+    start = System.monotonic_time(:nanosecond)
+
+    latencies =
+      1..processes
+      |> Enum.map(fn _ ->
+        Task.async(fn ->
+          for _ <- 1..count do
+            call_start = System.monotonic_time(:nanosecond)
+            fun.()
+            System.monotonic_time(:nanosecond) - call_start
+          end
+        end)
+      end)
+      |> Task.await_many(:infinity)
+      |> List.flatten()
+      |> Enum.sort()
+      |> List.to_tuple()
+
+    elapsed = System.monotonic_time(:nanosecond) - start
+    total = tuple_size(latencies)
+
+    record(
+      Map.merge(meta, %{
+        group: group,
+        name: name,
+        processes: processes,
+        iterations: total,
+        ns_per_op: elapsed / total,
+        ops_per_sec: total * 1_000_000_000 / elapsed,
+        p50_ns: elem(latencies, div(total * 50, 100)),
+        p99_ns: elem(latencies, min(total - 1, div(total * 99, 100)))
+      })
+    )
+  end
+
+  @doc """
+  Prints the results and writes them as JSON to `path`.
+  """
+  def report(path) do
+    results = Enum.reverse(Process.get({__MODULE__, :results}, []))
+
+    for result <- results do
+      IO.puts(
+        "#{String.pad_trailing(result.group, 12)} #{String.pad_trailing(result.name, 40)} " <>
+          "#{:erlang.float_to_binary(result.ns_per_op / 1, decimals: 1)} ns/op"
+      )
+    end
+
+    document = %{
+      environment: %{
+        timestamp: DateTime.to_iso8601(DateTime.utc_now()),
+        git_revision: git_revision(),
+        elixir: System.version(),
+        otp: System.otp_release(),
+        schedulers: System.schedulers_online(),
+        python: python_version()
+      },
+      results: results
+    }
+
+    File.write!(path, Jason.encode_to_iodata!(document, pretty: true))
+    IO.puts("\nResults written to #{path}")
+  end
+
+  defp record(result) do
+    IO.puts(:stderr, "  #{result.group}/#{result.name}")
+    Process.put({__MODULE__, :results}, [result | Process.get({__MODULE__, :results}, [])])
+  end
+
+  defp calibrate(fun, iterations) do
+    {elapsed, _} = timed(fun, iterations)
+
+    cond do
+      elapsed >= @sample_ns or iterations >= 100_000_000 -> iterations
+      elapsed < div(@sample_ns, 100) -> calibrate(fun, iterations * 10)
+      true -> max(1, round(iterations * @sample_ns / elapsed))
+    end
+  end
+
+  defp timed(fun, iterations) do
+    start = System.monotonic_time(:nanosecond)
+    loop(fun, iterations)
+    {System.monotonic_time(:nanosecond) - start, iterations}
+  end
+
+  defp loop(_fun, 0), do: :ok
+
+  defp loop(fun, n) do
+    fun.()
+    loop(fun, n - 1)
+  end
+
+  defp git_revision do
+    case System.cmd("git", ["rev-parse", "HEAD"], stderr_to_stdout: true) do
+      {sha, 0} -> String.trim(sha)
+      _ -> nil
+    end
+  rescue
+    _ -> nil
+  end
+
+  defp python_version do
+    case Pythonx.inline("import sys\nversion = sys.version.split()[0]", return: [:version]) do
+      {:ok, [version]} -> version
+      _ -> nil
+    end
+  end
+end
@@ -0,0 +1,63 @@
+# Compares NIF resources with slab handles and arenas for short-lived objects.
+#
+#     mix run bench/handle_slab.exs
+
+alias Pythonx.C.{PyLong, PyNumber}
+alias Pythonx.Handle
+
+Pythonx.initialize_once()
+
+n = String.to_integer(System.get_env("ITERATIONS", "200000"))
+batch = 1000
+
+measure = fn name, fun ->
+  fun.(div(n, 10))
+  :erlang.garbage_collect()
+  {us, _} = :timer.tc(fn -> fun.(n) end)
+  IO.puts("#{String.pad_trailing(name, 12)} #{Float.round(us * 1000 / n, 1)} ns/iter")
+end
+
+measure.("resources", fn n ->
+  one = PyLong.from_long(1)
+
+  for i <- 1..n do
+    i |> PyLong.from_long() |> PyNumber.add(one) |> PyLong.as_long()
+  end
+end)
+
+measure.("handles", fn n ->
+  one = Handle.from_long(1)
+
+  1..n
+  |> Stream.chunk_every(batch)
+  |> Enum.each(fn chunk ->
+    handles =
+      Enum.flat_map(chunk, fn i ->
+        a = Handle.from_long(i)
+        b = Handle.number(:add, a, one)
+        Handle.as_long(b)
+        [a, b]
+      end)
+
+    Handle.release(handles)
+  end)
+
+  Handle.release(one)
+end)
+
+measure.("arena", fn n ->
+  one = Handle.from_long(1)
+
+  1..n
+  |> Stream.chunk_every(batch)
+  |> Enum.each(fn chunk ->
+    Pythonx.Arena.run(fn arena ->
+      Enum.each(chunk, fn i ->
+        a = Handle.from_long(i, arena)
+        Handle.as_long(Handle.number(:add, a, one, arena))
+      end)
+    end)
+  end)
+
+  Handle.release(one)
+end)
@@ -0,0 +1,170 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <erl_nif.h>
+#include <benchmark/benchmark.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "nif_shim.hpp"
+#include "pythonx_convert.hpp"
+
+// Benchmarks of the conversion core, run without the BEAM.
+//
+// Each benchmark converts a container of `size` elements of one type, and
+// reports the time per element in the `per_element` counter. Scalars are
+// measured inside a list, so their numbers include the cost of the list.
+//
+//     cmake -S . -B build -D PYTHONX_BUILD_BENCHMARKS=ON ...
+//     cmake --build build --target pythonx_convert_bench
+//     ./build/pythonx_convert_bench --benchmark_filter=python_to/list
+//
+// Build with -fno-omit-frame-pointer to get usable stacks in perf.
+
+static const std::vector<int64_t> kSizes = {1, 16, 256, 4096};
+
+static ErlNifEnv *env;
+
+using PyElement = std::function<PyObject *(int64_t)>;
+using ErlElement = std::function<ERL_NIF_TERM(int64_t)>;
+
+static void set_per_element(benchmark::State &state, int64_t size) {
+    state.counters["per_element"] = benchmark::Counter(
+        (double)size,
+        benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert
+    );
+}
+
+// ------- Python to Erlang -------
+
+static PyObject * py_list(const PyElement &element, int64_t size) {
+    PyObject *list = PyList_New(size);
+    for (int64_t i = 0; i < size; ++i) PyList_SET_ITEM(list, i, element(i));
+    return list;
+}
+
+static PyObject * py_tuple(const PyElement &element, int64_t size) {
+    PyObject *tuple = PyTuple_New(size);
+    for (int64_t i = 0; i < size; ++i) PyTuple_SET_ITEM(tuple, i, element(i));
+    return tuple;
+}
+
+static PyObject * py_dict(const PyElement &element, int64_t size) {
+    PyObject *dict = PyDict_New();
+    for (int64_t i = 0; i < size; ++i) {
+        PyObject *key = PyUnicode_FromFormat("key-%lld", (long long)i);
+        PyObject *value = element(i);
+        PyDict_SetItem(dict, key, value);
+        Py_DECREF(key);
+        Py_DECREF(value);
+    }
+    return dict;
+}
+
+static void python_to_bench(benchmark::State &state, PyObject *(*container)(const PyElement &, int64_t), PyElement element) {
+    int64_t size = state.range(0);
+    PyObject *value = container(element, size);
+
+    for (auto _ : state) {
+        auto term = python_to(env, value);
+        benchmark::DoNotOptimize(term);
+        pythonx_shim_env_reset(env);
+    }
+
+    Py_DECREF(value);
+    set_per_element(state, size);
+}
+
+// ------- Erlang to Python -------
+
+static ERL_NIF_TERM erl_list(const ErlElement &element, int64_t size) {
+    std::vector<ERL_NIF_TERM> items;
+    for (int64_t i = 0; i < size; ++i) items.emplace_back(element(i));
+    return enif_make_list_from_array(env, items.data(), (unsigned)items.size());
+}
+
+static ERL_NIF_TERM erl_tuple(const ErlElement &element, int64_t size) {
+    std::vector<ERL_NIF_TERM> items;
+    for (int64_t i = 0; i < size; ++i) items.emplace_back(element(i));
+    return enif_make_tuple_from_array(env, items.data(), (unsigned)items.size());
+}
+
+static ERL_NIF_TERM erl_binary(const std::string &value) {
+    ERL_NIF_TERM term;
+    unsigned char *data = enif_make_new_binary(env, value.size(), &term);
+    memcpy(data, value.data(), value.size());
+    return term;
+}
+
+static void erl_to_python_bench(benchmark::State &state, ERL_NIF_TERM (*container)(const ErlElement &, int64_t), ErlElement element) {
+    int64_t size = state.range(0);
+    ErlNifEnv *input = pythonx_shim_env_new();
+    std::swap(env, input);
+    ERL_NIF_TERM term = container(element, size);
+    std::swap(env, input);
+
+    // freeing the result is part of the measurement
+    for (auto _ : state) {
+        auto value = erl_to_python(env, term);
+        Py_XDECREF(value.value_or(nullptr));
+    }
+
+    pythonx_shim_env_free(input);
+    set_per_element(state, size);
+}
+
+// ------- Registration -------
+
+static void register_benchmarks() {
+    struct PyType { const char *name; PyElement element; };
+    std::vector<PyType> py_types = {
+        {"int", [](int64_t i) { return PyLong_FromLongLong(i); }},
+        {"float", [](int64_t i) { return PyFloat_FromDouble(i * 0.5); }},
+        {"str", [](int64_t i) { return PyUnicode_FromFormat("element-%lld", (long long)i); }},
+        {"bool", [](int64_t i) { PyObject *b = i % 2 ? Py_True : Py_False; Py_INCREF(b); return b; }},
+        {"none", [](int64_t) { Py_INCREF(Py_None); return Py_None; }},
+        {"list", [](int64_t i) { return py_list([](int64_t j) { return PyLong_FromLongLong(j); }, 4); }},
+    };
+    struct PyContainer { const char *name; PyObject *(*make)(const PyElement &, int64_t); };
+    std::vector<PyContainer> py_containers = {{"list", py_list}, {"tuple", py_tuple}, {"dict", py_dict}};
+
+    for (auto &container : py_containers) {
+        for (auto &type : py_types) {
+            std::string name = std::string("python_to/") + container.name + "/" + type.name;
+            benchmark::RegisterBenchmark(name.c_str(), python_to_bench, container.make, type.element)->ArgName("size")->ArgsProduct({kSizes});
+        }
+    }
+
+    struct ErlType { const char *name; ErlElement element; };
+    std::vector<ErlType> erl_types = {
+        {"integer", [](int64_t i) { return enif_make_int64(env, i); }},
+        {"float", [](int64_t i) { return enif_make_double(env, i * 0.5); }},
+        {"binary", [](int64_t i) { return erl_binary("element-" + std::to_string(i)); }},
+        {"atom", [](int64_t i) { return enif_make_atom(env, ("atom_" + std::to_string(i % 64)).c_str()); }},
+        {"boolean", [](int64_t i) { return i % 2 ? kAtomTrue : kAtomFalse; }},
+        {"list", [](int64_t) { return erl_list([](int64_t j) { return enif_make_int64(env, j); }, 4); }},
+    };
+    struct ErlContainer { const char *name; ERL_NIF_TERM (*make)(const ErlElement &, int64_t); };
+    std::vector<ErlContainer> erl_containers = {{"list", erl_list}, {"tuple", erl_tuple}};
+
+    for (auto &container : erl_containers) {
+        for (auto &type : erl_types) {
+            std::string name = std::string("erl_to_python/") + container.name + "/" + type.name;
+            benchmark::RegisterBenchmark(name.c_str(), erl_to_python_bench, container.make, type.element)->ArgName("size")->ArgsProduct({kSizes});
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    Py_InitializeEx(0);
+    env = pythonx_shim_env_new();
+    init_pythonx_consts(env);
+
+    register_benchmarks();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    pythonx_shim_env_free(env);
+    return Py_FinalizeEx() < 0 ? 120 : 0;
+}
@@ -0,0 +1,376 @@
+#include "nif_shim.hpp"
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+enum class Kind : uint8_t { Atom, Integer, Float, Binary, Nil, Cons, Tuple, Map };
+
+struct Term {
+    Kind kind;
+};
+
+struct Atom : Term {
+    std::string name;
+};
+
+struct Integer : Term {
+    int64_t value;
+};
+
+struct Float : Term {
+    double value;
+};
+
+struct Binary : Term {
+    size_t size;
+    unsigned char data[];
+};
+
+struct Cons : Term {
+    ERL_NIF_TERM head;
+    ERL_NIF_TERM tail;
+};
+
+struct Tuple : Term {
+    unsigned arity;
+    ERL_NIF_TERM items[];
+};
+
+struct Map : Term {
+    size_t size;
+    // keys followed by values
+    ERL_NIF_TERM items[];
+};
+
+inline ERL_NIF_TERM to_term(const Term *term) {
+    return (ERL_NIF_TERM)(uintptr_t)term;
+}
+
+inline const Term * from_term(ERL_NIF_TERM term) {
+    return (const Term *)(uintptr_t)term;
+}
+
+template <typename T>
+inline const T * as(ERL_NIF_TERM term, Kind kind) {
+    const Term *t = from_term(term);
+    return t->kind == kind ? static_cast<const T *>(t) : nullptr;
+}
+
+const Term nil_term{Kind::Nil};
+
+std::mutex atoms_mutex;
+std::unordered_map<std::string, std::unique_ptr<Atom>> atoms;
+
+[[noreturn]] void unsupported(const char *name) {
+    fprintf(stderr, "nif_shim: %s is not supported\n", name);
+    abort();
+}
+
+}  // namespace
+
+struct enif_environment_t {
+    static constexpr size_t kChunkSize = 1 << 20;
+
+    std::vector<std::unique_ptr<char[]>> chunks;
+    std::vector<std::unique_ptr<char[]>> large;
+    size_t chunk = 0;
+    size_t used = 0;
+
+    enif_environment_t() {
+        chunks.emplace_back(new char[kChunkSize]);
+    }
+
+    // terms are never destructed, only the memory is reused
+    template <typename T>
+    T * alloc(size_t extra = 0) {
+        size_t size = (sizeof(T) + extra + 15) & ~(size_t)15;
+        if (size > kChunkSize) {
+            large.emplace_back(new char[size]);
+            return reinterpret_cast<T *>(large.back().get());
+        }
+        if (used + size > kChunkSize) {
+            if (++chunk == chunks.size()) chunks.emplace_back(new char[kChunkSize]);
+            used = 0;
+        }
+        T *ptr = reinterpret_cast<T *>(chunks[chunk].get() + used);
+        used += size;
+        return ptr;
+    }
+};
+
+ErlNifEnv * pythonx_shim_env_new() {
+    return new enif_environment_t();
+}
+
+void pythonx_shim_env_reset(ErlNifEnv *env) {
+    env->chunk = 0;
+    env->used = 0;
+    env->large.clear();
+}
+
+void pythonx_shim_env_free(ErlNifEnv *env) {
+    delete env;
+}
+
+// ------- atoms -------
+
+ERL_NIF_TERM enif_make_atom_len(ErlNifEnv *env, const char *name, size_t len) {
+    std::lock_guard<std::mutex> guard(atoms_mutex);
+    std::string key(name, len);
+    auto it = atoms.find(key);
+    if (it == atoms.end()) {
+        auto atom = std::make_unique<Atom>();
+        atom->kind = Kind::Atom;
+        atom->name = key;
+        it = atoms.emplace(key, std::move(atom)).first;
+    }
+    return to_term(it->second.get());
+}
+
+ERL_NIF_TERM enif_make_atom(ErlNifEnv *env, const char *name) {
+    return enif_make_atom_len(env, name, strlen(name));
+}
+
+int enif_make_existing_atom(ErlNifEnv *env, const char *name, ERL_NIF_TERM *atom, ErlNifCharEncoding encoding) {
+    std::lock_guard<std::mutex> guard(atoms_mutex);
+    auto it = atoms.find(name);
+    if (it == atoms.end()) return 0;
+    *atom = to_term(it->second.get());
+    return 1;
+}
+
+int enif_is_atom(ErlNifEnv *env, ERL_NIF_TERM term) {
+    return from_term(term)->kind == Kind::Atom;
+}
+
+int enif_get_atom_length(ErlNifEnv *env, ERL_NIF_TERM term, unsigned *len, ErlNifCharEncoding encoding) {
+    const Atom *atom = as<Atom>(term, Kind::Atom);
+    if (atom == nullptr) return 0;
+    *len = (unsigned)atom->name.size();
+    return 1;
+}
+
+int enif_get_atom(ErlNifEnv *env, ERL_NIF_TERM term, char *buf, unsigned len, ErlNifCharEncoding encoding) {
+    const Atom *atom = as<Atom>(term, Kind::Atom);
+    if (atom == nullptr || atom->name.size() + 1 > len) return 0;
+    memcpy(buf, atom->name.c_str(), atom->name.size() + 1);
+    return (int)atom->name.size() + 1;
+}
+
+// ------- numbers -------
+
+ERL_NIF_TERM enif_make_int64(ErlNifEnv *env, ErlNifSInt64 value) {
+    Integer *term = env->alloc<Integer>();
+    term->kind = Kind::Integer;
+    term->value = value;
+    return to_term(term);
+}
+
+ERL_NIF_TERM enif_make_int(ErlNifEnv *env, int value) {
+    return enif_make_int64(env, value);
+}
+
+ERL_NIF_TERM enif_make_double(ErlNifEnv *env, double value) {
+    Float *term = env->alloc<Float>();
+    term->kind = Kind::Float;
+    term->value = value;
+    return to_term(term);
+}
+
+int enif_is_number(ErlNifEnv *env, ERL_NIF_TERM term) {
+    Kind kind = from_term(term)->kind;
+    return kind == Kind::Integer || kind == Kind::Float;
+}
+
+int enif_get_int64(ErlNifEnv *env, ERL_NIF_TERM term, ErlNifSInt64 *value) {
+    const Integer *integer = as<Integer>(term, Kind::Integer);
+    if (integer == nullptr) return 0;
+    *value = integer->value;
+    return 1;
+}
+
+int enif_get_int(ErlNifEnv *env, ERL_NIF_TERM term, int *value) {
+    const Integer *integer = as<Integer>(term, Kind::Integer);
+    if (integer == nullptr || integer->value < INT32_MIN || integer->value > INT32_MAX) return 0;
+    *value = (int)integer->value;
+    return 1;
+}
+
+int enif_get_uint64(ErlNifEnv *env, ERL_NIF_TERM term, ErlNifUInt64 *value) {
+    const Integer *integer = as<Integer>(term, Kind::Integer);
+    if (integer == nullptr || integer->value < 0) return 0;
+    *value = (ErlNifUInt64)integer->value;
+    return 1;
+}
+
+int enif_get_double(ErlNifEnv *env, ERL_NIF_TERM term, double *value) {
+    const Float *number = as<Float>(term, Kind::Float);
+    if (number == nullptr) return 0;
+    *value = number->value;
+    return 1;
+}
+
+// ------- binaries -------
+
+unsigned char * enif_make_new_binary(ErlNifEnv *env, size_t size, ERL_NIF_TERM *term) {
+    Binary *binary = env->alloc<Binary>(size);
+    binary->kind = Kind::Binary;
+    binary->size = size;
+    *term = to_term(binary);
+    return binary->data;
+}
+
+int enif_is_binary(ErlNifEnv *env, ERL_NIF_TERM term) {
+    return from_term(term)->kind == Kind::Binary;
+}
+
+int enif_inspect_binary(ErlNifEnv *env, ERL_NIF_TERM term, ErlNifBinary *bin) {
+    const Binary *binary = as<Binary>(term, Kind::Binary);
+    if (binary == nullptr) return 0;
+    memset(bin, 0, sizeof(ErlNifBinary));
+    bin->size = binary->size;
+    bin->data = const_cast<unsigned char *>(binary->data);
+    return 1;
+}
+
+// ------- lists -------
+
+ERL_NIF_TERM enif_make_list_cell(ErlNifEnv *env, ERL_NIF_TERM head, ERL_NIF_TERM tail) {
+    Cons *cons = env->alloc<Cons>();
+    cons->kind = Kind::Cons;
+    cons->head = head;
+    cons->tail = tail;
+    return to_term(cons);
+}
+
+ERL_NIF_TERM enif_make_list_from_array(ErlNifEnv *env, const ERL_NIF_TERM arr[], unsigned cnt) {
+    ERL_NIF_TERM list = to_term(&nil_term);
+    for (unsigned i = cnt; i > 0; --i) {
+        list = enif_make_list_cell(env, arr[i - 1], list);
+    }
+    return list;
+}
+
+ERL_NIF_TERM enif_make_list(ErlNifEnv *env, unsigned cnt, ...) {
+    std::vector<ERL_NIF_TERM> items(cnt);
+    va_list va;
+    va_start(va, cnt);
+    for (unsigned i = 0; i < cnt; ++i) items[i] = va_arg(va, ERL_NIF_TERM);
+    va_end(va);
+    return enif_make_list_from_array(env, items.data(), cnt);
+}
+
+int enif_is_list(ErlNifEnv *env, ERL_NIF_TERM term) {
+    Kind kind = from_term(term)->kind;
+    return kind == Kind::Cons || kind == Kind::Nil;
+}
+
+int enif_is_empty_list(ErlNifEnv *env, ERL_NIF_TERM term) {
+    return from_term(term)->kind == Kind::Nil;
+}
+
+int enif_get_list_cell(ErlNifEnv *env, ERL_NIF_TERM term, ERL_NIF_TERM *head, ERL_NIF_TERM *tail) {
+    const Cons *cons = as<Cons>(term, Kind::Cons);
+    if (cons == nullptr) return 0;
+    *head = cons->head;
+    *tail = cons->tail;
+    return 1;
+}
+
+int enif_get_list_length(ErlNifEnv *env, ERL_NIF_TERM term, unsigned *len) {
+    unsigned count = 0;
+    while (const Cons *cons = as<Cons>(term, Kind::Cons)) {
+        ++count;
+        term = cons->tail;
+    }
+    if (from_term(term)->kind != Kind::Nil) return 0;
+    *len = count;
+    return 1;
+}
+
+// ------- tuples -------
+
+ERL_NIF_TERM enif_make_tuple_from_array(ErlNifEnv *env, const ERL_NIF_TERM arr[], unsigned cnt) {
+    Tuple *tuple = env->alloc<Tuple>(sizeof(ERL_NIF_TERM) * cnt);
+    tuple->kind = Kind::Tuple;
+    tuple->arity = cnt;
+    memcpy(tuple->items, arr, sizeof(ERL_NIF_TERM) * cnt);
+    return to_term(tuple);
+}
+
+ERL_NIF_TERM enif_make_tuple(ErlNifEnv *env, unsigned cnt, ...) {
+    std::vector<ERL_NIF_TERM> items(cnt);
+    va_list va;
+    va_start(va, cnt);
+    for (unsigned i = 0; i < cnt; ++i) items[i] = va_arg(va, ERL_NIF_TERM);
+    va_end(va);
+    return enif_make_tuple_from_array(env, items.data(), cnt);
+}
+
+int enif_is_tuple(ErlNifEnv *env, ERL_NIF_TERM term) {
+    return from_term(term)->kind == Kind::Tuple;
+}
+
+int enif_get_tuple(ErlNifEnv *env, ERL_NIF_TERM term, int *arity, const ERL_NIF_TERM **array) {
+    const Tuple *tuple = as<Tuple>(term, Kind::Tuple);
+    if (tuple == nullptr) return 0;
+    *arity = (int)tuple->arity;
+    *array = tuple->items;
+    return 1;
+}
+
+// ------- maps -------
+
+int enif_make_map_from_arrays(ErlNifEnv *env, ERL_NIF_TERM keys[], ERL_NIF_TERM values[], size_t cnt, ERL_NIF_TERM *map_out) {
+    Map *map = env->alloc<Map>(sizeof(ERL_NIF_TERM) * cnt * 2);
+    map->kind = Kind::Map;
+    map->size = cnt;
+    if (cnt > 0) {
+        memcpy(map->items, keys, sizeof(ERL_NIF_TERM) * cnt);
+        memcpy(map->items + cnt, values, sizeof(ERL_NIF_TERM) * cnt);
+    }
+    *map_out = to_term(map);
+    return 1;
+}
+
+int enif_is_map(ErlNifEnv *env, ERL_NIF_TERM term) {
+    return from_term(term)->kind == Kind::Map;
+}
+
+int enif_get_map_size(ErlNifEnv *env, ERL_NIF_TERM term, size_t *size) {
+    const Map *map = as<Map>(term, Kind::Map);
+    if (map == nullptr) return 0;
+    *size = map->size;
+    return 1;
+}
+
+// ------- comparison -------
+
+// structurally equal terms are not identical here, which is enough for atoms
+int enif_is_identical(ERL_NIF_TERM lhs, ERL_NIF_TERM rhs) {
+    return lhs == rhs;
+}
+
+// ------- outside of the term API -------
+
+// referenced by nif_utils.hpp, but never reached from the conversion core
+
+ERL_NIF_TERM enif_make_binary(ErlNifEnv *env, ErlNifBinary *bin) {
+    unsupported("enif_make_binary");
+}
+
+int enif_get_string(ErlNifEnv *env, ERL_NIF_TERM term, char *buf, unsigned len, ErlNifCharEncoding encoding) {
+    unsupported("enif_get_string");
+}
+
+ERL_NIF_TERM enif_make_string(ErlNifEnv *env, const char *string, ErlNifCharEncoding encoding) {
+    unsupported("enif_make_string");
+}
@@ -0,0 +1,18 @@
+#ifndef PYTHONX_NIF_SHIM_HPP
+#define PYTHONX_NIF_SHIM_HPP
+#pragma once
+
+#include <erl_nif.h>
+
+// A minimal implementation of the enif_* term API, enough to run the
+// conversion core in `c_src/pythonx_convert.hpp` outside of the BEAM.
+//
+// Terms live in a bump allocated heap owned by the env, like a process heap.
+// Resetting the env drops every term made in it at once, atoms are global.
+// The few enif_* functions outside the term API that are linked in abort.
+
+ErlNifEnv * pythonx_shim_env_new();
+void pythonx_shim_env_reset(ErlNifEnv *env);
+void pythonx_shim_env_free(ErlNifEnv *env);
+
+#endif  // PYTHONX_NIF_SHIM_HPP
@@ -0,0 +1,24 @@
+# Runs the benchmark suite and writes the results as JSON.
+#
+#     mix run bench/run.exs [group ...]
+#
+# The groups are codec, c_api, vector, inline and concurrency, all of them run by
+# default. Results are written to $BENCH_OUTPUT, `bench_output.json` by default,
+# with the environment they were measured in, so that runs can be compared.
+
+Code.require_file("bench_helper.exs", __DIR__)
+
+Pythonx.initialize_once()
+
+groups =
+  case System.argv() do
+    [] -> ~w(codec c_api vector inline concurrency)
+    groups -> groups
+  end
+
+for group <- groups do
+  IO.puts(:stderr, "#{group}:")
+  Code.eval_file(Path.join([__DIR__, "suite", "#{group}.exs"]))
+end
+
+Pythonx.Bench.report(System.get_env("BENCH_OUTPUT", "bench_output.json"))
@@ -0,0 +1,37 @@
+# Cost of single `Pythonx.C` calls, which is mostly the NIF call and the
+# resource allocated for each Python object returned.
+
+alias Pythonx.Bench
+alias Pythonx.C.{PyDict, PyFloat, PyList, PyLong, PyNumber, PyObject, PyTuple, PyUnicode}
+
+one = PyLong.from_long(1)
+float = PyFloat.from_double(1.5)
+string = PyUnicode.from_string("hello")
+list = PyList.new(0)
+Enum.each(1..100, &PyList.append(list, PyLong.from_long(&1)))
+tuple = PyList.as_tuple(list)
+dict = PyDict.new()
+:ok = PyDict.set_item_string(dict, "key", one)
+
+calls = [
+  {"py_none", fn -> PyObject.py_none() end},
+  {"PyLong.from_long", fn -> PyLong.from_long(42) end},
+  {"PyLong.as_long", fn -> PyLong.as_long(one) end},
+  {"PyLong round trip", fn -> 42 |> PyLong.from_long() |> PyLong.as_long() end},
+  {"PyFloat.from_double", fn -> PyFloat.from_double(1.5) end},
+  {"PyFloat.as_double", fn -> PyFloat.as_double(float) end},
+  {"PyUnicode.from_string", fn -> PyUnicode.from_string("hello") end},
+  {"PyUnicode.as_utf8", fn -> PyUnicode.as_utf8(string) end},
+  {"PyNumber.add", fn -> PyNumber.add(one, one) end},
+  {"PyList.get_item", fn -> PyList.get_item(list, 50) end},
+  {"PyList.size", fn -> PyList.size(list) end},
+  {"PyTuple.get_item", fn -> PyTuple.get_item(tuple, 50) end},
+  {"PyDict.get_item_string", fn -> PyDict.get_item_string(dict, "key") end},
+  {"PyDict.set_item_string", fn -> PyDict.set_item_string(dict, "key", one) end},
+  {"PyObject.get_attr_string", fn -> PyObject.get_attr_string(string, "upper") end},
+  {"PyObject.type", fn -> PyObject.type(string) end}
+]
+
+for {name, fun} <- calls do
+  Bench.measure("c_api", name, fun)
+end
@@ -0,0 +1,48 @@
+# Conversion between BEAM terms and Python objects, per shape and size:
+#
+#   * codec - the `Pythonx.Codec` protocols, one NIF call per element;
+#   * etf - `Pythonx.ETF`, one NIF call per value;
+#   * inline_codec - `erl_to_python` and `python_to` in `Pythonx.inline/2`, which
+#     includes the fixed cost of the call, see the inline group.
+
+alias Pythonx.Beam.PyObject
+alias Pythonx.Bench
+alias Pythonx.Codec.Encoder
+
+sizes = [1, 10, 100, 1000]
+
+inputs =
+  [
+    {"integer", 1, 42},
+    {"bignum", 1, 2 ** 100},
+    {"float", 1, 3.14},
+    {"boolean", 1, true},
+    {"nil", 1, nil}
+  ] ++
+    for(size <- [8, 1024, 65_536], do: {"string", size, String.duplicate("a", size)}) ++
+    for(size <- sizes, do: {"list_of_integers", size, Enum.to_list(1..size)}) ++
+    for(size <- sizes, do: {"list_of_strings", size, Enum.map(1..size, &"item #{&1}")}) ++
+    for(size <- sizes, do: {"map", size, Map.new(1..size, &{"key #{&1}", &1})}) ++
+    for(
+      size <- sizes,
+      do: {"nested", size, Enum.map(1..size, &%{"id" => &1, "score" => &1 * 1.5, "tags" => ["a", "b"]})}
+    )
+
+for {shape, size, value} <- inputs do
+  meta = %{shape: shape, size: size}
+  ref = Encoder.encode_c(value)
+
+  Bench.measure("codec", "encode #{shape}/#{size}", fn -> Encoder.encode_c(value) end, meta)
+  Bench.measure("codec", "decode #{shape}/#{size}", fn -> PyObject.decode(%PyObject{ref: ref}) end, meta)
+  Bench.measure("etf", "encode #{shape}/#{size}", fn -> :erlang.binary_to_term(Pythonx.ETF.encode(ref)) end, meta)
+  Bench.measure("etf", "decode #{shape}/#{size}", fn -> Pythonx.ETF.decode(:erlang.term_to_binary(value)) end, meta)
+
+  # maps cannot be injected into inline code
+  unless shape in ["map", "nested"] do
+    Bench.measure("inline_codec", "encode #{shape}/#{size}", fn -> Pythonx.inline("pass", elixir_vars: [x: value]) end, meta)
+  end
+
+  # locals are kept between calls, so `x` is only built once
+  {:ok, _} = Pythonx.inline("import json\nx = json.loads(data)", elixir_vars: [data: Jason.encode!(value)])
+  Bench.measure("inline_codec", "decode #{shape}/#{size}", fn -> Pythonx.inline("pass", return: [:x]) end, meta)
+end
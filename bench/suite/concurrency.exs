@@ -0,0 +1,23 @@
+# Throughput and latency of inline calls made by several processes at once.
+# Calls are serialized on the interpreter, so throughput should stay flat
+# while latency grows with the number of processes.
+
+alias Pythonx.Bench
+
+calls = String.to_integer(System.get_env("BENCH_CONCURRENT_CALLS", "2000"))
+
+workloads = [
+  {"small", "y = x + 1"},
+  {"medium", "y = sum(range(x * 1000))"}
+]
+
+for {workload, code} <- workloads, processes <- [1, 2, 4, 8, 16, 32] do
+  Bench.measure_concurrent(
+    "concurrency",
+    "#{workload} x#{processes}",
+    processes,
+    div(calls, processes),
+    fn -> Pythonx.inline(code, return: [:y], elixir_vars: [x: 1]) end,
+    %{workload: workload}
+  )
+end
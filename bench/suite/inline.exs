@@ -0,0 +1,19 @@
+# Fixed cost of `Pythonx.inline/2`, depending on how the code object is obtained.
+
+alias Pythonx.Bench
+
+source = "y = x + 1"
+{:ok, analysis} = Pythonx.Symtable.analyze(source)
+bytecode = {analysis.magic, analysis.bytecode}
+precompiled = "y = x + 2"
+{:ok, _} = Pythonx.Nif.precompile(precompiled)
+
+Bench.measure("inline", "empty", fn -> Pythonx.inline("pass") end)
+Bench.measure("inline", "source", fn -> Pythonx.inline(source, return: [:y], elixir_vars: [x: 1]) end)
+
+Bench.measure("inline", "bytecode", fn ->
+  Pythonx.inline(source, return: [:y], elixir_vars: [x: 1], bytecode: bytecode)
+end)
+
+Bench.measure("inline", "precompiled", fn -> Pythonx.inline(precompiled, return: [:y], elixir_vars: [x: 1]) end)
+Bench.measure("inline", "locals", fn -> Pythonx.inline("pass", locals: true) end)
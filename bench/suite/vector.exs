@@ -0,0 +1,21 @@
+# Elementwise arithmetic over 1000 numbers, one `PyNumber` call per element
+# against `Pythonx.Vector` on lists and on packed binaries.
+
+alias Pythonx.Bench
+alias Pythonx.C.{PyFloat, PyNumber}
+
+size = 1000
+floats = Enum.map(1..size, &(&1 * 0.5))
+refs = Enum.map(floats, &PyFloat.from_double/1)
+packed = Pythonx.Vector.pack(floats, :f64)
+
+calls = [
+  {"PyNumber.multiply per element", fn -> Enum.map(refs, &PyNumber.multiply(&1, &1)) end},
+  {"Vector.number list", fn -> Pythonx.Vector.number(:multiply, floats, floats) end},
+  {"Vector.number f64", fn -> Pythonx.Vector.number(:multiply, {:f64, packed}, {:f64, packed}, into: :f64) end},
+  {"Vector.number remainder f64", fn -> Pythonx.Vector.number(:remainder, {:f64, packed}, 7.0, into: :f64) end}
+]
+
+for {name, fun} <- calls do
+  Bench.measure("vector", name, fun)
+end
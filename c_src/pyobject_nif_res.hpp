@@ -5,25 +5,93 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include <erl_nif.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "nif_utils.hpp"
 #include "pythonx_consts.hpp"
+#include "pythonx_deferred.hpp"
 
 struct PyObjectNifRes {
     PyObject * val;
     bool borrowed = false;
+    // the interpreter the reference belongs to, see pythonx_deferred.hpp
+    uint64_t epoch = pythonx_current_epoch();
+    // counted in the number of live resources, see pythonx_census.hpp
+    bool census_counted = false;
+    // linked into the census list, only while the census is enabled
+    std::atomic<bool> census_linked{false};
+    uint32_t census_site = 0;
+    PyObjectNifRes * census_prev = nullptr;
+    PyObjectNifRes * census_next = nullptr;
     static ErlNifResourceType *type;
 };
 
+// Resources made by nonnull_pyobject_to_nifres are counted, and while the
+// census is enabled also linked into a list that the census walks.
+static std::atomic<int64_t> pythonx_census_live{0};
+static std::atomic<bool> pythonx_census_enabled{false};
+static std::mutex pythonx_census_mutex;
+static PyObjectNifRes * pythonx_census_head = nullptr;
+// allocation site tags of processes, site 0 is untagged
+static std::atomic<int64_t> pythonx_census_tagged{0};
+static std::unordered_map<ERL_NIF_TERM, uint32_t> pythonx_census_process_sites;
+static std::vector<std::string> pythonx_census_site_names{""};
+
+static void pythonx_census_track(ErlNifEnv *env, PyObjectNifRes *res) {
+    res->census_counted = true;
+    pythonx_census_live.fetch_add(1, std::memory_order_relaxed);
+    if (!pythonx_census_enabled.load(std::memory_order_relaxed)) return;
+
+    ErlNifPid self;
+    bool tagged = pythonx_census_tagged.load(std::memory_order_relaxed) > 0 && env != nullptr && enif_self(env, &self) != nullptr;
+
+    std::lock_guard<std::mutex> guard(pythonx_census_mutex);
+    // disabled meanwhile
+    if (!pythonx_census_enabled.load(std::memory_order_relaxed)) return;
+    if (tagged) {
+        auto it = pythonx_census_process_sites.find(self.pid);
+        if (it != pythonx_census_process_sites.end()) res->census_site = it->second;
+    }
+    res->census_prev = nullptr;
+    res->census_next = pythonx_census_head;
+    if (pythonx_census_head) pythonx_census_head->census_prev = res;
+    pythonx_census_head = res;
+    res->census_linked.store(true, std::memory_order_relaxed);
+}
+
+static void pythonx_census_untrack(PyObjectNifRes *res) {
+    if (res->census_counted) pythonx_census_live.fetch_sub(1, std::memory_order_relaxed);
+    if (!res->census_linked.load(std::memory_order_acquire)) return;
+
+    std::lock_guard<std::mutex> guard(pythonx_census_mutex);
+    // unlinked meanwhile, by disabling the census
+    if (!res->census_linked.load(std::memory_order_relaxed)) return;
+    if (res->census_prev) {
+        res->census_prev->census_next = res->census_next;
+    } else {
+        pythonx_census_head = res->census_next;
+    }
+    if (res->census_next) res->census_next->census_prev = res->census_prev;
+    res->census_linked.store(false, std::memory_order_relaxed);
+}
+
 static void destruct_py_object(ErlNifEnv *env, void * args) {
     // args can't be nullptr
-    // Py_XDECREF check if val is nullptr before decrementing the reference count
     auto res = (struct PyObjectNifRes *)args;
-    if (!res->borrowed) Py_XDECREF(res->val);
+    pythonx_census_untrack(res);
+    // destructors run without the python mutex, the reference is dropped by the next call that takes it
+    if (!res->borrowed && res->val != nullptr) pythonx_defer_decref(res->val, res->epoch);
 }
 
 template <typename T>
 auto allocate_resource() -> T * {
-    return (T *)enif_alloc_resource(T::type, sizeof(T));
+    void *ptr = enif_alloc_resource(T::type, sizeof(T));
+    // runs the default member initializers
+    return ptr ? new (ptr) T() : nullptr;
 }
 
 template <typename T>
@@ -1,15 +1,33 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <marshal.h>
 #include <erl_nif.h>
 #include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <dlfcn.h>
 #include "nif_utils.hpp"
+#include "pythonx_allocator.hpp"
 #include "pythonx_consts.hpp"
+#include "pythonx_convert.hpp"
 #include "pyobject_nif_res.hpp"
+#include "pythonx_census.hpp"
+#include "pythonx_deferred.hpp"
+#include "pythonx_etf.hpp"
+#include "pythonx_gc.hpp"
+#include "pythonx_handle.hpp"
+#include "pythonx_lock_profile.hpp"
+#include "pythonx_output.hpp"
+#include "pythonx_pickle.hpp"
+#include "pythonx_pipeline.hpp"
+#include "pythonx_vector.hpp"
+#include "pythonx_call.hpp"
+#include "pythonx_iter.hpp"
+#include "pythonx_profile.hpp"
 #include "pythonx_pyanyset.hpp"
 #include "pythonx_pyerr.hpp"
 #include "pythonx_pydict.hpp"
@@ -27,260 +45,23 @@
 #include "pythonx_pyunicode.hpp"
 
 char pythonx_mutex_name[] = {"python_mutex"};
+char pythonx_handle_mutex_name[] = {"pythonx_handle_mutex"};
 static ErlNifMutex * python_mutex = nullptr;
 static bool python_initialized = false;
 static PyObject * local_dict;
 static PyObject * global_dict;
 static PyConfig config;
 
-ErlNifResourceType * PyObjectNifRes::type = nullptr;
-
-// ------- Helper functions for NIF -------
-// Convert Python objects to Erlang terms
-static std::optional<ERL_NIF_TERM> python_to(ErlNifEnv *env, PyObject * dict);
-static std::optional<ERL_NIF_TERM> python_dict_to(ErlNifEnv *env, PyObject * dict);
-static std::optional<ERL_NIF_TERM> python_tuple_to(ErlNifEnv *env, PyObject * dict);
-static std::optional<ERL_NIF_TERM> python_list_to(ErlNifEnv *env, PyObject * list);
-
-static std::optional<ERL_NIF_TERM> python_to(ErlNifEnv *env, PyObject * val) {
-    auto ret = std::nullopt;
-    if (val == nullptr) {
-        return ret;
-    }
-    if (PyLong_Check(val)) {
-        return enif_make_int64(env, PyLong_AsLong(val));
-    }
-    if (PyFloat_Check(val)) {
-        return enif_make_double(env, PyFloat_AsDouble(val));
-    }
-    if (PyUnicode_Check(val)) {
-        Py_ssize_t size;
-        const char * data = PyUnicode_AsUTF8AndSize(val, &size);
-        if (data == nullptr) {
-            return ret;
-        }
-        ERL_NIF_TERM string_val;
-        unsigned char * ptr;
-        if ((ptr = enif_make_new_binary(env, size, &string_val)) != nullptr) {
-            strncpy((char *)ptr, data, size);
-            return string_val;
-        }
-        return ret;
-    }
-    if (PyDict_Check(val)) {
-        return python_dict_to(env, val);
-    }
-    if (PyTuple_Check(val)) {
-        return python_tuple_to(env, val);
-    }
-    if (val == Py_None) {
-        return kAtomNil;
-    }
-    if (val == Py_False) {
-        return kAtomFalse;
-    }
-    if (val == Py_True) {
-        return kAtomTrue;
-    }
-    if (PyList_Check(val)) {
-        return python_list_to(env, val);
-    }
-
-    PyObject* type_obj = PyObject_Type(val);
-    PyObject* type_name_obj = PyObject_GetAttrString(type_obj, "__name__");
-    const char* type_name = PyUnicode_AsUTF8(type_name_obj);
-    // printf("[debug] type_name: %s\r\n", type_name);
-
-    // Cleanup type objects
-    Py_DECREF(type_obj);
-    Py_DECREF(type_name_obj);
-
-    return kAtomNil;
-}
-
-static std::optional<ERL_NIF_TERM> python_dict_to(ErlNifEnv *env, PyObject * dict) {
-    auto ret = std::nullopt;
-    PyObject *keys = PyDict_Keys(dict);
-    if (keys == nullptr) {
-        return ret;
-    }
-
-    Py_ssize_t size = PyList_Size(keys);
-    std::vector<ERL_NIF_TERM> erl_keys, erl_values;
-    for (Py_ssize_t i = 0; i < size; ++i) {
-        PyObject *key = PyList_GetItem(keys, i);
-        auto key_term = python_to(env, key);
-        if (!key_term) return ret;
-        erl_keys.emplace_back(key_term.value());
-
-        auto val = PyDict_GetItem(dict, key);
-        auto val_term = python_to(env, val);
-        if (!val_term) return ret;
-        erl_values.emplace_back(val_term.value());
-    }
-    Py_DECREF(keys);
-
-    ERL_NIF_TERM erl_dict;
-    if (enif_make_map_from_arrays(env, erl_keys.data(), erl_values.data(), erl_keys.size(), &erl_dict)) {
-        return erl_dict;
-    }
-    return ret;
-}
-
-static std::optional<ERL_NIF_TERM> python_tuple_to(ErlNifEnv *env, PyObject * tuple) {
-    auto ret = std::nullopt;
-    Py_ssize_t size = PyTuple_Size(tuple);
-    std::vector<ERL_NIF_TERM> erl_values;
-    for (Py_ssize_t i = 0; i < size; ++i) {
-        PyObject * item = PyTuple_GetItem(tuple, i);
-        auto item_term = python_to(env, item);
-        if (!item_term) return ret;
-        erl_values.emplace_back(item_term.value());
-    }
-    ERL_NIF_TERM erl_tuple = enif_make_tuple_from_array(env, erl_values.data(), erl_values.size());
-    return erl_tuple;
-}
-
-static std::optional<ERL_NIF_TERM> python_list_to(ErlNifEnv *env, PyObject * list) {
-    auto ret = std::nullopt;
-    Py_ssize_t size = PyList_Size(list);
-    std::vector<ERL_NIF_TERM> erl_values;
-    for (Py_ssize_t i = 0; i < size; ++i) {
-        PyObject * item = PyList_GetItem(list, i);
-        auto item_term = python_to(env, item);
-        if (!item_term) return ret;
-        erl_values.emplace_back(item_term.value());
-    }
-    ERL_NIF_TERM erl_list = enif_make_list_from_array(env, erl_values.data(), erl_values.size());
-    return erl_list;
-}
-
-static std::optional<ERL_NIF_TERM> python_items_in_dict_to(ErlNifEnv *env, PyObject * dict, std::vector<std::string> &keys) {
-    auto ret = std::nullopt;
-    Py_ssize_t keys_size = keys.size();
-    if (keys_size == 0) {
-        return ret;
-    }
-
-    PyObject *dict_keys = PyDict_Keys(dict);
-    if (dict_keys == nullptr) {
-        return ret;
-    }
-
-    std::vector<ERL_NIF_TERM> erl_values(keys.size(), kAtomNil);
-    Py_ssize_t dict_keys_size = PyList_Size(dict_keys);
-    if (dict_keys_size != 0) {
-        for (Py_ssize_t i = 0; i < dict_keys_size; ++i) {
-            PyObject *dict_key = PyList_GetItem(dict_keys, i);
-            if (dict_key != nullptr && PyUnicode_Check(dict_key)) {
-                const char* dict_key_str = PyUnicode_AsUTF8(dict_key);
-                auto it = std::find(keys.begin(), keys.end(), dict_key_str);
-                if (it != keys.end()) {
-                    size_t index = it - keys.begin();
-                    auto val = PyDict_GetItem(dict, dict_key);
-                    auto val_term = python_to(env, val);
-                    if (!val_term) return ret;
-                    erl_values[index] = val_term.value();
-                }
-            }
-        }
-    }
-    Py_DECREF(dict_keys);
-
-    ERL_NIF_TERM erl_dict = enif_make_list_from_array(env, erl_values.data(), erl_values.size());
-    return erl_dict;
-}
-
-// Convert Erlang NIF terms to Python objects
-static std::optional<PyObject *> erl_to_python(ErlNifEnv *env, ERL_NIF_TERM term) {
-    if (enif_is_atom(env, term)) {
-        if (enif_is_identical(term, kAtomNil)) {
-            Py_RETURN_NONE;
-        }
-        if (enif_is_identical(term, kAtomTrue)) {
-            Py_RETURN_TRUE;
-        }
-        if (enif_is_identical(term, kAtomFalse)) {
-            Py_RETURN_FALSE;
-        }
-
-        std::string atom;
-        if (erlang::nif::get_atom(env, term, atom)) {
-            return PyUnicode_DecodeUTF8(atom.c_str(), atom.size(), "strict");
-        } else {
-            // todo: better error handling
-            // return None if get_atom fails for now
-            Py_RETURN_NONE;
-        }
-    } else if (enif_is_binary(env, term)) {
-        ErlNifBinary binary;
-        if (enif_inspect_binary(env, term, &binary)) {
-            return PyUnicode_DecodeUTF8((const char *)binary.data, binary.size, "strict");
-        } else {
-            // todo: return None if enif_inspect_binary fails
-            Py_RETURN_NONE;
-        }
-    } else if (enif_is_list(env, term)) {
-        ERL_NIF_TERM head, tail;
-        if (enif_get_list_cell(env, term, &head, &tail)) {
-            std::vector<PyObject *> list;
-            while (enif_get_list_cell(env, term, &head, &tail)) {
-                auto item = erl_to_python(env, head);
-                if (item) {
-                    list.emplace_back(item.value());
-                } else {
-                    // todo: return None for unsupported types for now
-                    Py_RETURN_NONE;
-                }
-                term = tail;
-            }
-            PyObject *py_list = PyList_New(list.size());
-            for (size_t i = 0; i < list.size(); ++i) {
-                PyList_SetItem(py_list, i, list[i]);
-            }
-            return py_list;
-        }
-    } else if (enif_is_tuple(env, term)) {
-        int arity;
-        const ERL_NIF_TERM *arr;
-        if (enif_get_tuple(env, term, &arity, &arr)) {
-            // n-tuple maps to n-ary tuple in Python
-            PyObject *py_tuple = PyTuple_New(arity);
-            for (int i = 0; i < arity; ++i) {
-                auto item = erl_to_python(env, arr[i]);
-                if (item) {
-                    PyTuple_SetItem(py_tuple, i, item.value());
-                } else {
-                    // todo: set None for unsupported types for now
-                    PyTuple_SetItem(py_tuple, i, Py_None);
-                }
-            }
-        } else {
-            // todo: this should not happen
-            // but if it does, return None for now
-            Py_RETURN_NONE;
-        }
-    } else if (enif_is_number(env, term)) {
-        ErlNifUInt64 u64;
-        if (enif_get_uint64(env, term, &u64)) {
-            return PyLong_FromUnsignedLongLong(u64);
-        }
-        ErlNifSInt64 i64;
-        if (enif_get_int64(env, term, &i64)) {
-            return PyLong_FromLongLong(i64);
-        }
-        double num;
-        if (enif_get_double(env, term, &num)) {
-            return PyFloat_FromDouble(num);
-        }
+// Startup phase timings in microseconds, -1 when the phase did not run.
+static int64_t pythonx_dlopen_us = -1;
+static int64_t pythonx_init_us = -1;
 
-        // todo: return None for unsupported types for now
-        Py_RETURN_NONE;
-    }
+// Code objects compiled by `precompile`, reused by `inline` for the same source.
+static std::unordered_map<std::string, PyObject *> precompiled_code;
 
-    // todo: return None for unsupported types for now
-    Py_RETURN_NONE;
-}
+ErlNifResourceType * PyObjectNifRes::type = nullptr;
+ErlNifResourceType * PyBufferNifRes::type = nullptr;
+ErlNifResourceType * PyArenaNifRes::type = nullptr;
 
 // ------- Python C API functions -------
 
@@ -297,11 +78,25 @@ static void init_locals_and_globals() {
         // Initialize globals with the __builtins__ module to enable built-in functions
         PyDict_SetItemString(global_dict, "__builtins__", PyEval_GetBuiltins());
 
+        // collections are timed from here on, pausing them is still possible without the stats
+        if (pythonx_gc_install_callback() != 0) PyErr_Clear();
+
         python_initialized = true;
     }
 }
 
-static int pythonx_c_api_initialize(std::optional<std::string> user_python_home) {
+static int64_t pythonx_elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int pythonx_c_api_initialize(std::optional<std::string> user_python_home, PythonxAllocatorBackend allocator = kPythonxAllocatorNone) {
+    // the allocators must be in place before the config allocates anything,
+    // and memory from an earlier interpreter may outlive Py_Finalize
+    if (allocator != pythonx_allocator_backend && (python_mutex != nullptr || !pythonx_install_allocator(allocator))) {
+        fprintf(stderr, "Cannot change the allocator once Python has been started\r\n");
+        return -1;
+    }
+
     python_mutex = enif_mutex_create(pythonx_mutex_name);
     if (python_mutex == nullptr) {
         return -1;
@@ -331,63 +126,201 @@ static int pythonx_c_api_initialize(std::optional<std::string> user_python_home)
     PyConfig_SetBytesString(&config, &config.prefix, python_home.c_str());
     PyConfig_SetBytesString(&config, &config.exec_prefix, python_home.c_str());
 
-#ifndef __APPLE__
+#if defined(PYTHONX_STATIC_LIBPYTHON) && !defined(__APPLE__)
+    // libpython is linked into this library, which the VM loads with
+    // RTLD_LOCAL. Extension modules resolve the C API from the global
+    // namespace, so promote our own symbols instead of loading libpython3.so.
+    auto dlopen_start = std::chrono::steady_clock::now();
+    Dl_info self{};
+    if (!dladdr((const void *)&pythonx_c_api_initialize, &self) ||
+        !dlopen(self.dli_fname, RTLD_NOW | RTLD_NOLOAD | RTLD_GLOBAL)) {
+        fprintf(stderr, "Error exporting the linked libpython: %s\r\n", dlerror());
+        return -1;
+    }
+    pythonx_dlopen_us = pythonx_elapsed_us(dlopen_start);
+#elif !defined(__APPLE__)
+    auto dlopen_start = std::chrono::steady_clock::now();
     std::string so_file = python_home + "/lib/libpython3.so";
     void *handle = dlopen(so_file.c_str(), RTLD_LAZY | RTLD_GLOBAL);
     if (!handle) {
         fprintf(stderr, "Error loading libpython: %s\r\n", dlerror());
         return -1;
     }
+    pythonx_dlopen_us = pythonx_elapsed_us(dlopen_start);
 #endif
 
-    enif_mutex_lock(python_mutex);
+    pythonx_lock(python_mutex, kPythonxLockInitialize);
+    auto init_start = std::chrono::steady_clock::now();
     init_locals_and_globals();
-    enif_mutex_unlock(python_mutex);
+    pythonx_init_us = pythonx_elapsed_us(init_start);
+    pythonx_unlock(python_mutex, kPythonxLockInitialize);
 
     return 0;
 }
 
+// Takes the python mutex for code that calls into Python. The references
+// queued by resource destructors since the last time are dropped first.
+static void pythonx_enter(PythonxLockSite site) {
+    pythonx_lock(python_mutex, site);
+    if (python_initialized) pythonx_deferred_drain();
+}
+
+// Whether a NIF that runs Python code has to move to a dirty scheduler first.
+// Writes to a blocking output capture wait for the subscriber, see pythonx_output.hpp.
+static inline bool pythonx_needs_dirty() {
+    return pythonx_output_may_block() && enif_thread_type() == ERL_NIF_THR_NORMAL_SCHEDULER;
+}
+
+// Runs a NIF that calls into Python while holding the python mutex, and
+// starts Python first if needed.
+template <ERL_NIF_TERM (*nif)(ErlNifEnv *, int, const ERL_NIF_TERM[]), PythonxLockSite site>
+static ERL_NIF_TERM pythonx_locked(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (pythonx_needs_dirty()) {
+        return enif_schedule_nif(env, pythonx_lock_site_names[site], ERL_NIF_DIRTY_JOB_IO_BOUND, pythonx_locked<nif, site>, argc, argv);
+    }
+    if (python_mutex == nullptr) pythonx_c_api_initialize(std::nullopt);
+
+    pythonx_enter(site);
+    init_locals_and_globals();
+    ERL_NIF_TERM ret = nif(env, argc, argv);
+    pythonx_unlock(python_mutex, site);
+    return ret;
+}
+
+// Runs a NIF that runs Python code without the python mutex, moving to a
+// dirty scheduler first like the locked ones.
+template <ERL_NIF_TERM (*nif)(ErlNifEnv *, int, const ERL_NIF_TERM[])>
+static ERL_NIF_TERM pythonx_unlocked(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (pythonx_needs_dirty()) {
+        return enif_schedule_nif(env, "py_run", ERL_NIF_DIRTY_JOB_IO_BOUND, pythonx_unlocked<nif>, argc, argv);
+    }
+    return nif(env, argc, argv);
+}
+
 // ------- NIF functions -------
 
 static ERL_NIF_TERM pythonx_initialize(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
     std::string python_home;
-    if (!erlang::nif::get(env, argv[0], python_home)) {
+    PythonxAllocatorBackend allocator;
+    if (!erlang::nif::get(env, argv[0], python_home) || !pythonx_get_allocator_backend(env, argv[1], &allocator)) {
         return enif_make_badarg(env);
     }
 
-    if (!pythonx_c_api_initialize(python_home)) {
+    if (!pythonx_c_api_initialize(python_home, allocator)) {
         return kAtomOk;
     } else {
         return erlang::nif::error(env, "Cannot initialize Python");
     }
 }
 
-static ERL_NIF_TERM pythonx_inline(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+// Unmarshals a code object compiled ahead of time by `Pythonx.Symtable`.
+//
+// Returns nullptr without a Python error set when the bytecode was produced
+// by an interpreter with a different magic number, or cannot be read back,
+// in which case the caller compiles the source instead.
+static PyObject * pythonx_load_bytecode(const ErlNifBinary &bytecode, int64_t magic) {
+    if (magic != PyImport_GetMagicNumber()) return nullptr;
+
+    PyObject *code = PyMarshal_ReadObjectFromString((const char *)bytecode.data, (Py_ssize_t)bytecode.size);
+    if (code == nullptr || !PyCode_Check(code)) {
+        Py_XDECREF(code);
+        PyErr_Clear();
+        return nullptr;
+    }
+    return code;
+}
+
+// Where the time of an inline call goes, reported to `:telemetry` by `Pythonx.inline/2`.
+struct PythonxInlineStats {
+    int64_t mutex_wait_ns = 0;
+    int64_t inject_ns = 0;
+    int64_t compile_ns = 0;
+    int64_t execute_ns = 0;
+    int64_t convert_ns = 0;
+    size_t code_bytes = 0;
+    size_t injected = 0;
+    size_t returned = 0;
+    const char *compile = "source";
+    // type name of the exception raised by the code, if any
+    std::string error;
+};
+
+static int64_t pythonx_lap_ns(std::chrono::steady_clock::time_point &lap) {
+    auto now = std::chrono::steady_clock::now();
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - lap).count();
+    lap = now;
+    return elapsed;
+}
+
+// Returns `{result, stats}`, unless `ret` raises.
+static ERL_NIF_TERM pythonx_inline_result(ErlNifEnv *env, ERL_NIF_TERM ret, const PythonxInlineStats &stats) {
+    if (enif_has_pending_exception(env, nullptr)) return ret;
+
+    ERL_NIF_TERM keys[] = {
+        enif_make_atom(env, "mutex_wait"),
+        enif_make_atom(env, "inject"),
+        enif_make_atom(env, "compile"),
+        enif_make_atom(env, "execute"),
+        enif_make_atom(env, "convert"),
+        enif_make_atom(env, "code_bytes"),
+        enif_make_atom(env, "injected"),
+        enif_make_atom(env, "returned"),
+        enif_make_atom(env, "compiled_from"),
+        enif_make_atom(env, "error"),
+    };
+    ERL_NIF_TERM values[] = {
+        enif_make_int64(env, stats.mutex_wait_ns),
+        enif_make_int64(env, stats.inject_ns),
+        enif_make_int64(env, stats.compile_ns),
+        enif_make_int64(env, stats.execute_ns),
+        enif_make_int64(env, stats.convert_ns),
+        enif_make_uint64(env, stats.code_bytes),
+        enif_make_uint64(env, stats.injected),
+        enif_make_uint64(env, stats.returned),
+        enif_make_atom(env, stats.compile),
+        stats.error.empty() ? kAtomNil : erlang::nif::make_binary(env, stats.error.c_str()).value_or(kAtomNil),
+    };
+    ERL_NIF_TERM stats_term;
+    enif_make_map_from_arrays(env, keys, values, sizeof(keys) / sizeof(keys[0]), &stats_term);
+    return enif_make_tuple2(env, ret, stats_term);
+}
+
+// `opts` holds the return variable names, the locals and globals flags, the
+// Elixir variables to inject and the memory limit, in that order.
+static ERL_NIF_TERM pythonx_inline_run(ErlNifEnv *env, const std::string &python_code, const ErlNifBinary *bytecode, int64_t magic, const ERL_NIF_TERM opts[], PythonxInlineStats &stats) {
     if (python_mutex == nullptr) pythonx_c_api_initialize(std::nullopt);
 
-    std::string python_code;
-    if (!erlang::nif::get(env, argv[0], python_code)) {
-        return enif_make_badarg(env);
-    }
     std::vector<std::string> var_names;
-    if (!erlang::nif::get_list(env, argv[1], var_names)) {
+    if (!erlang::nif::get_list(env, opts[0], var_names)) {
         return enif_make_badarg(env);
     }
     bool get_locals = false;
-    if (!erlang::nif::get(env, argv[2], &get_locals)) {
+    if (!erlang::nif::get(env, opts[1], &get_locals)) {
         return enif_make_badarg(env);
     }
     bool get_globals = false;
-    if (!erlang::nif::get(env, argv[3], &get_globals)) {
+    if (!erlang::nif::get(env, opts[2], &get_globals)) {
         return enif_make_badarg(env);
     }
     std::map<std::string, ERL_NIF_TERM> elixir_vars;
-    if (!erlang::nif::parse_arg(env, 4, argv, elixir_vars)) {
+    if (!erlang::nif::parse_arg(env, 3, opts, elixir_vars)) {
         return enif_make_badarg(env);
     }
+    bool track_memory = false;
+    int64_t memory_limit = -1;
+    if (!pythonx_get_memory_limit(env, opts[4], &track_memory, &memory_limit)) {
+        return enif_make_badarg(env);
+    }
+    if (track_memory && pythonx_allocator_backend == kPythonxAllocatorNone) {
+        return erlang::nif::error(env, "memory limits need Python to be initialized with the :counting or :enif allocator");
+    }
     ERL_NIF_TERM ret{};
+    stats.code_bytes = bytecode ? bytecode->size : python_code.size();
+    stats.injected = elixir_vars.size();
 
-    enif_mutex_lock(python_mutex);
+    auto lap = std::chrono::steady_clock::now();
+    pythonx_enter(kPythonxLockInline);
+    stats.mutex_wait_ns = pythonx_lap_ns(lap);
 
     init_locals_and_globals();
 
@@ -395,9 +328,45 @@ static ERL_NIF_TERM pythonx_inline(ErlNifEnv *env, int argc, const ERL_NIF_TERM
         // send elixir variables to python
         PyDict_SetItemString(local_dict, var.first.c_str(), erl_to_python(env, var.second).value());
     }
+    stats.inject_ns = pythonx_lap_ns(lap);
 
-    PyObject *result = PyRun_String(python_code.c_str(), Py_file_input, global_dict, local_dict);
-    if (result == NULL) {
+    PyObject *code = bytecode ? pythonx_load_bytecode(*bytecode, magic) : nullptr;
+    if (code != nullptr) {
+        stats.compile = "bytecode";
+    } else {
+        auto precompiled = precompiled_code.find(python_code);
+        if (precompiled != precompiled_code.end()) {
+            code = precompiled->second;
+            Py_INCREF(code);
+            stats.compile = "precompiled";
+        } else {
+            // same as PyRun_String, compiling separately lets us time both steps
+            code = Py_CompileString(python_code.c_str(), "<string>", Py_file_input);
+        }
+    }
+    stats.compile_ns = pythonx_lap_ns(lap);
+
+    PyObject *result = nullptr;
+    int64_t peak_bytes = 0;
+    bool within_limit = true;
+    if (code != nullptr) {
+        if (track_memory) pythonx_call_memory_begin(memory_limit);
+        result = PyEval_EvalCode(code, global_dict, local_dict);
+        if (track_memory) within_limit = pythonx_call_memory_end(&peak_bytes);
+        Py_DECREF(code);
+    }
+    stats.execute_ns = pythonx_lap_ns(lap);
+
+    if (result == NULL && !within_limit) {
+        // the MemoryError may have been caught and replaced by another exception
+        PyErr_Clear();
+        stats.error = "MemoryError";
+        ret = enif_make_tuple2(env, kAtomError, pythonx_memory_limit_error(env, memory_limit, peak_bytes));
+    } else if (result == NULL) {
+        PyObject *error_type = PyErr_Occurred();
+        if (error_type != nullptr && PyExceptionClass_Check(error_type)) {
+            stats.error = PyExceptionClass_Name(error_type);
+        }
         // Handle error (print traceback, etc.)
         PyErr_Print();
         ret = erlang::nif::error(env, "python_error");
@@ -410,9 +379,11 @@ static ERL_NIF_TERM pythonx_inline(ErlNifEnv *env, int argc, const ERL_NIF_TERM
             result_erl = enif_make_list(env, 0, NULL);
         }
 
-        if (get_locals || get_globals) {
+        stats.returned = var_names.size();
+        if (get_locals || get_globals || track_memory) {
             std::vector<ERL_NIF_TERM> keys, values;
             if (get_locals) {
+                stats.returned += PyDict_Size(local_dict);
                 auto local_vars = python_to(env, local_dict);
                 if (local_vars) {
                     keys.emplace_back(enif_make_atom(env, "locals"));
@@ -420,12 +391,20 @@ static ERL_NIF_TERM pythonx_inline(ErlNifEnv *env, int argc, const ERL_NIF_TERM
                 }
             }
             if (get_globals) {
+                stats.returned += PyDict_Size(global_dict);
                 auto global_vars = python_to(env, global_dict);
                 if (global_vars) {
                     keys.emplace_back(enif_make_atom(env, "globals"));
                     values.emplace_back(global_vars.value());
                 }
             }
+            if (track_memory) {
+                ERL_NIF_TERM memory_key = enif_make_atom(env, "peak_bytes");
+                ERL_NIF_TERM memory_value = enif_make_int64(env, peak_bytes);
+                keys.emplace_back(enif_make_atom(env, "memory"));
+                values.emplace_back(kAtomNil);
+                enif_make_map_from_arrays(env, &memory_key, &memory_value, 1, &values.back());
+            }
             enif_make_map_from_arrays(env, keys.data(), values.data(), keys.size(), &vars_map);
             ret = erlang::nif::ok(env, enif_make_tuple2(env, result_erl, vars_map));
         } else {
@@ -434,15 +413,210 @@ static ERL_NIF_TERM pythonx_inline(ErlNifEnv *env, int argc, const ERL_NIF_TERM
 
         Py_DECREF(result);
     }
+    stats.convert_ns = pythonx_lap_ns(lap);
+    pythonx_output_request_flush();
 
-    enif_mutex_unlock(python_mutex);
+    pythonx_unlock(python_mutex, kPythonxLockInline);
+    return ret;
+}
+
+static ERL_NIF_TERM pythonx_inline(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (pythonx_needs_dirty()) {
+        return enif_schedule_nif(env, "inline", ERL_NIF_DIRTY_JOB_IO_BOUND, pythonx_inline, argc, argv);
+    }
+    std::string python_code;
+    if (!erlang::nif::get(env, argv[0], python_code)) {
+        return enif_make_badarg(env);
+    }
+    PythonxInlineStats stats;
+    return pythonx_inline_result(env, pythonx_inline_run(env, python_code, nullptr, 0, &argv[1], stats), stats);
+}
+
+static ERL_NIF_TERM pythonx_inline_bytecode(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (pythonx_needs_dirty()) {
+        return enif_schedule_nif(env, "inline_bytecode", ERL_NIF_DIRTY_JOB_IO_BOUND, pythonx_inline_bytecode, argc, argv);
+    }
+    std::string python_code;
+    if (!erlang::nif::get(env, argv[0], python_code)) {
+        return enif_make_badarg(env);
+    }
+    int64_t magic;
+    if (!erlang::nif::get(env, argv[1], &magic)) {
+        return enif_make_badarg(env);
+    }
+    ErlNifBinary bytecode;
+    if (!enif_inspect_binary(env, argv[2], &bytecode)) {
+        return enif_make_badarg(env);
+    }
+    PythonxInlineStats stats;
+    return pythonx_inline_result(env, pythonx_inline_run(env, python_code, &bytecode, magic, &argv[3], stats), stats);
+}
+
+static ERL_NIF_TERM pythonx_init_timings(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    ERL_NIF_TERM keys[] = {enif_make_atom(env, "dlopen"), enif_make_atom(env, "init")};
+    ERL_NIF_TERM values[] = {
+        pythonx_dlopen_us < 0 ? kAtomNil : enif_make_int64(env, pythonx_dlopen_us),
+        pythonx_init_us < 0 ? kAtomNil : enif_make_int64(env, pythonx_init_us)
+    };
+    ERL_NIF_TERM ret;
+    enif_make_map_from_arrays(env, keys, values, 2, &ret);
+    return ret;
+}
+
+static ERL_NIF_TERM pythonx_preload_module(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (pythonx_needs_dirty()) {
+        return enif_schedule_nif(env, "preload_module", ERL_NIF_DIRTY_JOB_IO_BOUND, pythonx_preload_module, argc, argv);
+    }
+    std::string name;
+    if (!erlang::nif::get(env, argv[0], name)) {
+        return enif_make_badarg(env);
+    }
+    if (python_mutex == nullptr) pythonx_c_api_initialize(std::nullopt);
+
+    ERL_NIF_TERM ret;
+    pythonx_enter(kPythonxLockPreloadModule);
+
+    auto start = std::chrono::steady_clock::now();
+    // the module stays in sys.modules, so later imports only do a dict lookup
+    PyObject *module = PyImport_ImportModule(name.c_str());
+    if (module == nullptr) {
+        ret = pythonx_current_pyerr(env);
+    } else {
+        ret = erlang::nif::ok(env, enif_make_int64(env, pythonx_elapsed_us(start)));
+        Py_DECREF(module);
+    }
+
+    pythonx_unlock(python_mutex, kPythonxLockPreloadModule);
+    return ret;
+}
+
+static ERL_NIF_TERM pythonx_precompile(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (pythonx_needs_dirty()) {
+        return enif_schedule_nif(env, "precompile", ERL_NIF_DIRTY_JOB_IO_BOUND, pythonx_precompile, argc, argv);
+    }
+    std::string python_code;
+    if (!erlang::nif::get(env, argv[0], python_code)) {
+        return enif_make_badarg(env);
+    }
+    if (python_mutex == nullptr) pythonx_c_api_initialize(std::nullopt);
+
+    ERL_NIF_TERM ret;
+    pythonx_enter(kPythonxLockPrecompile);
+
+    auto start = std::chrono::steady_clock::now();
+    PyObject *code = Py_CompileString(python_code.c_str(), "<string>", Py_file_input);
+    if (code == nullptr) {
+        ret = pythonx_current_pyerr(env);
+    } else {
+        int64_t elapsed = pythonx_elapsed_us(start);
+        auto inserted = precompiled_code.emplace(python_code, code);
+        if (!inserted.second) {
+            Py_DECREF(inserted.first->second);
+            inserted.first->second = code;
+        }
+        ret = erlang::nif::ok(env, enif_make_int64(env, elapsed));
+    }
+
+    pythonx_unlock(python_mutex, kPythonxLockPrecompile);
+    return ret;
+}
+
+static ERL_NIF_TERM pythonx_pipeline(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (pythonx_needs_dirty()) {
+        return enif_schedule_nif(env, "pipeline", ERL_NIF_DIRTY_JOB_IO_BOUND, pythonx_pipeline, argc, argv);
+    }
+    // decoded before taking the lock, a malformed batch never runs
+    PythonxPipeline pipeline;
+    if (!pythonx_pipeline_parse(env, argv[0], argv[1], argv[2], pipeline)) {
+        return enif_make_badarg(env);
+    }
+    if (python_mutex == nullptr) pythonx_c_api_initialize(std::nullopt);
+
+    pythonx_enter(kPythonxLockPipeline);
+    ERL_NIF_TERM ret = pythonx_pipeline_run(env, pipeline);
+    pythonx_unlock(python_mutex, kPythonxLockPipeline);
+    return ret;
+}
+
+static ERL_NIF_TERM pythonx_call(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (pythonx_needs_dirty()) {
+        return enif_schedule_nif(env, "call", ERL_NIF_DIRTY_JOB_IO_BOUND, pythonx_call, argc, argv);
+    }
+    PythonxCall call;
+    if (!pythonx_call_parse(env, argv, call)) {
+        return enif_make_badarg(env);
+    }
+    if (python_mutex == nullptr) pythonx_c_api_initialize(std::nullopt);
+
+    pythonx_enter(kPythonxLockCall);
+    ERL_NIF_TERM ret = pythonx_call_run(env, call);
+    pythonx_unlock(python_mutex, kPythonxLockCall);
+    return ret;
+}
+
+static ERL_NIF_TERM pythonx_number_vector(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (pythonx_needs_dirty()) {
+        return enif_schedule_nif(env, "number_vector", ERL_NIF_DIRTY_JOB_IO_BOUND, pythonx_number_vector, argc, argv);
+    }
+    PythonxVector vector;
+    if (!pythonx_vector_parse(env, argv, vector)) {
+        return enif_make_badarg(env);
+    }
+    // plain numbers in and out never wait for the interpreter
+    ERL_NIF_TERM ret;
+    if (pythonx_vector_run_native(env, vector, &ret)) return ret;
+    if (python_mutex == nullptr) pythonx_c_api_initialize(std::nullopt);
+
+    pythonx_enter(kPythonxLockVector);
+    ret = pythonx_vector_run(env, vector);
+    pythonx_unlock(python_mutex, kPythonxLockVector);
+    return ret;
+}
+
+static ERL_NIF_TERM pythonx_iter_new(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (pythonx_needs_dirty()) {
+        return enif_schedule_nif(env, "iter_new", ERL_NIF_DIRTY_JOB_IO_BOUND, pythonx_iter_new, argc, argv);
+    }
+    if (python_mutex == nullptr) pythonx_c_api_initialize(std::nullopt);
+
+    pythonx_enter(kPythonxLockIter);
+    ERL_NIF_TERM ret = pythonx_iter_open(env, argv[0]);
+    pythonx_unlock(python_mutex, kPythonxLockIter);
+    return ret;
+}
+
+static ERL_NIF_TERM pythonx_iter_send(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (pythonx_needs_dirty()) {
+        return enif_schedule_nif(env, "iter_send", ERL_NIF_DIRTY_JOB_IO_BOUND, pythonx_iter_send, argc, argv);
+    }
+    PyObjectNifRes *iterator = get_resource<PyObjectNifRes>(env, argv[0]);
+    int64_t count;
+    ErlNifPid pid;
+    if (unlikely(iterator == nullptr) || !erlang::nif::get(env, argv[1], &count) || count <= 0 || !enif_get_local_pid(env, argv[2], &pid)) {
+        return enif_make_badarg(env);
+    }
+    if (python_mutex == nullptr) pythonx_c_api_initialize(std::nullopt);
+
+    pythonx_enter(kPythonxLockIter);
+    ERL_NIF_TERM ret = pythonx_iter_send_chunk(env, iterator->val, count, &pid, argv[3]);
+    pythonx_unlock(python_mutex, kPythonxLockIter);
     return ret;
 }
 
 static ERL_NIF_TERM pythonx_finalize(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-    enif_mutex_lock(python_mutex);
+    pythonx_lock(python_mutex, kPythonxLockFinalize);
 
     if (python_initialized) {
+        pyhandle_release_all();
+        pythonx_profile_detach();
+        pythonx_output_detach();
+        pythonx_call_clear_names();
+        pythonx_gc_detach();
+        pythonx_deferred_finalize();
+        for (auto &precompiled : precompiled_code) {
+            Py_DECREF(precompiled.second);
+        }
+        precompiled_code.clear();
         Py_DECREF(global_dict);
         Py_DECREF(local_dict);
         Py_DECREF(global_dict);
@@ -451,7 +625,7 @@ static ERL_NIF_TERM pythonx_finalize(ErlNifEnv *env, int argc, const ERL_NIF_TER
         python_initialized = false;
     }
 
-    enif_mutex_unlock(python_mutex);
+    pythonx_unlock(python_mutex, kPythonxLockFinalize);
     return kAtomOk;
 }
 
@@ -530,6 +704,9 @@ static ERL_NIF_TERM pythonx_py_single_input(ErlNifEnv *env, int argc, const ERL_
 static int on_load(ErlNifEnv *env, void **_sth1, ERL_NIF_TERM _sth2) {
     init_pythonx_consts(env);
 
+    pyhandle_mutex = enif_mutex_create(pythonx_handle_mutex_name);
+    if (pyhandle_mutex == nullptr) return -1;
+
     ErlNifResourceType *rt;
     {
         using res_type = PyObjectNifRes;
@@ -537,6 +714,18 @@ static int on_load(ErlNifEnv *env, void **_sth1, ERL_NIF_TERM _sth2) {
         if (!rt) return -1;
         res_type::type = rt;
     }
+    {
+        using res_type = PyBufferNifRes;
+        rt = enif_open_resource_type(env, "Elixir.Pythonx.Nif", "Pythonx.PyBuffer", destruct_py_buffer, ERL_NIF_RT_CREATE, NULL);
+        if (!rt) return -1;
+        res_type::type = rt;
+    }
+    {
+        using res_type = PyArenaNifRes;
+        rt = enif_open_resource_type(env, "Elixir.Pythonx.Nif", "Pythonx.PyArena", destruct_py_arena, ERL_NIF_RT_CREATE, NULL);
+        if (!rt) return -1;
+        res_type::type = rt;
+    }
 
     return 0;
 }
@@ -550,8 +739,15 @@ static int on_upgrade(ErlNifEnv *_sth0, void **_sth1, void **_sth2, ERL_NIF_TERM
 }
 
 static ErlNifFunc nif_functions[] = {
-    {"initialize", 1, pythonx_initialize, 0},
-    {"inline", 5, pythonx_inline, 0},
+    {"initialize", 2, pythonx_initialize, 0},
+    {"inline", 6, pythonx_inline, 0},
+    {"inline_bytecode", 8, pythonx_inline_bytecode, 0},
+    {"init_timings", 0, pythonx_init_timings, 0},
+    {"preload_module", 1, pythonx_preload_module, 0},
+    {"precompile", 1, pythonx_precompile, 0},
+    {"memory_stats", 0, pythonx_memory_stats, 0},
+    {"lock_stats", 0, pythonx_lock_stats, 0},
+    {"lock_stats_reset", 0, pythonx_lock_stats_reset, 0},
     {"finalize", 0, pythonx_finalize, 0},
     {"nif_loaded", 0, pythonx_nif_loaded, 0},
 
@@ -561,6 +757,56 @@ static ErlNifFunc nif_functions[] = {
     {"py_incref", 1, pythonx_py_incref, 0},
     {"py_decref", 1, pythonx_py_decref, 0},
 
+    {"etf_encode", 1, pythonx_locked<pythonx_etf_encode, kPythonxLockEtf>, 0},
+    {"etf_decode", 1, pythonx_locked<pythonx_etf_decode, kPythonxLockEtf>, 0},
+
+    {"pickle_dumps", 1, pythonx_locked<pythonx_pickle_dumps, kPythonxLockPickle>, 0},
+    {"pickle_loads", 2, pythonx_locked<pythonx_pickle_loads, kPythonxLockPickle>, 0},
+
+    {"gc_collect", 1, pythonx_locked<pythonx_gc_collect, kPythonxLockGC>, 0},
+    {"gc_set_enabled", 1, pythonx_locked<pythonx_gc_set_enabled, kPythonxLockGC>, 0},
+    {"gc_get_threshold", 0, pythonx_locked<pythonx_gc_get_threshold, kPythonxLockGC>, 0},
+    {"gc_set_threshold", 3, pythonx_locked<pythonx_gc_set_threshold, kPythonxLockGC>, 0},
+    {"gc_freeze", 0, pythonx_locked<pythonx_gc_freeze, kPythonxLockGC>, 0},
+    {"gc_unfreeze", 0, pythonx_locked<pythonx_gc_unfreeze, kPythonxLockGC>, 0},
+    {"gc_stats", 0, pythonx_locked<pythonx_gc_stats, kPythonxLockGC>, 0},
+    {"gc_stats_reset", 0, pythonx_gc_stats_reset, 0},
+
+    {"profiler_start", 1, pythonx_locked<pythonx_profiler_start, kPythonxLockProfiler>, 0},
+    {"profiler_stop", 0, pythonx_locked<pythonx_profiler_stop, kPythonxLockProfiler>, 0},
+    {"profiler_collapsed", 0, pythonx_profiler_collapsed, 0},
+    {"output_capture", 6, pythonx_locked<pythonx_output_capture, kPythonxLockOutput>, 0},
+    {"output_release", 0, pythonx_locked<pythonx_output_release, kPythonxLockOutput>, 0},
+    {"output_flush", 0, pythonx_output_flush, 0},
+    {"output_ack", 2, pythonx_output_ack, 0},
+
+    {"handle_new", 2, pythonx_locked<pythonx_handle_new, kPythonxLockHandle>, 0},
+    {"handle_to_ref", 1, pythonx_locked<pythonx_handle_to_ref, kPythonxLockHandle>, 0},
+    {"handle_release", 1, pythonx_locked<pythonx_handle_release, kPythonxLockHandle>, 0},
+    {"handle_count", 0, pythonx_handle_count, 0},
+    {"handle_from_long", 2, pythonx_locked<pythonx_handle_from_long, kPythonxLockHandle>, 0},
+    {"handle_as_long", 1, pythonx_locked<pythonx_handle_as_long, kPythonxLockHandle>, 0},
+    {"handle_number", 4, pythonx_locked<pythonx_handle_number, kPythonxLockHandle>, 0},
+    {"handle_list", 2, pythonx_locked<pythonx_handle_list, kPythonxLockHandle>, 0},
+    {"handle_tuple", 2, pythonx_locked<pythonx_handle_tuple, kPythonxLockHandle>, 0},
+    {"handle_dict", 2, pythonx_locked<pythonx_handle_dict, kPythonxLockHandle>, 0},
+    {"handle_items", 2, pythonx_locked<pythonx_handle_items, kPythonxLockHandle>, 0},
+    {"handle_get_attrs", 3, pythonx_locked<pythonx_handle_get_attrs, kPythonxLockHandle>, 0},
+    {"pipeline", 3, pythonx_pipeline, 0},
+    {"call", 6, pythonx_call, 0},
+    {"iter_new", 1, pythonx_iter_new, 0},
+    {"iter_send", 4, pythonx_iter_send, 0},
+    {"number_vector", 5, pythonx_number_vector, 0},
+    {"arena_new", 0, pythonx_arena_new, 0},
+    {"arena_adopt", 2, pythonx_arena_adopt, 0},
+    {"arena_release", 1, pythonx_locked<pythonx_arena_release, kPythonxLockArena>, 0},
+    {"arena_size", 1, pythonx_arena_size, 0},
+
+    {"census", 1, pythonx_locked<pythonx_census, kPythonxLockCensus>, 0},
+    {"census_count", 0, pythonx_census_count, 0},
+    {"census_set_enabled", 1, pythonx_census_set_enabled, 0},
+    {"census_tag", 1, pythonx_census_tag, 0},
+
     {"py_anyset_check", 1, pythonx_py_anyset_check, 0},
     {"py_anyset_check_exact", 1, pythonx_py_anyset_check_exact, 0},
 
@@ -724,8 +970,8 @@ static ErlNifFunc nif_functions[] = {
     {"py_unicode_from_string", 1, pythonx_py_unicode_from_string, 0},
     {"py_unicode_as_utf8", 1, pythonx_py_unicode_as_utf8, 0},
 
-    {"py_run_simple_string", 1, pythonx_py_run_simple_string, 0},
-    {"py_run_string", 4, pythonx_py_run_string, 0},
+    {"py_run_simple_string", 1, pythonx_unlocked<pythonx_py_run_simple_string>, 0},
+    {"py_run_string", 4, pythonx_unlocked<pythonx_py_run_string>, 0},
 
     {"py_print_raw", 0, pythonx_py_print_raw, 0},
     {"py_eval_input", 0, pythonx_py_eval_input, 0},
@@ -0,0 +1,346 @@
+#ifndef PYTHONX_ALLOCATOR_HPP
+#define PYTHONX_ALLOCATOR_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <erl_nif.h>
+#include <atomic>
+#include <cstring>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+
+// Instrumented CPython memory allocators.
+//
+// Every domain (raw, mem and obj) is wrapped so that each block carries a
+// small header with its size, which lets us keep live byte and block counts
+// per domain. Blocks are forwarded to the allocators that were installed
+// before, so the mem and obj domains keep using pymalloc, which serves small
+// blocks from its arenas and falls back to the raw domain for large ones.
+// With `enif`, the raw domain and the arenas are taken from `enif_alloc`, so
+// that all memory used by Python shows up in `:erlang.memory/0`.
+//
+// The allocators can only be installed before the interpreter allocates
+// anything, and are never removed.
+//
+// Memory taken from the system, that is raw blocks and pymalloc arenas, is
+// also charged to the call being run, if any, which may have a limit. Going
+// over the limit fails the allocation, and Python raises MemoryError.
+
+enum PythonxAllocatorBackend {
+    kPythonxAllocatorNone = 0,
+    kPythonxAllocatorCounting,
+    kPythonxAllocatorEnif,
+};
+
+struct PythonxAllocStats {
+    std::atomic<int64_t> bytes{0};
+    std::atomic<int64_t> blocks{0};
+    std::atomic<int64_t> peak_bytes{0};
+    std::atomic<int64_t> allocations{0};
+};
+
+struct PythonxAllocCtx {
+    PythonxAllocStats *stats;
+    PyMemAllocatorEx prev;
+    bool enif;
+    bool charged;
+};
+
+struct PythonxCallMemory {
+    std::atomic<bool> active{false};
+    std::atomic<bool> exceeded{false};
+    int64_t baseline = 0;
+    // -1 for no limit
+    int64_t limit = -1;
+    std::atomic<int64_t> peak_bytes{0};
+};
+
+// raw, mem, obj and pymalloc arenas
+static PythonxAllocStats pythonx_alloc_stats[4];
+static PythonxAllocCtx pythonx_alloc_ctx[3];
+static PyObjectArenaAllocator pythonx_prev_arena_allocator;
+static PythonxAllocatorBackend pythonx_allocator_backend = kPythonxAllocatorNone;
+static std::atomic<int64_t> pythonx_system_bytes{0};
+static PythonxCallMemory pythonx_call_memory;
+
+// keeps the returned blocks 16-byte aligned, as CPython expects on 64-bit platforms
+struct alignas(16) PythonxAllocHeader {
+    size_t size;
+    void * base;
+};
+
+static inline PythonxAllocHeader * pythonx_alloc_header(void *ptr) {
+    return (PythonxAllocHeader *)ptr - 1;
+}
+
+static inline void pythonx_update_peak(std::atomic<int64_t> &peak_bytes, int64_t bytes) {
+    int64_t peak = peak_bytes.load(std::memory_order_relaxed);
+    while (bytes > peak && !peak_bytes.compare_exchange_weak(peak, bytes, std::memory_order_relaxed)) {}
+}
+
+static inline void pythonx_count_alloc(PythonxAllocStats *stats, size_t size) {
+    int64_t bytes = stats->bytes.fetch_add((int64_t)size, std::memory_order_relaxed) + (int64_t)size;
+    stats->blocks.fetch_add(1, std::memory_order_relaxed);
+    stats->allocations.fetch_add(1, std::memory_order_relaxed);
+    pythonx_update_peak(stats->peak_bytes, bytes);
+}
+
+static inline void pythonx_count_free(PythonxAllocStats *stats, size_t size) {
+    stats->bytes.fetch_sub((int64_t)size, std::memory_order_relaxed);
+    stats->blocks.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// Returns false, without charging anything, if the call being run would go over its limit.
+static inline bool pythonx_charge(size_t size) {
+    int64_t total = pythonx_system_bytes.fetch_add((int64_t)size, std::memory_order_relaxed) + (int64_t)size;
+    if (pythonx_call_memory.active.load(std::memory_order_acquire)) {
+        int64_t used = total - pythonx_call_memory.baseline;
+        if (pythonx_call_memory.limit >= 0 && used > pythonx_call_memory.limit) {
+            pythonx_system_bytes.fetch_sub((int64_t)size, std::memory_order_relaxed);
+            pythonx_call_memory.exceeded.store(true, std::memory_order_relaxed);
+            return false;
+        }
+        pythonx_update_peak(pythonx_call_memory.peak_bytes, used);
+    }
+    return true;
+}
+
+static inline void pythonx_uncharge(size_t size) {
+    pythonx_system_bytes.fetch_sub((int64_t)size, std::memory_order_relaxed);
+}
+
+static void * pythonx_alloc_block(PythonxAllocCtx *ctx, size_t size, bool zero) {
+    if (size > PY_SSIZE_T_MAX - 2 * sizeof(PythonxAllocHeader)) return nullptr;
+    if (ctx->charged && !pythonx_charge(size)) return nullptr;
+
+    void *base;
+    char *ptr;
+    if (ctx->enif) {
+        // enif_alloc only guarantees 8-byte alignment
+        base = enif_alloc(size + 2 * sizeof(PythonxAllocHeader));
+        uintptr_t aligned = ((uintptr_t)base + sizeof(PythonxAllocHeader) + 15) & ~(uintptr_t)15;
+        ptr = (char *)aligned;
+        if (base != nullptr && zero) memset(ptr, 0, size);
+    } else {
+        size_t total = size + sizeof(PythonxAllocHeader);
+        base = zero ? ctx->prev.calloc(ctx->prev.ctx, 1, total) : ctx->prev.malloc(ctx->prev.ctx, total);
+        ptr = (char *)base + sizeof(PythonxAllocHeader);
+    }
+    if (base == nullptr) {
+        if (ctx->charged) pythonx_uncharge(size);
+        return nullptr;
+    }
+
+    PythonxAllocHeader *header = pythonx_alloc_header(ptr);
+    header->size = size;
+    header->base = base;
+    pythonx_count_alloc(ctx->stats, size);
+    return ptr;
+}
+
+static void * pythonx_malloc(void *ctx, size_t size) {
+    return pythonx_alloc_block((PythonxAllocCtx *)ctx, size, false);
+}
+
+static void * pythonx_calloc(void *ctx, size_t nelem, size_t elsize) {
+    if (elsize != 0 && nelem > (size_t)PY_SSIZE_T_MAX / elsize) return nullptr;
+    return pythonx_alloc_block((PythonxAllocCtx *)ctx, nelem * elsize, true);
+}
+
+static void pythonx_free(void *ctx, void *ptr) {
+    if (ptr == nullptr) return;
+
+    auto alloc_ctx = (PythonxAllocCtx *)ctx;
+    PythonxAllocHeader *header = pythonx_alloc_header(ptr);
+    pythonx_count_free(alloc_ctx->stats, header->size);
+    if (alloc_ctx->charged) pythonx_uncharge(header->size);
+    if (alloc_ctx->enif) {
+        enif_free(header->base);
+    } else {
+        alloc_ctx->prev.free(alloc_ctx->prev.ctx, header->base);
+    }
+}
+
+static void * pythonx_realloc(void *ctx, void *ptr, size_t new_size) {
+    if (ptr == nullptr) return pythonx_malloc(ctx, new_size);
+
+    auto alloc_ctx = (PythonxAllocCtx *)ctx;
+    PythonxAllocHeader *header = pythonx_alloc_header(ptr);
+    size_t old_size = header->size;
+
+    if (alloc_ctx->enif) {
+        // enif_realloc may move the block to a different alignment
+        void *new_ptr = pythonx_alloc_block(alloc_ctx, new_size, false);
+        if (new_ptr == nullptr) return nullptr;
+        memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+        pythonx_free(ctx, ptr);
+        return new_ptr;
+    }
+
+    if (new_size > PY_SSIZE_T_MAX - sizeof(PythonxAllocHeader)) return nullptr;
+    bool grows = alloc_ctx->charged && new_size > old_size;
+    if (grows && !pythonx_charge(new_size - old_size)) return nullptr;
+    void *base = alloc_ctx->prev.realloc(alloc_ctx->prev.ctx, header->base, new_size + sizeof(PythonxAllocHeader));
+    if (base == nullptr) {
+        if (grows) pythonx_uncharge(new_size - old_size);
+        return nullptr;
+    }
+    if (alloc_ctx->charged && new_size < old_size) pythonx_uncharge(old_size - new_size);
+
+    char *new_ptr = (char *)base + sizeof(PythonxAllocHeader);
+    header = pythonx_alloc_header(new_ptr);
+    header->size = new_size;
+    header->base = base;
+    pythonx_count_free(alloc_ctx->stats, old_size);
+    pythonx_count_alloc(alloc_ctx->stats, new_size);
+    return new_ptr;
+}
+
+static void * pythonx_arena_alloc(void *ctx, size_t size) {
+    if (!pythonx_charge(size)) return nullptr;
+    void *ptr = pythonx_allocator_backend == kPythonxAllocatorEnif
+        ? enif_alloc(size)
+        : pythonx_prev_arena_allocator.alloc(pythonx_prev_arena_allocator.ctx, size);
+    if (ptr == nullptr) {
+        pythonx_uncharge(size);
+        return nullptr;
+    }
+    pythonx_count_alloc(&pythonx_alloc_stats[3], size);
+    return ptr;
+}
+
+static void pythonx_arena_free(void *ctx, void *ptr, size_t size) {
+    pythonx_count_free(&pythonx_alloc_stats[3], size);
+    pythonx_uncharge(size);
+    if (pythonx_allocator_backend == kPythonxAllocatorEnif) {
+        enif_free(ptr);
+    } else {
+        pythonx_prev_arena_allocator.free(pythonx_prev_arena_allocator.ctx, ptr, size);
+    }
+}
+
+// Must be called before the interpreter allocates any memory. Returns false if
+// another backend is already installed.
+static bool pythonx_install_allocator(PythonxAllocatorBackend backend) {
+    if (backend == kPythonxAllocatorNone || backend == pythonx_allocator_backend) return true;
+    if (pythonx_allocator_backend != kPythonxAllocatorNone) return false;
+
+    PyMemAllocatorDomain domains[] = {PYMEM_DOMAIN_RAW, PYMEM_DOMAIN_MEM, PYMEM_DOMAIN_OBJ};
+    for (int i = 0; i < 3; ++i) {
+        PythonxAllocCtx *ctx = &pythonx_alloc_ctx[i];
+        ctx->stats = &pythonx_alloc_stats[i];
+        ctx->enif = backend == kPythonxAllocatorEnif && domains[i] == PYMEM_DOMAIN_RAW;
+        ctx->charged = domains[i] == PYMEM_DOMAIN_RAW;
+        PyMem_GetAllocator(domains[i], &ctx->prev);
+
+        PyMemAllocatorEx allocator = {ctx, pythonx_malloc, pythonx_calloc, pythonx_realloc, pythonx_free};
+        PyMem_SetAllocator(domains[i], &allocator);
+    }
+
+    PyObject_GetArenaAllocator(&pythonx_prev_arena_allocator);
+    PyObjectArenaAllocator arena_allocator = {nullptr, pythonx_arena_alloc, pythonx_arena_free};
+    PyObject_SetArenaAllocator(&arena_allocator);
+
+    pythonx_allocator_backend = backend;
+    return true;
+}
+
+// Starts charging memory to the call about to run. `limit` is in bytes, -1 for no limit.
+// Only one call runs at a time, under the python mutex.
+static void pythonx_call_memory_begin(int64_t limit) {
+    pythonx_call_memory.baseline = pythonx_system_bytes.load(std::memory_order_relaxed);
+    pythonx_call_memory.limit = limit;
+    pythonx_call_memory.peak_bytes.store(0, std::memory_order_relaxed);
+    pythonx_call_memory.exceeded.store(false, std::memory_order_relaxed);
+    pythonx_call_memory.active.store(true, std::memory_order_release);
+}
+
+// Stops charging memory to the current call. Returns false if the call went over its limit.
+static bool pythonx_call_memory_end(int64_t *peak_bytes) {
+    pythonx_call_memory.active.store(false, std::memory_order_release);
+    *peak_bytes = pythonx_call_memory.peak_bytes.load(std::memory_order_relaxed);
+    return !pythonx_call_memory.exceeded.load(std::memory_order_relaxed);
+}
+
+// `nil` for no tracking, `:infinity` to track without a limit, or a limit in bytes.
+static bool pythonx_get_memory_limit(ErlNifEnv *env, ERL_NIF_TERM term, bool *track, int64_t *limit) {
+    if (enif_is_identical(term, kAtomNil)) {
+        *track = false;
+        return true;
+    }
+    *track = true;
+    if (enif_is_atom(env, term)) {
+        char name[16];
+        *limit = -1;
+        return enif_get_atom(env, term, name, sizeof(name), ERL_NIF_LATIN1) && strcmp(name, "infinity") == 0;
+    }
+    return erlang::nif::get(env, term, limit) && *limit >= 0;
+}
+
+static ERL_NIF_TERM pythonx_memory_limit_error(ErlNifEnv *env, int64_t limit, int64_t peak_bytes) {
+    ERL_NIF_TERM keys[] = {
+        kAtomStruct,
+        enif_make_atom(env, "__exception__"),
+        enif_make_atom(env, "limit"),
+        enif_make_atom(env, "peak_bytes"),
+    };
+    ERL_NIF_TERM values[] = {
+        enif_make_atom(env, "Elixir.Pythonx.MemoryLimitError"),
+        kAtomTrue,
+        enif_make_int64(env, limit),
+        enif_make_int64(env, peak_bytes),
+    };
+    ERL_NIF_TERM ret;
+    enif_make_map_from_arrays(env, keys, values, 4, &ret);
+    return ret;
+}
+
+static bool pythonx_get_allocator_backend(ErlNifEnv *env, ERL_NIF_TERM term, PythonxAllocatorBackend *backend) {
+    char name[16];
+    if (!enif_get_atom(env, term, name, sizeof(name), ERL_NIF_LATIN1)) return false;
+    if (strcmp(name, "default") == 0) {
+        *backend = kPythonxAllocatorNone;
+    } else if (strcmp(name, "counting") == 0) {
+        *backend = kPythonxAllocatorCounting;
+    } else if (strcmp(name, "enif") == 0) {
+        *backend = kPythonxAllocatorEnif;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// ------- NIF functions -------
+
+static ERL_NIF_TERM pythonx_memory_stats(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (pythonx_allocator_backend == kPythonxAllocatorNone) return kAtomNil;
+
+    const char *domains[] = {"raw", "mem", "obj", "arenas"};
+    ERL_NIF_TERM keys[5], values[5];
+    for (int i = 0; i < 4; ++i) {
+        PythonxAllocStats *stats = &pythonx_alloc_stats[i];
+        ERL_NIF_TERM stat_keys[] = {
+            enif_make_atom(env, "bytes"),
+            enif_make_atom(env, "blocks"),
+            enif_make_atom(env, "peak_bytes"),
+            enif_make_atom(env, "allocations"),
+        };
+        ERL_NIF_TERM stat_values[] = {
+            enif_make_int64(env, stats->bytes.load(std::memory_order_relaxed)),
+            enif_make_int64(env, stats->blocks.load(std::memory_order_relaxed)),
+            enif_make_int64(env, stats->peak_bytes.load(std::memory_order_relaxed)),
+            enif_make_int64(env, stats->allocations.load(std::memory_order_relaxed)),
+        };
+        keys[i] = enif_make_atom(env, domains[i]);
+        enif_make_map_from_arrays(env, stat_keys, stat_values, 4, &values[i]);
+    }
+    keys[4] = enif_make_atom(env, "allocator");
+    values[4] = enif_make_atom(env, pythonx_allocator_backend == kPythonxAllocatorEnif ? "enif" : "counting");
+
+    ERL_NIF_TERM ret;
+    enif_make_map_from_arrays(env, keys, values, 5, &ret);
+    return ret;
+}
+
+#endif  // PYTHONX_ALLOCATOR_HPP
@@ -0,0 +1,239 @@
+#ifndef PYTHONX_CALL_HPP
+#define PYTHONX_CALL_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <erl_nif.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+#include "pythonx_convert.hpp"
+#include "pythonx_handle.hpp"
+#include "pythonx_pyerr.hpp"
+
+// Calls of Python callables and methods with positional and keyword arguments.
+//
+// Arguments are laid out in one array and passed with the vectorcall
+// protocol, so no args tuple or kwargs dict is built per call. Method and
+// keyword names are interned once and cached. The call is decoded before the
+// python mutex is taken, and only converted to Python objects under it.
+
+// vectorcall is public since 3.9, and provisional with a leading underscore in 3.8
+static inline PyObject * pythonx_vectorcall(PyObject *callable, PyObject *const *args, size_t nargsf, PyObject *kwnames) {
+#if PY_VERSION_HEX >= 0x03090000
+    return PyObject_Vectorcall(callable, args, nargsf, kwnames);
+#else
+    return _PyObject_Vectorcall(callable, args, nargsf, kwnames);
+#endif
+}
+
+// `args[0]` is self, and counts in `nargsf`.
+static inline PyObject * pythonx_vectorcall_method(PyObject *name, PyObject *const *args, size_t nargsf, PyObject *kwnames) {
+#if PY_VERSION_HEX >= 0x03090000
+    return PyObject_VectorcallMethod(name, args, nargsf, kwnames);
+#else
+    PyObject *method = PyObject_GetAttr(args[0], name);
+    if (method == nullptr) return nullptr;
+    // self is not an argument of the bound method, its slot is free for the callee
+    PyObject *result = _PyObject_Vectorcall(method, args + 1, (PyVectorcall_NARGS(nargsf) - 1) | PY_VECTORCALL_ARGUMENTS_OFFSET, kwnames);
+    Py_DECREF(method);
+    return result;
+#endif
+}
+
+// Interned method and keyword names. Only touched under the python mutex.
+static std::unordered_map<std::string, PyObject *> pythonx_call_names;
+static constexpr size_t kPythonxCallMaxNames = 4096;
+
+// Returns a new reference to the interned string `name`.
+static PyObject * pythonx_call_name(const std::string &name) {
+    auto it = pythonx_call_names.find(name);
+    if (it != pythonx_call_names.end()) {
+        Py_INCREF(it->second);
+        return it->second;
+    }
+    PyObject *interned = PyUnicode_InternFromString(name.c_str());
+    if (interned != nullptr && pythonx_call_names.size() < kPythonxCallMaxNames) {
+        Py_INCREF(interned);
+        pythonx_call_names.emplace(name, interned);
+    }
+    return interned;
+}
+
+// Drops the cached names, used when the interpreter is finalized.
+static void pythonx_call_clear_names() {
+    for (auto &name : pythonx_call_names) Py_DECREF(name.second);
+    pythonx_call_names.clear();
+}
+
+enum PythonxCallInto {
+    kCallIntoTerm,
+    kCallIntoHandle,
+    kCallIntoRef,
+};
+
+struct PythonxCall {
+    ERL_NIF_TERM target;
+    bool is_method = false;
+    std::string method;
+    std::vector<ERL_NIF_TERM> args;
+    std::vector<std::string> kwnames;
+    std::vector<ERL_NIF_TERM> kwvalues;
+    PythonxCallInto into = kCallIntoTerm;
+    PyArenaNifRes *arena = nullptr;
+};
+
+static bool pythonx_call_get_name(ErlNifEnv *env, ERL_NIF_TERM term, std::string &name) {
+    return erlang::nif::get_atom(env, term, name) || (enif_is_binary(env, term) && erlang::nif::get(env, term, name));
+}
+
+// kwargs are a map or a list of pairs, with atom or string keys.
+static bool pythonx_call_get_kwargs(ErlNifEnv *env, ERL_NIF_TERM term, PythonxCall &call) {
+    if (enif_is_map(env, term)) {
+        ErlNifMapIterator iter;
+        if (!enif_map_iterator_create(env, term, &iter, ERL_NIF_MAP_ITERATOR_FIRST)) return false;
+        ERL_NIF_TERM key, value;
+        bool ok = true;
+        while (ok && enif_map_iterator_get_pair(env, &iter, &key, &value)) {
+            std::string name;
+            ok = pythonx_call_get_name(env, key, name);
+            call.kwnames.emplace_back(name);
+            call.kwvalues.emplace_back(value);
+            enif_map_iterator_next(env, &iter);
+        }
+        enif_map_iterator_destroy(env, &iter);
+        return ok;
+    }
+
+    ERL_NIF_TERM head, tail = term;
+    if (!enif_is_list(env, term)) return false;
+    while (enif_get_list_cell(env, tail, &head, &tail)) {
+        int arity;
+        const ERL_NIF_TERM *pair;
+        std::string name;
+        if (!enif_get_tuple(env, head, &arity, &pair) || arity != 2 || !pythonx_call_get_name(env, pair[0], name)) return false;
+        call.kwnames.emplace_back(name);
+        call.kwvalues.emplace_back(pair[1]);
+    }
+    return true;
+}
+
+// call(target, method, args, kwargs, into, arena), `method` is nil for a plain call.
+static bool pythonx_call_parse(ErlNifEnv *env, const ERL_NIF_TERM argv[], PythonxCall &call) {
+    call.target = argv[0];
+    call.is_method = !erlang::nif::check_nil(env, argv[1]);
+    if (call.is_method && !pythonx_call_get_name(env, argv[1], call.method)) return false;
+    ERL_NIF_TERM head, tail = argv[2];
+    if (!enif_is_list(env, argv[2])) return false;
+    while (enif_get_list_cell(env, tail, &head, &tail)) call.args.emplace_back(head);
+    if (!pythonx_call_get_kwargs(env, argv[3], call)) return false;
+
+    std::string into;
+    if (!erlang::nif::get_atom(env, argv[4], into)) return false;
+    if (into == "term") call.into = kCallIntoTerm;
+    else if (into == "handle") call.into = kCallIntoHandle;
+    else if (into == "ref") call.into = kCallIntoRef;
+    else return false;
+    return pyhandle_get_arena(env, argv[5], &call.arena);
+}
+
+// Arguments are `{:handle, handle}`, `Pythonx.C` references, or terms, which
+// are converted. Returns a new reference, or nullptr and sets `stale` if a
+// handle was released.
+static PyObject * pythonx_call_arg(ErlNifEnv *env, ERL_NIF_TERM term, bool &stale) {
+    int arity;
+    const ERL_NIF_TERM *tagged;
+    std::string tag;
+    if (enif_get_tuple(env, term, &arity, &tagged) && arity == 2 && erlang::nif::get_atom(env, tagged[0], tag) && tag == "handle") {
+        PyObject *val = pyhandle_get(env, tagged[1]);
+        stale = val == nullptr;
+        return val;
+    }
+
+    PyObjectNifRes *res = get_resource<PyObjectNifRes>(env, term);
+    if (res != nullptr) {
+        Py_INCREF(res->val);
+        return res->val;
+    }
+
+    auto val = erl_to_python(env, term);
+    if (!val) {
+        PyErr_SetString(PyExc_TypeError, "cannot convert the argument to a Python object");
+        return nullptr;
+    }
+    return val.value();
+}
+
+static ERL_NIF_TERM pythonx_call_result(ErlNifEnv *env, PyObject *result, const PythonxCall &call) {
+    if (result == nullptr) return pythonx_current_pyerr(env);
+    switch (call.into) {
+        case kCallIntoHandle:
+            return pyhandle_to_term_or_pyerr(env, result, call.arena);
+        case kCallIntoRef:
+            return nonnull_pyobject_to_nifres(env, result);
+        case kCallIntoTerm:
+            break;
+    }
+
+    auto term = python_to(env, result);
+    if (!term) {
+        if (!PyErr_Occurred()) PyErr_Format(PyExc_TypeError, "cannot convert %s to a term", Py_TYPE(result)->tp_name);
+        Py_DECREF(result);
+        return pythonx_current_pyerr(env);
+    }
+    Py_DECREF(result);
+    return term.value();
+}
+
+// Runs a decoded call. Must hold the python mutex.
+static ERL_NIF_TERM pythonx_call_run(ErlNifEnv *env, const PythonxCall &call) {
+    PyObject *target = pyhandle_or_ref_get(env, call.target);
+    if (target == nullptr) return enif_make_badarg(env);
+
+    size_t nargs = call.args.size();
+    size_t nkw = call.kwnames.size();
+    // slot 0 holds self for a method call, and is free for the callee otherwise
+    std::vector<PyObject *> stack(1 + nargs + nkw, nullptr);
+    stack[0] = target;
+
+    bool stale = false;
+    bool ok = true;
+    for (size_t i = 0; ok && i < nargs; ++i) {
+        ok = (stack[1 + i] = pythonx_call_arg(env, call.args[i], stale)) != nullptr;
+    }
+    for (size_t i = 0; ok && i < nkw; ++i) {
+        ok = (stack[1 + nargs + i] = pythonx_call_arg(env, call.kwvalues[i], stale)) != nullptr;
+    }
+
+    PyObject *kwnames = nullptr;
+    if (ok && nkw > 0) {
+        kwnames = PyTuple_New(nkw);
+        for (size_t i = 0; kwnames != nullptr && i < nkw; ++i) {
+            PyObject *name = pythonx_call_name(call.kwnames[i]);
+            if (name == nullptr) Py_CLEAR(kwnames);
+            else PyTuple_SET_ITEM(kwnames, i, name);
+        }
+        ok = kwnames != nullptr;
+    }
+
+    PyObject *result = nullptr;
+    if (ok && call.is_method) {
+        PyObject *name = pythonx_call_name(call.method);
+        if (name != nullptr) {
+            result = pythonx_vectorcall_method(name, stack.data(), 1 + nargs, kwnames);
+            Py_DECREF(name);
+        }
+    } else if (ok) {
+        result = pythonx_vectorcall(target, stack.data() + 1, nargs | PY_VECTORCALL_ARGUMENTS_OFFSET, kwnames);
+    }
+
+    Py_XDECREF(kwnames);
+    for (PyObject *val : stack) Py_XDECREF(val);
+    if (stale) return enif_make_badarg(env);
+    return pythonx_call_result(env, result, call);
+}
+
+#endif  // PYTHONX_CALL_HPP
@@ -0,0 +1,221 @@
+#ifndef PYTHONX_CENSUS_HPP
+#define PYTHONX_CENSUS_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <erl_nif.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+#include "pyobject_nif_res.hpp"
+
+// Census of the live Python object resources, grouped by type.
+//
+// Every resource made by nonnull_pyobject_to_nifres is counted until its
+// destructor runs. While the census is enabled, the resources made from then
+// on are also linked into a list, so the census sees exactly the objects they
+// keep alive from the BEAM side. The list is shared by all schedulers, so it is
+// off by default. A process can tag the resources it creates with a site name,
+// which tells apart the owners of objects of the same type.
+
+struct PythonxCensusType {
+    int64_t count = 0;
+    int64_t bytes = 0;
+    std::map<uint32_t, int64_t> sites;
+};
+
+static const char *pythonx_census_borrowed_type = "(borrowed)";
+// the tags of exited processes are pruned once there are this many tags
+static size_t pythonx_census_prune_at = 64;
+
+static ERL_NIF_TERM pythonx_census_site_term(ErlNifEnv *env, uint32_t site) {
+    if (site == 0) return kAtomNil;
+    auto name = erlang::nif::make_binary(env, pythonx_census_site_names[site].c_str());
+    return name ? name.value() : kAtomNil;
+}
+
+// Forgets the tags of processes that exited without removing them. Must hold pythonx_census_mutex.
+static void pythonx_census_prune_sites(ErlNifEnv *env) {
+    for (auto it = pythonx_census_process_sites.begin(); it != pythonx_census_process_sites.end();) {
+        ErlNifPid pid;
+        if (!enif_get_local_pid(env, it->first, &pid) || !enif_is_process_alive(env, &pid)) {
+            it = pythonx_census_process_sites.erase(it);
+            pythonx_census_tagged.fetch_sub(1, std::memory_order_relaxed);
+        } else {
+            ++it;
+        }
+    }
+    pythonx_census_prune_at = std::max<size_t>(64, pythonx_census_process_sites.size() * 2);
+}
+
+// ------- NIF functions -------
+
+// Tags the resources created by the calling process, returns the previous tag.
+static ERL_NIF_TERM pythonx_census_tag(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    std::string tag;
+    bool untag = erlang::nif::check_nil(env, argv[0]);
+    if (!untag && !erlang::nif::get_atom(env, argv[0], tag) && !erlang::nif::get(env, argv[0], tag)) {
+        return enif_make_badarg(env);
+    }
+
+    ErlNifPid self;
+    if (enif_self(env, &self) == nullptr) {
+        return enif_make_badarg(env);
+    }
+
+    uint32_t previous = 0;
+    {
+        std::lock_guard<std::mutex> guard(pythonx_census_mutex);
+        auto it = pythonx_census_process_sites.find(self.pid);
+        if (it != pythonx_census_process_sites.end()) {
+            previous = it->second;
+            if (untag) {
+                pythonx_census_process_sites.erase(it);
+                pythonx_census_tagged.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        if (!untag) {
+            auto name = std::find(pythonx_census_site_names.begin() + 1, pythonx_census_site_names.end(), tag);
+            uint32_t site = (uint32_t)(name - pythonx_census_site_names.begin());
+            if (name == pythonx_census_site_names.end()) pythonx_census_site_names.push_back(tag);
+
+            if (it == pythonx_census_process_sites.end()) {
+                if (pythonx_census_process_sites.size() >= pythonx_census_prune_at) pythonx_census_prune_sites(env);
+                pythonx_census_process_sites.emplace(self.pid, site);
+                pythonx_census_tagged.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                it->second = site;
+            }
+        }
+    }
+    return pythonx_census_site_term(env, previous);
+}
+
+// Starts or stops linking new resources into the census list, returns whether it was enabled.
+static ERL_NIF_TERM pythonx_census_set_enabled(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    bool enabled;
+    if (!erlang::nif::get(env, argv[0], &enabled)) {
+        return enif_make_badarg(env);
+    }
+
+    std::lock_guard<std::mutex> guard(pythonx_census_mutex);
+    bool previous = pythonx_census_enabled.exchange(enabled, std::memory_order_relaxed);
+    if (!enabled) {
+        for (PyObjectNifRes *res = pythonx_census_head; res != nullptr;) {
+            // once unlinked, its destructor may free it without the census mutex
+            PyObjectNifRes *next = res->census_next;
+            res->census_linked.store(false, std::memory_order_release);
+            res = next;
+        }
+        pythonx_census_head = nullptr;
+    }
+    return previous ? kAtomTrue : kAtomFalse;
+}
+
+static ERL_NIF_TERM pythonx_census_count(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    return enif_make_int64(env, pythonx_census_live.load(std::memory_order_relaxed));
+}
+
+// `[%{type:, count:, bytes:, sites: %{tag => count}}]`, by descending count
+static ERL_NIF_TERM pythonx_census(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    bool sizes;
+    if (!erlang::nif::get(env, argv[0], &sizes)) {
+        return enif_make_badarg(env);
+    }
+    // runs under the python mutex, and a resource collected meanwhile only
+    // queues its reference for the next holder of the mutex, so the references
+    // taken here are never dropped concurrently
+    std::vector<std::pair<PyObject *, uint32_t>> snapshot;
+    int64_t borrowed = 0;
+    std::map<uint32_t, int64_t> borrowed_sites;
+    uint64_t epoch = pythonx_current_epoch();
+    {
+        std::lock_guard<std::mutex> guard(pythonx_census_mutex);
+        if (!pythonx_census_enabled.load(std::memory_order_relaxed)) {
+            return erlang::nif::error(env, "census is not enabled");
+        }
+        pythonx_census_prune_sites(env);
+        snapshot.reserve(pythonx_census_live.load(std::memory_order_relaxed));
+        for (PyObjectNifRes *res = pythonx_census_head; res != nullptr; res = res->census_next) {
+            if (res->epoch != epoch) {
+                // its object went away with a finalized interpreter
+                continue;
+            } else if (res->borrowed) {
+                // the object may be gone already
+                ++borrowed;
+                ++borrowed_sites[res->census_site];
+            } else if (res->val != nullptr) {
+                Py_INCREF(res->val);
+                snapshot.emplace_back(res->val, res->census_site);
+            }
+        }
+    }
+
+    PyObject *getsizeof = sizes ? PySys_GetObject("getsizeof") : nullptr;
+    std::unordered_map<std::string, PythonxCensusType> types;
+    for (auto &entry : snapshot) {
+        PythonxCensusType &type = types[Py_TYPE(entry.first)->tp_name];
+        type.count += 1;
+        type.sites[entry.second] += 1;
+        if (getsizeof) {
+            PyObject *size = PyObject_CallFunctionObjArgs(getsizeof, entry.first, nullptr);
+            if (size) {
+                type.bytes += PyLong_AsLongLong(size);
+                Py_DECREF(size);
+            }
+            if (PyErr_Occurred()) PyErr_Clear();
+        }
+        Py_DECREF(entry.first);
+    }
+    if (borrowed > 0) {
+        PythonxCensusType &type = types[pythonx_census_borrowed_type];
+        type.count = borrowed;
+        type.sites = borrowed_sites;
+    }
+
+    std::vector<std::pair<std::string, PythonxCensusType>> sorted(types.begin(), types.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.second.count != b.second.count ? a.second.count > b.second.count : a.first < b.first;
+    });
+
+    std::vector<ERL_NIF_TERM> entries;
+    for (auto &[name, type] : sorted) {
+        std::vector<ERL_NIF_TERM> site_keys, site_values;
+        {
+            std::lock_guard<std::mutex> guard(pythonx_census_mutex);
+            for (auto &site : type.sites) {
+                site_keys.push_back(pythonx_census_site_term(env, site.first));
+                site_values.push_back(enif_make_int64(env, site.second));
+            }
+        }
+        ERL_NIF_TERM sites;
+        enif_make_map_from_arrays(env, site_keys.data(), site_values.data(), site_keys.size(), &sites);
+
+        auto type_name = erlang::nif::make_binary(env, name.c_str());
+        if (!type_name) return erlang::nif::error(env, "cannot allocate the census");
+        ERL_NIF_TERM keys[] = {
+            enif_make_atom(env, "type"),
+            enif_make_atom(env, "count"),
+            enif_make_atom(env, "bytes"),
+            enif_make_atom(env, "sites"),
+        };
+        ERL_NIF_TERM values[] = {
+            type_name.value(),
+            enif_make_int64(env, type.count),
+            sizes && name != pythonx_census_borrowed_type ? enif_make_int64(env, type.bytes) : kAtomNil,
+            sites,
+        };
+        ERL_NIF_TERM entry;
+        enif_make_map_from_arrays(env, keys, values, 4, &entry);
+        entries.push_back(entry);
+    }
+    return enif_make_list_from_array(env, entries.data(), (unsigned)entries.size());
+}
+
+#endif  // PYTHONX_CENSUS_HPP
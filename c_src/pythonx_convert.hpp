@@ -0,0 +1,269 @@
+#ifndef PYTHONX_CONVERT_HPP
+#define PYTHONX_CONVERT_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <erl_nif.h>
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+
+// Conversion between Erlang terms and Python objects.
+//
+// Kept free of resources and of the python mutex so that it can also be built
+// into the native benchmarks in `bench/native`.
+
+// Convert Python objects to Erlang terms
+static std::optional<ERL_NIF_TERM> python_to(ErlNifEnv *env, PyObject * dict);
+static std::optional<ERL_NIF_TERM> python_dict_to(ErlNifEnv *env, PyObject * dict);
+static std::optional<ERL_NIF_TERM> python_tuple_to(ErlNifEnv *env, PyObject * dict);
+static std::optional<ERL_NIF_TERM> python_list_to(ErlNifEnv *env, PyObject * list);
+
+static std::optional<ERL_NIF_TERM> python_to(ErlNifEnv *env, PyObject * val) {
+    auto ret = std::nullopt;
+    if (val == nullptr) {
+        return ret;
+    }
+    if (PyLong_Check(val)) {
+        return enif_make_int64(env, PyLong_AsLong(val));
+    }
+    if (PyFloat_Check(val)) {
+        return enif_make_double(env, PyFloat_AsDouble(val));
+    }
+    if (PyUnicode_Check(val)) {
+        Py_ssize_t size;
+        const char * data = PyUnicode_AsUTF8AndSize(val, &size);
+        if (data == nullptr) {
+            return ret;
+        }
+        ERL_NIF_TERM string_val;
+        unsigned char * ptr;
+        if ((ptr = enif_make_new_binary(env, size, &string_val)) != nullptr) {
+            strncpy((char *)ptr, data, size);
+            return string_val;
+        }
+        return ret;
+    }
+    if (PyDict_Check(val)) {
+        return python_dict_to(env, val);
+    }
+    if (PyTuple_Check(val)) {
+        return python_tuple_to(env, val);
+    }
+    if (val == Py_None) {
+        return kAtomNil;
+    }
+    if (val == Py_False) {
+        return kAtomFalse;
+    }
+    if (val == Py_True) {
+        return kAtomTrue;
+    }
+    if (PyList_Check(val)) {
+        return python_list_to(env, val);
+    }
+
+    PyObject* type_obj = PyObject_Type(val);
+    PyObject* type_name_obj = PyObject_GetAttrString(type_obj, "__name__");
+    const char* type_name = PyUnicode_AsUTF8(type_name_obj);
+    // printf("[debug] type_name: %s\r\n", type_name);
+
+    // Cleanup type objects
+    Py_DECREF(type_obj);
+    Py_DECREF(type_name_obj);
+
+    return kAtomNil;
+}
+
+static std::optional<ERL_NIF_TERM> python_dict_to(ErlNifEnv *env, PyObject * dict) {
+    auto ret = std::nullopt;
+    PyObject *keys = PyDict_Keys(dict);
+    if (keys == nullptr) {
+        return ret;
+    }
+
+    Py_ssize_t size = PyList_Size(keys);
+    std::vector<ERL_NIF_TERM> erl_keys, erl_values;
+    for (Py_ssize_t i = 0; i < size; ++i) {
+        PyObject *key = PyList_GetItem(keys, i);
+        auto key_term = python_to(env, key);
+        if (!key_term) return ret;
+        erl_keys.emplace_back(key_term.value());
+
+        auto val = PyDict_GetItem(dict, key);
+        auto val_term = python_to(env, val);
+        if (!val_term) return ret;
+        erl_values.emplace_back(val_term.value());
+    }
+    Py_DECREF(keys);
+
+    ERL_NIF_TERM erl_dict;
+    if (enif_make_map_from_arrays(env, erl_keys.data(), erl_values.data(), erl_keys.size(), &erl_dict)) {
+        return erl_dict;
+    }
+    return ret;
+}
+
+static std::optional<ERL_NIF_TERM> python_tuple_to(ErlNifEnv *env, PyObject * tuple) {
+    auto ret = std::nullopt;
+    Py_ssize_t size = PyTuple_Size(tuple);
+    std::vector<ERL_NIF_TERM> erl_values;
+    for (Py_ssize_t i = 0; i < size; ++i) {
+        PyObject * item = PyTuple_GetItem(tuple, i);
+        auto item_term = python_to(env, item);
+        if (!item_term) return ret;
+        erl_values.emplace_back(item_term.value());
+    }
+    ERL_NIF_TERM erl_tuple = enif_make_tuple_from_array(env, erl_values.data(), erl_values.size());
+    return erl_tuple;
+}
+
+static std::optional<ERL_NIF_TERM> python_list_to(ErlNifEnv *env, PyObject * list) {
+    auto ret = std::nullopt;
+    Py_ssize_t size = PyList_Size(list);
+    std::vector<ERL_NIF_TERM> erl_values;
+    for (Py_ssize_t i = 0; i < size; ++i) {
+        PyObject * item = PyList_GetItem(list, i);
+        auto item_term = python_to(env, item);
+        if (!item_term) return ret;
+        erl_values.emplace_back(item_term.value());
+    }
+    ERL_NIF_TERM erl_list = enif_make_list_from_array(env, erl_values.data(), erl_values.size());
+    return erl_list;
+}
+
+static std::optional<ERL_NIF_TERM> python_items_in_dict_to(ErlNifEnv *env, PyObject * dict, std::vector<std::string> &keys) {
+    auto ret = std::nullopt;
+    Py_ssize_t keys_size = keys.size();
+    if (keys_size == 0) {
+        return ret;
+    }
+
+    PyObject *dict_keys = PyDict_Keys(dict);
+    if (dict_keys == nullptr) {
+        return ret;
+    }
+
+    std::vector<ERL_NIF_TERM> erl_values(keys.size(), kAtomNil);
+    Py_ssize_t dict_keys_size = PyList_Size(dict_keys);
+    if (dict_keys_size != 0) {
+        for (Py_ssize_t i = 0; i < dict_keys_size; ++i) {
+            PyObject *dict_key = PyList_GetItem(dict_keys, i);
+            if (dict_key != nullptr && PyUnicode_Check(dict_key)) {
+                const char* dict_key_str = PyUnicode_AsUTF8(dict_key);
+                auto it = std::find(keys.begin(), keys.end(), dict_key_str);
+                if (it != keys.end()) {
+                    size_t index = it - keys.begin();
+                    auto val = PyDict_GetItem(dict, dict_key);
+                    auto val_term = python_to(env, val);
+                    if (!val_term) return ret;
+                    erl_values[index] = val_term.value();
+                }
+            }
+        }
+    }
+    Py_DECREF(dict_keys);
+
+    ERL_NIF_TERM erl_dict = enif_make_list_from_array(env, erl_values.data(), erl_values.size());
+    return erl_dict;
+}
+
+// Convert Erlang NIF terms to Python objects
+static std::optional<PyObject *> erl_to_python(ErlNifEnv *env, ERL_NIF_TERM term) {
+    if (enif_is_atom(env, term)) {
+        if (enif_is_identical(term, kAtomNil)) {
+            Py_RETURN_NONE;
+        }
+        if (enif_is_identical(term, kAtomTrue)) {
+            Py_RETURN_TRUE;
+        }
+        if (enif_is_identical(term, kAtomFalse)) {
+            Py_RETURN_FALSE;
+        }
+
+        std::string atom;
+        if (erlang::nif::get_atom(env, term, atom)) {
+            return PyUnicode_DecodeUTF8(atom.c_str(), atom.size(), "strict");
+        } else {
+            // todo: better error handling
+            // return None if get_atom fails for now
+            Py_RETURN_NONE;
+        }
+    } else if (enif_is_binary(env, term)) {
+        ErlNifBinary binary;
+        if (enif_inspect_binary(env, term, &binary)) {
+            return PyUnicode_DecodeUTF8((const char *)binary.data, binary.size, "strict");
+        } else {
+            // todo: return None if enif_inspect_binary fails
+            Py_RETURN_NONE;
+        }
+    } else if (enif_is_list(env, term)) {
+        ERL_NIF_TERM head, tail;
+        if (enif_get_list_cell(env, term, &head, &tail)) {
+            std::vector<PyObject *> list;
+            while (enif_get_list_cell(env, term, &head, &tail)) {
+                auto item = erl_to_python(env, head);
+                if (item) {
+                    list.emplace_back(item.value());
+                } else {
+                    // todo: return None for unsupported types for now
+                    Py_RETURN_NONE;
+                }
+                term = tail;
+            }
+            PyObject *py_list = PyList_New(list.size());
+            for (size_t i = 0; i < list.size(); ++i) {
+                PyList_SetItem(py_list, i, list[i]);
+            }
+            return py_list;
+        }
+    } else if (enif_is_tuple(env, term)) {
+        int arity;
+        const ERL_NIF_TERM *arr;
+        if (enif_get_tuple(env, term, &arity, &arr)) {
+            // n-tuple maps to n-ary tuple in Python
+            PyObject *py_tuple = PyTuple_New(arity);
+            for (int i = 0; i < arity; ++i) {
+                auto item = erl_to_python(env, arr[i]);
+                if (item) {
+                    PyTuple_SetItem(py_tuple, i, item.value());
+                } else {
+                    // todo: set None for unsupported types for now
+                    Py_INCREF(Py_None);
+                    PyTuple_SetItem(py_tuple, i, Py_None);
+                }
+            }
+            return py_tuple;
+        } else {
+            // todo: this should not happen
+            // but if it does, return None for now
+            Py_RETURN_NONE;
+        }
+    } else if (enif_is_number(env, term)) {
+        ErlNifUInt64 u64;
+        if (enif_get_uint64(env, term, &u64)) {
+            return PyLong_FromUnsignedLongLong(u64);
+        }
+        ErlNifSInt64 i64;
+        if (enif_get_int64(env, term, &i64)) {
+            return PyLong_FromLongLong(i64);
+        }
+        double num;
+        if (enif_get_double(env, term, &num)) {
+            return PyFloat_FromDouble(num);
+        }
+
+        // todo: return None for unsupported types for now
+        Py_RETURN_NONE;
+    }
+
+    // todo: return None for unsupported types for now
+    Py_RETURN_NONE;
+}
+
+#endif  // PYTHONX_CONVERT_HPP
@@ -0,0 +1,87 @@
+#ifndef PYTHONX_DEFERRED_HPP
+#define PYTHONX_DEFERRED_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Python references dropped by resource destructors.
+//
+// The VM runs destructors on whichever thread collects the resource, without
+// the python mutex, so they must not touch reference counts. They queue the
+// references instead, and the next NIF that takes the python mutex drops
+// them. References of an interpreter that was finalized in the meantime are
+// left alone, their objects went away with it.
+
+struct PythonxDeferred {
+    PyObject *obj;
+    // released before `obj` when `has_view` is set
+    Py_buffer view;
+    bool has_view;
+};
+
+static std::mutex pythonx_deferred_mutex;
+static std::vector<PythonxDeferred> pythonx_deferred;
+static std::atomic<bool> pythonx_deferred_pending{false};
+// bumped by each finalize, references are tagged with it when they are taken
+static std::atomic<uint64_t> pythonx_interpreter_epoch{0};
+
+static inline uint64_t pythonx_current_epoch() {
+    return pythonx_interpreter_epoch.load(std::memory_order_acquire);
+}
+
+static void pythonx_defer(PyObject *obj, const Py_buffer *view, uint64_t epoch) {
+    std::lock_guard<std::mutex> guard(pythonx_deferred_mutex);
+    if (epoch != pythonx_current_epoch()) return;
+    PythonxDeferred deferred{obj, {}, view != nullptr};
+    if (view != nullptr) deferred.view = *view;
+    pythonx_deferred.emplace_back(deferred);
+    pythonx_deferred_pending.store(true, std::memory_order_release);
+}
+
+// Queues a reference to be dropped under the python mutex.
+static void pythonx_defer_decref(PyObject *obj, uint64_t epoch) {
+    pythonx_defer(obj, nullptr, epoch);
+}
+
+// Queues an exported buffer to be released, and then its exporter.
+static void pythonx_defer_buffer_release(PyObject *obj, const Py_buffer &view, uint64_t epoch) {
+    pythonx_defer(obj, &view, epoch);
+}
+
+static void pythonx_deferred_release(std::vector<PythonxDeferred> &deferred) {
+    for (auto &item : deferred) {
+        if (item.has_view) PyBuffer_Release(&item.view);
+        Py_XDECREF(item.obj);
+    }
+}
+
+// Drops the queued references. Must hold the python mutex, with Python initialized.
+static void pythonx_deferred_drain() {
+    if (!pythonx_deferred_pending.load(std::memory_order_acquire)) return;
+
+    std::vector<PythonxDeferred> deferred;
+    {
+        std::lock_guard<std::mutex> guard(pythonx_deferred_mutex);
+        deferred.swap(pythonx_deferred);
+        pythonx_deferred_pending.store(false, std::memory_order_release);
+    }
+    // destructors that run meanwhile queue for the next drain
+    pythonx_deferred_release(deferred);
+}
+
+// Drops the queued references, and starts a new epoch. Called before Python is finalized.
+static void pythonx_deferred_finalize() {
+    while (pythonx_deferred_pending.load(std::memory_order_acquire)) pythonx_deferred_drain();
+
+    std::lock_guard<std::mutex> guard(pythonx_deferred_mutex);
+    // queued after the last drain, left to the interpreter
+    pythonx_deferred.clear();
+    pythonx_deferred_pending.store(false, std::memory_order_release);
+    pythonx_interpreter_epoch.fetch_add(1, std::memory_order_acq_rel);
+}
+
+#endif  // PYTHONX_DEFERRED_HPP
@@ -0,0 +1,523 @@
+#ifndef PYTHONX_ETF_HPP
+#define PYTHONX_ETF_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <erl_nif.h>
+#include <cstring>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+#include "pythonx_utils.hpp"
+#include "pythonx_pyerr.hpp"
+
+// External Term Format tags, see
+// https://www.erlang.org/doc/apps/erts/erl_ext_dist.html
+#define PYTHONX_ETF_VERSION             131
+#define PYTHONX_ETF_NEW_FLOAT_EXT       70
+#define PYTHONX_ETF_SMALL_INTEGER_EXT   97
+#define PYTHONX_ETF_INTEGER_EXT         98
+#define PYTHONX_ETF_FLOAT_EXT           99
+#define PYTHONX_ETF_ATOM_EXT            100
+#define PYTHONX_ETF_SMALL_TUPLE_EXT     104
+#define PYTHONX_ETF_LARGE_TUPLE_EXT     105
+#define PYTHONX_ETF_NIL_EXT             106
+#define PYTHONX_ETF_STRING_EXT          107
+#define PYTHONX_ETF_LIST_EXT            108
+#define PYTHONX_ETF_BINARY_EXT          109
+#define PYTHONX_ETF_SMALL_BIG_EXT       110
+#define PYTHONX_ETF_LARGE_BIG_EXT       111
+#define PYTHONX_ETF_SMALL_ATOM_EXT      115
+#define PYTHONX_ETF_MAP_EXT             116
+#define PYTHONX_ETF_ATOM_UTF8_EXT       118
+#define PYTHONX_ETF_SMALL_ATOM_UTF8_EXT 119
+
+// ------- Python -> ETF -------
+
+// Growable output buffer backed by an ErlNifBinary so that the final
+// result can be handed to the VM without another copy.
+struct EtfBuffer {
+    ErlNifBinary bin;
+    size_t size = 0;
+    bool ok = false;
+
+    explicit EtfBuffer(size_t initial_capacity = 256) {
+        ok = enif_alloc_binary(initial_capacity, &bin);
+    }
+
+    ~EtfBuffer() {
+        if (ok) enif_release_binary(&bin);
+    }
+
+    bool reserve(size_t extra) {
+        if (unlikely(!ok)) return false;
+        if (likely(size + extra <= bin.size)) return true;
+
+        size_t capacity = bin.size * 2;
+        while (capacity < size + extra) capacity *= 2;
+        if (!enif_realloc_binary(&bin, capacity)) {
+            enif_release_binary(&bin);
+            ok = false;
+            return false;
+        }
+        return true;
+    }
+
+    bool put_u8(uint8_t v) {
+        if (!reserve(1)) return false;
+        bin.data[size++] = v;
+        return true;
+    }
+
+    bool put_u16(uint16_t v) {
+        if (!reserve(2)) return false;
+        bin.data[size++] = (uint8_t)(v >> 8);
+        bin.data[size++] = (uint8_t)(v);
+        return true;
+    }
+
+    bool put_u32(uint32_t v) {
+        if (!reserve(4)) return false;
+        bin.data[size++] = (uint8_t)(v >> 24);
+        bin.data[size++] = (uint8_t)(v >> 16);
+        bin.data[size++] = (uint8_t)(v >> 8);
+        bin.data[size++] = (uint8_t)(v);
+        return true;
+    }
+
+    bool put_bytes(const void *data, size_t len) {
+        if (!reserve(len)) return false;
+        if (len > 0) memcpy(bin.data + size, data, len);
+        size += len;
+        return true;
+    }
+
+    // Transfers the ownership of the underlying binary to the VM.
+    std::optional<ERL_NIF_TERM> make(ErlNifEnv *env) {
+        if (unlikely(!ok)) return std::nullopt;
+        if (!enif_realloc_binary(&bin, size)) return std::nullopt;
+        ok = false;
+        return enif_make_binary(env, &bin);
+    }
+};
+
+static bool etf_put_atom(EtfBuffer &buf, const char *name, size_t len) {
+    if (len > 255) return false;
+    return buf.put_u8(PYTHONX_ETF_SMALL_ATOM_UTF8_EXT) && buf.put_u8((uint8_t)len) && buf.put_bytes(name, len);
+}
+
+static bool etf_put_big(EtfBuffer &buf, PyObject *val, bool negative) {
+    // Fallback for integers that do not fit in 64 bits:
+    // `abs(val).to_bytes(n, 'little')` already is the ETF digit layout.
+    bool ret = false;
+    PyObject *magnitude = nullptr, *bits = nullptr, *digits = nullptr;
+    Py_ssize_t nbits, nbytes;
+
+    magnitude = PyNumber_Absolute(val);
+    if (magnitude == nullptr) goto cleanup;
+    bits = PyObject_CallMethod(magnitude, "bit_length", nullptr);
+    if (bits == nullptr) goto cleanup;
+    nbits = PyLong_AsSsize_t(bits);
+    if (nbits < 0) goto cleanup;
+    nbytes = (nbits + 7) / 8;
+    digits = PyObject_CallMethod(magnitude, "to_bytes", "ns", nbytes, "little");
+    if (digits == nullptr || !PyBytes_Check(digits)) goto cleanup;
+
+    if (nbytes <= 255) {
+        ret = buf.put_u8(PYTHONX_ETF_SMALL_BIG_EXT) && buf.put_u8((uint8_t)nbytes);
+    } else {
+        ret = buf.put_u8(PYTHONX_ETF_LARGE_BIG_EXT) && buf.put_u32((uint32_t)nbytes);
+    }
+    ret = ret && buf.put_u8(negative ? 1 : 0) && buf.put_bytes(PyBytes_AS_STRING(digits), nbytes);
+
+cleanup:
+    Py_XDECREF(magnitude);
+    Py_XDECREF(bits);
+    Py_XDECREF(digits);
+    return ret;
+}
+
+static bool etf_put_long(EtfBuffer &buf, PyObject *val) {
+    int overflow = 0;
+    long long v = PyLong_AsLongLongAndOverflow(val, &overflow);
+    if (overflow != 0) return etf_put_big(buf, val, overflow < 0);
+    if (v == -1 && PyErr_Occurred()) return false;
+
+    if (v >= 0 && v <= 255) {
+        return buf.put_u8(PYTHONX_ETF_SMALL_INTEGER_EXT) && buf.put_u8((uint8_t)v);
+    }
+    if (v >= INT32_MIN && v <= INT32_MAX) {
+        return buf.put_u8(PYTHONX_ETF_INTEGER_EXT) && buf.put_u32((uint32_t)(int32_t)v);
+    }
+
+    uint64_t magnitude = v < 0 ? (uint64_t)(-(v + 1)) + 1 : (uint64_t)v;
+    uint8_t digits[8];
+    uint8_t n = 0;
+    while (magnitude != 0) {
+        digits[n++] = (uint8_t)(magnitude & 0xff);
+        magnitude >>= 8;
+    }
+    return buf.put_u8(PYTHONX_ETF_SMALL_BIG_EXT) && buf.put_u8(n) && buf.put_u8(v < 0 ? 1 : 0) && buf.put_bytes(digits, n);
+}
+
+static bool etf_put_double(EtfBuffer &buf, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    if (!buf.put_u8(PYTHONX_ETF_NEW_FLOAT_EXT)) return false;
+    if (!buf.put_u32((uint32_t)(bits >> 32))) return false;
+    return buf.put_u32((uint32_t)bits);
+}
+
+static bool etf_put_python(EtfBuffer &buf, PyObject *val, bool in_key = false);
+
+// Same type mapping as `python_to` in pythonx.cpp, except that the checks
+// for `None`, `True` and `False` come first so that booleans are encoded
+// as atoms rather than as integers.
+//
+// Within a dict key, unsupported types raise TypeError instead of becoming
+// nil, two such keys would make a map with duplicate keys, which
+// `binary_to_term` rejects.
+static bool etf_put_python(EtfBuffer &buf, PyObject *val, bool in_key) {
+    if (val == Py_None) return etf_put_atom(buf, "nil", 3);
+    if (val == Py_True) return etf_put_atom(buf, "true", 4);
+    if (val == Py_False) return etf_put_atom(buf, "false", 5);
+    if (PyLong_Check(val)) return etf_put_long(buf, val);
+    if (PyFloat_Check(val)) return etf_put_double(buf, PyFloat_AS_DOUBLE(val));
+    if (PyUnicode_Check(val)) {
+        Py_ssize_t size;
+        const char *data = PyUnicode_AsUTF8AndSize(val, &size);
+        if (data == nullptr) return false;
+        return buf.put_u8(PYTHONX_ETF_BINARY_EXT) && buf.put_u32((uint32_t)size) && buf.put_bytes(data, size);
+    }
+
+    if (Py_EnterRecursiveCall(" while encoding a Python object to ETF")) return false;
+
+    bool ret = false;
+    if (PyDict_Check(val)) {
+        PyObject *key, *value;
+        Py_ssize_t pos = 0;
+        ret = buf.put_u8(PYTHONX_ETF_MAP_EXT) && buf.put_u32((uint32_t)PyDict_Size(val));
+        while (ret && PyDict_Next(val, &pos, &key, &value)) {
+            ret = etf_put_python(buf, key, true) && etf_put_python(buf, value);
+        }
+    } else if (PyTuple_Check(val)) {
+        Py_ssize_t size = PyTuple_GET_SIZE(val);
+        if (size <= 255) {
+            ret = buf.put_u8(PYTHONX_ETF_SMALL_TUPLE_EXT) && buf.put_u8((uint8_t)size);
+        } else {
+            ret = buf.put_u8(PYTHONX_ETF_LARGE_TUPLE_EXT) && buf.put_u32((uint32_t)size);
+        }
+        for (Py_ssize_t i = 0; ret && i < size; ++i) {
+            ret = etf_put_python(buf, PyTuple_GET_ITEM(val, i), in_key);
+        }
+    } else if (PyList_Check(val)) {
+        Py_ssize_t size = PyList_GET_SIZE(val);
+        if (size == 0) {
+            ret = buf.put_u8(PYTHONX_ETF_NIL_EXT);
+        } else {
+            ret = buf.put_u8(PYTHONX_ETF_LIST_EXT) && buf.put_u32((uint32_t)size);
+            for (Py_ssize_t i = 0; ret && i < size; ++i) {
+                ret = etf_put_python(buf, PyList_GET_ITEM(val, i));
+            }
+            ret = ret && buf.put_u8(PYTHONX_ETF_NIL_EXT);
+        }
+    } else if (in_key) {
+        PyErr_Format(PyExc_TypeError, "cannot encode a dict key of type %s to ETF", Py_TYPE(val)->tp_name);
+    } else {
+        // unsupported types are mapped to nil, same as `python_to`
+        ret = etf_put_atom(buf, "nil", 3);
+    }
+
+    Py_LeaveRecursiveCall();
+    return ret;
+}
+
+// ------- ETF -> Python -------
+
+struct EtfReader {
+    const unsigned char *data;
+    size_t size;
+    size_t pos = 0;
+
+    EtfReader(const unsigned char *data, size_t size) : data(data), size(size) {}
+
+    bool has(size_t n) const {
+        return n <= size - pos;
+    }
+
+    bool get_u8(uint8_t &v) {
+        if (!has(1)) return false;
+        v = data[pos++];
+        return true;
+    }
+
+    bool get_u16(uint16_t &v) {
+        if (!has(2)) return false;
+        v = (uint16_t)((data[pos] << 8) | data[pos + 1]);
+        pos += 2;
+        return true;
+    }
+
+    bool get_u32(uint32_t &v) {
+        if (!has(4)) return false;
+        v = ((uint32_t)data[pos] << 24) | ((uint32_t)data[pos + 1] << 16) | ((uint32_t)data[pos + 2] << 8) | (uint32_t)data[pos + 3];
+        pos += 4;
+        return true;
+    }
+
+    const char *get_bytes(size_t n) {
+        if (!has(n)) return nullptr;
+        const char *p = (const char *)(data + pos);
+        pos += n;
+        return p;
+    }
+};
+
+static PyObject *etf_malformed() {
+    PyErr_SetString(PyExc_ValueError, "malformed or unsupported external term format data");
+    return nullptr;
+}
+
+// Same mapping as `erl_to_python` in pythonx.cpp; maps are decoded to dicts.
+static PyObject *etf_get_python(EtfReader &reader);
+
+static PyObject *etf_get_atom(EtfReader &reader, size_t len, bool latin1) {
+    const char *name = reader.get_bytes(len);
+    if (name == nullptr) return etf_malformed();
+
+    if (len == 3 && memcmp(name, "nil", 3) == 0) Py_RETURN_NONE;
+    if (len == 4 && memcmp(name, "true", 4) == 0) Py_RETURN_TRUE;
+    if (len == 5 && memcmp(name, "false", 5) == 0) Py_RETURN_FALSE;
+    if (latin1) return PyUnicode_DecodeLatin1(name, len, "strict");
+    return PyUnicode_DecodeUTF8(name, len, "strict");
+}
+
+static PyObject *etf_get_big(EtfReader &reader, size_t n) {
+    uint8_t sign;
+    if (!reader.get_u8(sign)) return etf_malformed();
+    const char *digits = reader.get_bytes(n);
+    if (digits == nullptr) return etf_malformed();
+
+    PyObject *magnitude = nullptr;
+    if (n <= 8) {
+        unsigned long long v = 0;
+        for (size_t i = n; i > 0; --i) v = (v << 8) | (uint8_t)digits[i - 1];
+        magnitude = PyLong_FromUnsignedLongLong(v);
+    } else {
+        magnitude = PyObject_CallMethod((PyObject *)&PyLong_Type, "from_bytes", "y#s", digits, (Py_ssize_t)n, "little");
+    }
+    if (magnitude == nullptr || !sign) return magnitude;
+
+    PyObject *negated = PyNumber_Negative(magnitude);
+    Py_DECREF(magnitude);
+    return negated;
+}
+
+static PyObject *etf_get_sequence(EtfReader &reader, size_t n, bool as_tuple) {
+    // every element takes at least one byte
+    if (!reader.has(n)) return etf_malformed();
+
+    PyObject *seq = as_tuple ? PyTuple_New(n) : PyList_New(n);
+    if (seq == nullptr) return nullptr;
+    if (Py_EnterRecursiveCall(" while decoding ETF to a Python object")) {
+        Py_DECREF(seq);
+        return nullptr;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        PyObject *item = etf_get_python(reader);
+        if (item == nullptr) {
+            Py_LeaveRecursiveCall();
+            Py_DECREF(seq);
+            return nullptr;
+        }
+        if (as_tuple) {
+            PyTuple_SET_ITEM(seq, i, item);
+        } else {
+            PyList_SET_ITEM(seq, i, item);
+        }
+    }
+    Py_LeaveRecursiveCall();
+    return seq;
+}
+
+static PyObject *etf_get_list(EtfReader &reader) {
+    uint32_t n;
+    if (!reader.get_u32(n)) return etf_malformed();
+    PyObject *list = etf_get_sequence(reader, n, false);
+    if (list == nullptr) return nullptr;
+
+    uint8_t tail_tag;
+    if (!reader.get_u8(tail_tag) || tail_tag != PYTHONX_ETF_NIL_EXT) {
+        // improper lists have no Python equivalent
+        Py_DECREF(list);
+        return etf_malformed();
+    }
+    return list;
+}
+
+static PyObject *etf_get_map(EtfReader &reader) {
+    uint32_t n;
+    if (!reader.get_u32(n)) return etf_malformed();
+    if (!reader.has(n)) return etf_malformed();
+
+    PyObject *dict = PyDict_New();
+    if (dict == nullptr) return nullptr;
+    for (uint32_t i = 0; i < n; ++i) {
+        PyObject *key = etf_get_python(reader);
+        if (key == nullptr) {
+            Py_DECREF(dict);
+            return nullptr;
+        }
+        PyObject *value = etf_get_python(reader);
+        if (value == nullptr) {
+            Py_DECREF(key);
+            Py_DECREF(dict);
+            return nullptr;
+        }
+        int result = PyDict_SetItem(dict, key, value);
+        Py_DECREF(key);
+        Py_DECREF(value);
+        if (result == -1) {
+            Py_DECREF(dict);
+            return nullptr;
+        }
+    }
+    return dict;
+}
+
+static PyObject *etf_get_python(EtfReader &reader) {
+    uint8_t tag;
+    if (!reader.get_u8(tag)) return etf_malformed();
+
+    switch (tag) {
+        case PYTHONX_ETF_SMALL_INTEGER_EXT: {
+            uint8_t v;
+            if (!reader.get_u8(v)) return etf_malformed();
+            return PyLong_FromLong(v);
+        }
+        case PYTHONX_ETF_INTEGER_EXT: {
+            uint32_t v;
+            if (!reader.get_u32(v)) return etf_malformed();
+            return PyLong_FromLong((int32_t)v);
+        }
+        case PYTHONX_ETF_SMALL_BIG_EXT: {
+            uint8_t n;
+            if (!reader.get_u8(n)) return etf_malformed();
+            return etf_get_big(reader, n);
+        }
+        case PYTHONX_ETF_LARGE_BIG_EXT: {
+            uint32_t n;
+            if (!reader.get_u32(n)) return etf_malformed();
+            return etf_get_big(reader, n);
+        }
+        case PYTHONX_ETF_NEW_FLOAT_EXT: {
+            uint32_t hi, lo;
+            if (!reader.get_u32(hi) || !reader.get_u32(lo)) return etf_malformed();
+            uint64_t bits = ((uint64_t)hi << 32) | lo;
+            double v;
+            memcpy(&v, &bits, sizeof(v));
+            return PyFloat_FromDouble(v);
+        }
+        case PYTHONX_ETF_FLOAT_EXT: {
+            const char *repr = reader.get_bytes(31);
+            if (repr == nullptr) return etf_malformed();
+            std::string str(repr, strnlen(repr, 31));
+            double v = PyOS_string_to_double(str.c_str(), nullptr, nullptr);
+            if (v == -1.0 && PyErr_Occurred()) return nullptr;
+            return PyFloat_FromDouble(v);
+        }
+        case PYTHONX_ETF_ATOM_EXT:
+        case PYTHONX_ETF_ATOM_UTF8_EXT: {
+            uint16_t len;
+            if (!reader.get_u16(len)) return etf_malformed();
+            return etf_get_atom(reader, len, tag == PYTHONX_ETF_ATOM_EXT);
+        }
+        case PYTHONX_ETF_SMALL_ATOM_EXT:
+        case PYTHONX_ETF_SMALL_ATOM_UTF8_EXT: {
+            uint8_t len;
+            if (!reader.get_u8(len)) return etf_malformed();
+            return etf_get_atom(reader, len, tag == PYTHONX_ETF_SMALL_ATOM_EXT);
+        }
+        case PYTHONX_ETF_BINARY_EXT: {
+            uint32_t len;
+            if (!reader.get_u32(len)) return etf_malformed();
+            const char *data = reader.get_bytes(len);
+            if (data == nullptr) return etf_malformed();
+            return PyUnicode_DecodeUTF8(data, len, "strict");
+        }
+        case PYTHONX_ETF_NIL_EXT:
+            return PyList_New(0);
+        case PYTHONX_ETF_STRING_EXT: {
+            // a list of small integers that the VM packed as bytes
+            uint16_t len;
+            if (!reader.get_u16(len)) return etf_malformed();
+            const char *data = reader.get_bytes(len);
+            if (data == nullptr) return etf_malformed();
+            PyObject *list = PyList_New(len);
+            if (list == nullptr) return nullptr;
+            for (uint16_t i = 0; i < len; ++i) {
+                PyList_SET_ITEM(list, i, PyLong_FromLong((uint8_t)data[i]));
+            }
+            return list;
+        }
+        case PYTHONX_ETF_LIST_EXT:
+            return etf_get_list(reader);
+        case PYTHONX_ETF_SMALL_TUPLE_EXT: {
+            uint8_t n;
+            if (!reader.get_u8(n)) return etf_malformed();
+            return etf_get_sequence(reader, n, true);
+        }
+        case PYTHONX_ETF_LARGE_TUPLE_EXT: {
+            uint32_t n;
+            if (!reader.get_u32(n)) return etf_malformed();
+            return etf_get_sequence(reader, n, true);
+        }
+        case PYTHONX_ETF_MAP_EXT: {
+            if (Py_EnterRecursiveCall(" while decoding ETF to a Python object")) return nullptr;
+            PyObject *dict = etf_get_map(reader);
+            Py_LeaveRecursiveCall();
+            return dict;
+        }
+        default:
+            // compressed terms, pids, references, funs, ...
+            return etf_malformed();
+    }
+}
+
+// ------- NIF functions -------
+
+static ERL_NIF_TERM pythonx_etf_encode(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    PyObjectNifRes *res = get_resource<PyObjectNifRes>(env, argv[0]);
+    if (unlikely(res == nullptr)) return enif_make_badarg(env);
+
+    EtfBuffer buf;
+    if (!buf.put_u8(PYTHONX_ETF_VERSION)) return kAtomError;
+    if (!etf_put_python(buf, res->val)) {
+        if (PyErr_Occurred()) return pythonx_current_pyerr(env);
+        return kAtomError;
+    }
+
+    auto ret = buf.make(env);
+    if (!ret) return kAtomError;
+    return ret.value();
+}
+
+static ERL_NIF_TERM pythonx_etf_decode(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    ErlNifBinary binary;
+    if (!enif_inspect_binary(env, argv[0], &binary)) return enif_make_badarg(env);
+
+    EtfReader reader(binary.data, binary.size);
+    uint8_t version;
+    if (!reader.get_u8(version) || version != PYTHONX_ETF_VERSION) {
+        return pyobject_to_nifres_or_pyerr(env, etf_malformed());
+    }
+
+    PyObject *result = etf_get_python(reader);
+    if (result != nullptr && reader.pos != reader.size) {
+        Py_DECREF(result);
+        result = etf_malformed();
+    }
+    return pyobject_to_nifres_or_pyerr(env, result);
+}
+
+#endif  // PYTHONX_ETF_HPP
@@ -0,0 +1,269 @@
+#ifndef PYTHONX_GC_HPP
+#define PYTHONX_GC_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <erl_nif.h>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+#include "pythonx_utils.hpp"
+#include "pythonx_pyerr.hpp"
+
+// Control of the cyclic garbage collector, and statistics about its pauses.
+//
+// A callback in `gc.callbacks` times every collection, including the ones
+// triggered by allocations in the middle of other calls.
+
+// pauses are bucketed by powers of two microseconds, the last bucket is open-ended
+static constexpr int kPythonxGCPauseBuckets = 16;
+
+struct PythonxGCGenerationStats {
+    std::atomic<int64_t> collections{0};
+    std::atomic<int64_t> collected{0};
+    std::atomic<int64_t> uncollectable{0};
+    std::atomic<int64_t> pause_us{0};
+    std::atomic<int64_t> max_pause_us{0};
+};
+
+static PythonxGCGenerationStats pythonx_gc_generations[3];
+static std::atomic<int64_t> pythonx_gc_pauses[kPythonxGCPauseBuckets];
+// only touched by the callback, which runs with the GIL held
+static std::chrono::steady_clock::time_point pythonx_gc_start;
+// imported once per interpreter, only touched with the python mutex held
+static PyObject *pythonx_gc_module = nullptr;
+
+// Returns a borrowed reference to the gc module, or nullptr with the error set.
+static PyObject * pythonx_gc_get_module() {
+    if (pythonx_gc_module == nullptr) pythonx_gc_module = PyImport_ImportModule("gc");
+    return pythonx_gc_module;
+}
+
+// Drops the cached module, used when the interpreter is finalized.
+static void pythonx_gc_detach() {
+    Py_CLEAR(pythonx_gc_module);
+}
+
+static PyObject * pythonx_gc_call(const char *name, const char *format = nullptr, ...) {
+    PyObject *gc = pythonx_gc_get_module();
+    if (gc == nullptr) return nullptr;
+    PyObject *func = PyObject_GetAttrString(gc, name);
+    if (func == nullptr) return nullptr;
+
+    PyObject *args;
+    if (format == nullptr) {
+        args = PyTuple_New(0);
+    } else {
+        va_list va;
+        va_start(va, format);
+        args = Py_VaBuildValue(format, va);
+        va_end(va);
+    }
+    if (args == nullptr) {
+        Py_DECREF(func);
+        return nullptr;
+    }
+
+    PyObject *result = PyObject_Call(func, args, nullptr);
+    Py_DECREF(args);
+    Py_DECREF(func);
+    return result;
+}
+
+static void pythonx_gc_record(int generation, int64_t pause_us, PyObject *info) {
+    if (generation < 0 || generation > 2) return;
+
+    PythonxGCGenerationStats &stats = pythonx_gc_generations[generation];
+    stats.collections.fetch_add(1, std::memory_order_relaxed);
+    stats.pause_us.fetch_add(pause_us, std::memory_order_relaxed);
+    int64_t max = stats.max_pause_us.load(std::memory_order_relaxed);
+    while (pause_us > max && !stats.max_pause_us.compare_exchange_weak(max, pause_us, std::memory_order_relaxed)) {}
+
+    PyObject *collected = PyDict_GetItemString(info, "collected");
+    if (collected && PyLong_Check(collected)) stats.collected.fetch_add(PyLong_AsLongLong(collected), std::memory_order_relaxed);
+    PyObject *uncollectable = PyDict_GetItemString(info, "uncollectable");
+    if (uncollectable && PyLong_Check(uncollectable)) stats.uncollectable.fetch_add(PyLong_AsLongLong(uncollectable), std::memory_order_relaxed);
+
+    int bucket = 0;
+    while (bucket < kPythonxGCPauseBuckets - 1 && pause_us >= ((int64_t)1 << bucket)) ++bucket;
+    pythonx_gc_pauses[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+static PyObject * pythonx_gc_callback(PyObject *self, PyObject *args) {
+    PyObject *phase, *info;
+    if (!PyArg_ParseTuple(args, "UO!", &phase, &PyDict_Type, &info)) return nullptr;
+
+    if (PyUnicode_CompareWithASCIIString(phase, "start") == 0) {
+        pythonx_gc_start = std::chrono::steady_clock::now();
+    } else {
+        int64_t pause_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - pythonx_gc_start).count();
+        PyObject *generation = PyDict_GetItemString(info, "generation");
+        if (generation && PyLong_Check(generation)) pythonx_gc_record((int)PyLong_AsLong(generation), pause_us, info);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef pythonx_gc_callback_def = {"pythonx_gc_callback", pythonx_gc_callback, METH_VARARGS, nullptr};
+
+// Appends the timing callback to `gc.callbacks`, once per interpreter.
+static int pythonx_gc_install_callback() {
+    PyObject *gc = pythonx_gc_get_module();
+    if (gc == nullptr) return -1;
+    PyObject *callbacks = PyObject_GetAttrString(gc, "callbacks");
+    if (callbacks == nullptr) return -1;
+
+    PyObject *callback = PyCFunction_New(&pythonx_gc_callback_def, nullptr);
+    int ret = callback ? PyList_Append(callbacks, callback) : -1;
+    Py_XDECREF(callback);
+    Py_DECREF(callbacks);
+    return ret;
+}
+
+static ERL_NIF_TERM pythonx_gc_none_to_ok(ErlNifEnv *env, PyObject *result) {
+    if (result == nullptr) return pythonx_current_pyerr(env);
+    Py_DECREF(result);
+    return kAtomOk;
+}
+
+static ERL_NIF_TERM pythonx_gc_generation_stats(ErlNifEnv *env, PythonxGCGenerationStats &stats) {
+    ERL_NIF_TERM keys[] = {
+        enif_make_atom(env, "collections"),
+        enif_make_atom(env, "collected"),
+        enif_make_atom(env, "uncollectable"),
+        enif_make_atom(env, "pause_us"),
+        enif_make_atom(env, "max_pause_us"),
+    };
+    ERL_NIF_TERM values[] = {
+        enif_make_int64(env, stats.collections.load(std::memory_order_relaxed)),
+        enif_make_int64(env, stats.collected.load(std::memory_order_relaxed)),
+        enif_make_int64(env, stats.uncollectable.load(std::memory_order_relaxed)),
+        enif_make_int64(env, stats.pause_us.load(std::memory_order_relaxed)),
+        enif_make_int64(env, stats.max_pause_us.load(std::memory_order_relaxed)),
+    };
+    ERL_NIF_TERM ret;
+    enif_make_map_from_arrays(env, keys, values, 5, &ret);
+    return ret;
+}
+
+// ------- NIF functions -------
+
+static ERL_NIF_TERM pythonx_gc_collect(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    int64_t generation;
+    if (!erlang::nif::get(env, argv[0], &generation) || generation < 0 || generation > 2) {
+        return enif_make_badarg(env);
+    }
+
+    PyObject *result = pythonx_gc_call("collect", "(L)", (long long)generation);
+    if (result == nullptr) return pythonx_current_pyerr(env);
+    long long collected = PyLong_AsLongLong(result);
+    Py_DECREF(result);
+    return enif_make_int64(env, collected);
+}
+
+static ERL_NIF_TERM pythonx_gc_set_enabled(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    bool enabled;
+    if (!erlang::nif::get(env, argv[0], &enabled)) {
+        return enif_make_badarg(env);
+    }
+
+    PyObject *was_enabled = pythonx_gc_call("isenabled");
+    if (was_enabled == nullptr) return pythonx_current_pyerr(env);
+    bool previous = was_enabled == Py_True;
+    Py_DECREF(was_enabled);
+
+    PyObject *result = pythonx_gc_call(enabled ? "enable" : "disable");
+    if (result == nullptr) return pythonx_current_pyerr(env);
+    Py_DECREF(result);
+    return previous ? kAtomTrue : kAtomFalse;
+}
+
+static ERL_NIF_TERM pythonx_gc_get_threshold(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    PyObject *result = pythonx_gc_call("get_threshold");
+    if (result == nullptr) return pythonx_current_pyerr(env);
+
+    long long t0, t1, t2;
+    if (!PyArg_ParseTuple(result, "LLL", &t0, &t1, &t2)) {
+        Py_DECREF(result);
+        return pythonx_current_pyerr(env);
+    }
+    Py_DECREF(result);
+    return enif_make_tuple3(env, enif_make_int64(env, t0), enif_make_int64(env, t1), enif_make_int64(env, t2));
+}
+
+static ERL_NIF_TERM pythonx_gc_set_threshold(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    int64_t thresholds[3];
+    for (int i = 0; i < 3; ++i) {
+        if (!erlang::nif::get(env, argv[i], &thresholds[i]) || thresholds[i] < 0) {
+            return enif_make_badarg(env);
+        }
+    }
+    return pythonx_gc_none_to_ok(env, pythonx_gc_call("set_threshold", "(LLL)", (long long)thresholds[0], (long long)thresholds[1], (long long)thresholds[2]));
+}
+
+static ERL_NIF_TERM pythonx_gc_freeze(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    return pythonx_gc_none_to_ok(env, pythonx_gc_call("freeze"));
+}
+
+static ERL_NIF_TERM pythonx_gc_unfreeze(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    return pythonx_gc_none_to_ok(env, pythonx_gc_call("unfreeze"));
+}
+
+static ERL_NIF_TERM pythonx_gc_stats(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    PyObject *enabled = pythonx_gc_call("isenabled");
+    if (enabled == nullptr) return pythonx_current_pyerr(env);
+    ERL_NIF_TERM enabled_term = enabled == Py_True ? kAtomTrue : kAtomFalse;
+    Py_DECREF(enabled);
+
+    PyObject *frozen = pythonx_gc_call("get_freeze_count");
+    if (frozen == nullptr) return pythonx_current_pyerr(env);
+    ERL_NIF_TERM frozen_term = enif_make_int64(env, PyLong_AsLongLong(frozen));
+    Py_DECREF(frozen);
+
+    ERL_NIF_TERM generations[3];
+    for (int i = 0; i < 3; ++i) {
+        generations[i] = pythonx_gc_generation_stats(env, pythonx_gc_generations[i]);
+    }
+
+    ERL_NIF_TERM pauses[kPythonxGCPauseBuckets];
+    for (int i = 0; i < kPythonxGCPauseBuckets; ++i) {
+        ERL_NIF_TERM upper = i == kPythonxGCPauseBuckets - 1
+            ? enif_make_atom(env, "infinity")
+            : enif_make_int64(env, (int64_t)1 << i);
+        pauses[i] = enif_make_tuple2(env, upper, enif_make_int64(env, pythonx_gc_pauses[i].load(std::memory_order_relaxed)));
+    }
+
+    ERL_NIF_TERM keys[] = {
+        enif_make_atom(env, "enabled"),
+        enif_make_atom(env, "frozen"),
+        enif_make_atom(env, "generations"),
+        enif_make_atom(env, "pauses"),
+    };
+    ERL_NIF_TERM values[] = {
+        enabled_term,
+        frozen_term,
+        enif_make_list_from_array(env, generations, 3),
+        enif_make_list_from_array(env, pauses, kPythonxGCPauseBuckets),
+    };
+    ERL_NIF_TERM ret;
+    enif_make_map_from_arrays(env, keys, values, 4, &ret);
+    return ret;
+}
+
+static ERL_NIF_TERM pythonx_gc_stats_reset(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    for (auto &stats : pythonx_gc_generations) {
+        stats.collections.store(0, std::memory_order_relaxed);
+        stats.collected.store(0, std::memory_order_relaxed);
+        stats.uncollectable.store(0, std::memory_order_relaxed);
+        stats.pause_us.store(0, std::memory_order_relaxed);
+        stats.max_pause_us.store(0, std::memory_order_relaxed);
+    }
+    for (auto &bucket : pythonx_gc_pauses) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    return kAtomOk;
+}
+
+#endif  // PYTHONX_GC_HPP
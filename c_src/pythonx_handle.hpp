@@ -0,0 +1,528 @@
+#ifndef PYTHONX_HANDLE_HPP
+#define PYTHONX_HANDLE_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <erl_nif.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+#include "pythonx_deferred.hpp"
+#include "pythonx_utils.hpp"
+#include "pythonx_pyerr.hpp"
+
+// Python objects addressed by integer handles into a slab of slots, as a
+// cheaper alternative to one NIF resource per object.
+//
+// A handle packs the index of a slot and the generation of that slot:
+//
+//     handle = generation << 32 | index
+//
+// Releasing a slot bumps its generation, so a handle that outlives its slot
+// no longer matches and is rejected. Each slot owns a strong reference to
+// its object until the handle is released.
+
+using PyHandle = uint64_t;
+
+struct PyHandleSlot {
+    PyObject * val;
+    uint32_t generation;
+};
+
+static ErlNifMutex * pyhandle_mutex = nullptr;
+static std::vector<PyHandleSlot> pyhandle_slots;
+static std::vector<uint32_t> pyhandle_free_slots;
+
+// A scope that owns the handles allocated in it, so that they can all be
+// released in one call. Handles released on their own are skipped, as their
+// generation no longer matches.
+struct PyArenaNifRes {
+    std::vector<PyHandle> * handles;
+    static ErlNifResourceType *type;
+};
+
+struct PyHandleLock {
+    PyHandleLock() { enif_mutex_lock(pyhandle_mutex); }
+    ~PyHandleLock() { enif_mutex_unlock(pyhandle_mutex); }
+};
+
+static inline PyHandle pyhandle_make(uint32_t index, uint32_t generation) {
+    return ((PyHandle)generation << 32) | index;
+}
+
+// Stores `val` in a free slot, stealing the reference. Must hold PyHandleLock.
+static PyHandle pyhandle_put_locked(PyObject *val) {
+    uint32_t index;
+    if (!pyhandle_free_slots.empty()) {
+        index = pyhandle_free_slots.back();
+        pyhandle_free_slots.pop_back();
+    } else {
+        index = (uint32_t)pyhandle_slots.size();
+        pyhandle_slots.push_back({nullptr, 1});
+    }
+    pyhandle_slots[index].val = val;
+    return pyhandle_make(index, pyhandle_slots[index].generation);
+}
+
+// Returns the slot of a live handle, or nullptr. Must hold PyHandleLock.
+static inline PyHandleSlot * pyhandle_slot_locked(PyHandle handle) {
+    uint32_t index = (uint32_t)(handle & 0xFFFFFFFF);
+    uint32_t generation = (uint32_t)(handle >> 32);
+    if (unlikely(index >= pyhandle_slots.size())) return nullptr;
+    PyHandleSlot *slot = &pyhandle_slots[index];
+    if (unlikely(slot->val == nullptr || slot->generation != generation)) return nullptr;
+    return slot;
+}
+
+// Empties a live slot and returns its reference. Must hold PyHandleLock.
+static PyObject * pyhandle_take_locked(PyHandleSlot *slot) {
+    PyObject *val = slot->val;
+    slot->val = nullptr;
+    // generation 0 is never handed out, so a handle of 0 is always stale
+    if (++slot->generation == 0) slot->generation = 1;
+    pyhandle_free_slots.push_back((uint32_t)(slot - pyhandle_slots.data()));
+    return val;
+}
+
+// Stores each of `vals` in a handle, stealing the references, and returns the
+// list of handles. Must hold PyHandleLock.
+static ERL_NIF_TERM pyhandle_put_list_locked(ErlNifEnv *env, const std::vector<PyObject *> &vals, PyArenaNifRes *arena) {
+    std::vector<ERL_NIF_TERM> handles(vals.size());
+    for (size_t i = 0; i < vals.size(); ++i) {
+        PyHandle handle = pyhandle_put_locked(vals[i]);
+        if (arena != nullptr) arena->handles->emplace_back(handle);
+        handles[i] = enif_make_uint64(env, handle);
+    }
+    return enif_make_list_from_array(env, handles.data(), (unsigned)handles.size());
+}
+
+// Stores `val`, stealing the reference, and records the handle in `arena` if it is not nullptr.
+static PyHandle pyhandle_put(PyObject *val, PyArenaNifRes *arena = nullptr) {
+    PyHandleLock lock;
+    PyHandle handle = pyhandle_put_locked(val);
+    if (arena != nullptr) arena->handles->emplace_back(handle);
+    return handle;
+}
+
+// Returns a new reference to the object behind `handle`, or nullptr if the handle is stale.
+static PyObject * pyhandle_get(PyHandle handle) {
+    PyHandleLock lock;
+    PyHandleSlot *slot = pyhandle_slot_locked(handle);
+    if (slot == nullptr) return nullptr;
+    Py_INCREF(slot->val);
+    return slot->val;
+}
+
+static PyObject * pyhandle_get(ErlNifEnv *env, ERL_NIF_TERM term) {
+    PyHandle handle;
+    if (!erlang::nif::get(env, term, &handle)) return nullptr;
+    return pyhandle_get(handle);
+}
+
+// Returns a new reference to the object behind a handle or a `Pythonx.C`
+// reference, or nullptr if `term` is neither.
+static PyObject * pyhandle_or_ref_get(ErlNifEnv *env, ERL_NIF_TERM term) {
+    PyObjectNifRes *res = get_resource<PyObjectNifRes>(env, term);
+    if (res != nullptr) {
+        Py_INCREF(res->val);
+        return res->val;
+    }
+    return pyhandle_get(env, term);
+}
+
+static ERL_NIF_TERM pyhandle_to_term_or_pyerr(ErlNifEnv *env, PyObject *result, PyArenaNifRes *arena) {
+    if (unlikely(result == nullptr)) return pythonx_current_pyerr(env);
+    return enif_make_uint64(env, pyhandle_put(result, arena));
+}
+
+// `nil` means no arena. Returns false if `term` is neither nil nor an arena.
+static bool pyhandle_get_arena(ErlNifEnv *env, ERL_NIF_TERM term, PyArenaNifRes **arena) {
+    if (enif_is_identical(term, kAtomNil)) {
+        *arena = nullptr;
+        return true;
+    }
+    *arena = get_resource<PyArenaNifRes>(env, term);
+    return *arena != nullptr;
+}
+
+// Empties every live handle in `arena` and the arena itself. Returns the references of the handles.
+static std::vector<PyObject *> pyarena_take(PyArenaNifRes *arena) {
+    std::vector<PyObject *> released;
+    PyHandleLock lock;
+    released.reserve(arena->handles->size());
+    for (PyHandle handle : *arena->handles) {
+        PyHandleSlot *slot = pyhandle_slot_locked(handle);
+        if (slot != nullptr) released.emplace_back(pyhandle_take_locked(slot));
+    }
+    arena->handles->clear();
+    return released;
+}
+
+static void destruct_py_arena(ErlNifEnv *env, void * args) {
+    auto res = (struct PyArenaNifRes *)args;
+    if (res->handles != nullptr) {
+        // taken before the slots, so that slots of a later interpreter are never queued as this one's
+        uint64_t epoch = pythonx_current_epoch();
+        for (PyObject *val : pyarena_take(res)) pythonx_defer_decref(val, epoch);
+        delete res->handles;
+    }
+}
+
+// Releases every live handle, used when the interpreter is finalized.
+static void pyhandle_release_all() {
+    std::vector<PyObject *> released;
+    {
+        PyHandleLock lock;
+        for (auto &slot : pyhandle_slots) {
+            if (slot.val != nullptr) released.emplace_back(pyhandle_take_locked(&slot));
+        }
+    }
+    for (PyObject *val : released) Py_DECREF(val);
+}
+
+// Binary number protocol functions, looked up by the name of their `Pythonx.C.PyNumber` wrapper.
+static binaryfunc pyhandle_number_op(const char *name) {
+    static const struct { const char *name; binaryfunc fn; } ops[] = {
+        {"add", PyNumber_Add},
+        {"subtract", PyNumber_Subtract},
+        {"multiply", PyNumber_Multiply},
+        {"matrix_multiply", PyNumber_MatrixMultiply},
+        {"floor_divide", PyNumber_FloorDivide},
+        {"true_divide", PyNumber_TrueDivide},
+        {"remainder", PyNumber_Remainder},
+        {"divmod", PyNumber_Divmod},
+        {"lshift", PyNumber_Lshift},
+        {"rshift", PyNumber_Rshift},
+        {"and", PyNumber_And},
+        {"xor", PyNumber_Xor},
+        {"or", PyNumber_Or},
+    };
+    for (auto &op : ops) {
+        if (strcmp(op.name, name) == 0) return op.fn;
+    }
+    return nullptr;
+}
+
+static binaryfunc pyhandle_number_op(ErlNifEnv *env, ERL_NIF_TERM term) {
+    char name[32];
+    if (!enif_get_atom(env, term, name, sizeof(name), ERL_NIF_LATIN1)) return nullptr;
+    return pyhandle_number_op(name);
+}
+
+// A new dict with room for `size` items. The pre-sizing constructor is
+// underscored C API until 3.12, and only an internal function since 3.13.
+static inline PyObject * pyhandle_dict_new(Py_ssize_t size) {
+#if PY_VERSION_HEX < 0x030D0000
+    return _PyDict_NewPresized(size);
+#else
+    return PyDict_New();
+#endif
+}
+
+// Builds a list or a tuple of the objects behind the handles in `items`.
+// Filling a sequence runs no Python code, so the items are resolved and the
+// result is stored under one slab lock.
+static ERL_NIF_TERM pyhandle_make_sequence(ErlNifEnv *env, ERL_NIF_TERM items, ERL_NIF_TERM arena_term, bool tuple) {
+    unsigned length;
+    if (!enif_get_list_length(env, items, &length)) return enif_make_badarg(env);
+    PyArenaNifRes *arena;
+    if (!pyhandle_get_arena(env, arena_term, &arena)) return enif_make_badarg(env);
+
+    PyObject *seq = tuple ? PyTuple_New(length) : PyList_New(length);
+    if (unlikely(seq == nullptr)) return pythonx_current_pyerr(env);
+
+    bool ok = true;
+    PyHandle handle = 0;
+    {
+        PyHandleLock lock;
+        ERL_NIF_TERM head, tail = items;
+        for (Py_ssize_t i = 0; ok && enif_get_list_cell(env, tail, &head, &tail); ++i) {
+            PyHandle item;
+            PyHandleSlot *slot = erlang::nif::get(env, head, &item) ? pyhandle_slot_locked(item) : nullptr;
+            ok = slot != nullptr;
+            if (!ok) break;
+            Py_INCREF(slot->val);
+            if (tuple) PyTuple_SET_ITEM(seq, i, slot->val);
+            else PyList_SET_ITEM(seq, i, slot->val);
+        }
+        if (ok) {
+            handle = pyhandle_put_locked(seq);
+            if (arena != nullptr) arena->handles->emplace_back(handle);
+        }
+    }
+
+    if (!ok) {
+        // the items that were not set are NULL, which the deallocator skips
+        Py_DECREF(seq);
+        return enif_make_badarg(env);
+    }
+    return enif_make_uint64(env, handle);
+}
+
+// ------- NIF functions -------
+
+static ERL_NIF_TERM pythonx_handle_new(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    PyObjectNifRes *res = get_resource<PyObjectNifRes>(env, argv[0]);
+    if (unlikely(res == nullptr)) return enif_make_badarg(env);
+    PyArenaNifRes *arena;
+    if (!pyhandle_get_arena(env, argv[1], &arena)) return enif_make_badarg(env);
+
+    Py_INCREF(res->val);
+    return enif_make_uint64(env, pyhandle_put(res->val, arena));
+}
+
+static ERL_NIF_TERM pythonx_handle_to_ref(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    PyObject *val = pyhandle_get(env, argv[0]);
+    if (unlikely(val == nullptr)) return enif_make_badarg(env);
+
+    return nonnull_pyobject_to_nifres(env, val);
+}
+
+static ERL_NIF_TERM pythonx_handle_release(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    unsigned length;
+    if (!enif_get_list_length(env, argv[0], &length)) return enif_make_badarg(env);
+
+    std::vector<PyObject *> released;
+    released.reserve(length);
+    {
+        PyHandleLock lock;
+        ERL_NIF_TERM head, tail = argv[0];
+        while (enif_get_list_cell(env, tail, &head, &tail)) {
+            PyHandle handle;
+            if (!erlang::nif::get(env, head, &handle)) continue;
+            PyHandleSlot *slot = pyhandle_slot_locked(handle);
+            if (slot != nullptr) released.emplace_back(pyhandle_take_locked(slot));
+        }
+    }
+
+    // decref outside of the slab lock, finalizers may run arbitrary code
+    for (PyObject *val : released) Py_DECREF(val);
+    return enif_make_uint64(env, released.size());
+}
+
+static ERL_NIF_TERM pythonx_handle_count(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    PyHandleLock lock;
+    return enif_make_uint64(env, pyhandle_slots.size() - pyhandle_free_slots.size());
+}
+
+static ERL_NIF_TERM pythonx_handle_from_long(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    int64_t v;
+    if (!erlang::nif::get(env, argv[0], &v)) return enif_make_badarg(env);
+    PyArenaNifRes *arena;
+    if (!pyhandle_get_arena(env, argv[1], &arena)) return enif_make_badarg(env);
+
+    return pyhandle_to_term_or_pyerr(env, PyLong_FromLongLong(v), arena);
+}
+
+static ERL_NIF_TERM pythonx_handle_as_long(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    PyObject *val = pyhandle_get(env, argv[0]);
+    if (unlikely(val == nullptr)) return enif_make_badarg(env);
+
+    long long result = PyLong_AsLongLong(val);
+    Py_DECREF(val);
+    if (result == -1 && PyErr_Occurred()) return pythonx_current_pyerr(env);
+    return enif_make_int64(env, result);
+}
+
+static ERL_NIF_TERM pythonx_handle_number(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    binaryfunc op = pyhandle_number_op(env, argv[0]);
+    if (unlikely(op == nullptr)) return enif_make_badarg(env);
+    PyArenaNifRes *arena;
+    if (!pyhandle_get_arena(env, argv[3], &arena)) return enif_make_badarg(env);
+
+    PyObject *o1 = pyhandle_get(env, argv[1]);
+    if (unlikely(o1 == nullptr)) return enif_make_badarg(env);
+    PyObject *o2 = pyhandle_get(env, argv[2]);
+    if (unlikely(o2 == nullptr)) {
+        Py_DECREF(o1);
+        return enif_make_badarg(env);
+    }
+
+    PyObject *result = op(o1, o2);
+    Py_DECREF(o1);
+    Py_DECREF(o2);
+    return pyhandle_to_term_or_pyerr(env, result, arena);
+}
+
+static ERL_NIF_TERM pythonx_handle_list(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    return pyhandle_make_sequence(env, argv[0], argv[1], false);
+}
+
+static ERL_NIF_TERM pythonx_handle_tuple(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    return pyhandle_make_sequence(env, argv[0], argv[1], true);
+}
+
+// Builds a dict from a list of `{key, value}` handle pairs.
+static ERL_NIF_TERM pythonx_handle_dict(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    unsigned length;
+    if (!enif_get_list_length(env, argv[0], &length)) return enif_make_badarg(env);
+    PyArenaNifRes *arena;
+    if (!pyhandle_get_arena(env, argv[1], &arena)) return enif_make_badarg(env);
+
+    std::vector<PyObject *> items;
+    items.reserve(2 * (size_t)length);
+    bool ok = true;
+    {
+        PyHandleLock lock;
+        ERL_NIF_TERM head, tail = argv[0];
+        while (ok && enif_get_list_cell(env, tail, &head, &tail)) {
+            int arity;
+            const ERL_NIF_TERM *pair;
+            ok = enif_get_tuple(env, head, &arity, &pair) && arity == 2;
+            for (int i = 0; ok && i < 2; ++i) {
+                PyHandle handle;
+                PyHandleSlot *slot = erlang::nif::get(env, pair[i], &handle) ? pyhandle_slot_locked(handle) : nullptr;
+                ok = slot != nullptr;
+                if (ok) {
+                    Py_INCREF(slot->val);
+                    items.emplace_back(slot->val);
+                }
+            }
+        }
+    }
+
+    // hashing the keys runs Python code, which is kept out of the slab lock
+    PyObject *dict = ok ? pyhandle_dict_new((Py_ssize_t)length) : nullptr;
+    for (size_t i = 0; dict != nullptr && i + 1 < items.size(); i += 2) {
+        if (PyDict_SetItem(dict, items[i], items[i + 1]) < 0) Py_CLEAR(dict);
+    }
+    for (PyObject *item : items) Py_DECREF(item);
+
+    if (!ok) return enif_make_badarg(env);
+    return pyhandle_to_term_or_pyerr(env, dict, arena);
+}
+
+// The items of a list or a tuple, or the `{key, value}` pairs of a dict, as handles.
+static ERL_NIF_TERM pythonx_handle_items(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    PyHandle handle;
+    if (!erlang::nif::get(env, argv[0], &handle)) return enif_make_badarg(env);
+    PyArenaNifRes *arena;
+    if (!pyhandle_get_arena(env, argv[1], &arena)) return enif_make_badarg(env);
+
+    std::vector<ERL_NIF_TERM> items;
+    PyObject *val;
+    {
+        PyHandleLock lock;
+        PyHandleSlot *slot = pyhandle_slot_locked(handle);
+        if (slot == nullptr) return enif_make_badarg(env);
+        // storing items may grow the slab, so `slot` is not used past this point
+        val = slot->val;
+
+        // reading the items runs no Python code, so they are all stored under this lock
+        auto put = [&](PyObject *item) {
+            Py_INCREF(item);
+            PyHandle item_handle = pyhandle_put_locked(item);
+            if (arena != nullptr) arena->handles->emplace_back(item_handle);
+            return enif_make_uint64(env, item_handle);
+        };
+        if (PyList_Check(val) || PyTuple_Check(val)) {
+            Py_ssize_t size = PySequence_Fast_GET_SIZE(val);
+            PyObject **elems = PySequence_Fast_ITEMS(val);
+            items.resize(size);
+            for (Py_ssize_t i = 0; i < size; ++i) items[i] = put(elems[i]);
+        } else if (PyDict_Check(val)) {
+            items.reserve(PyDict_GET_SIZE(val));
+            Py_ssize_t pos = 0;
+            PyObject *key, *value;
+            while (PyDict_Next(val, &pos, &key, &value)) {
+                ERL_NIF_TERM key_handle = put(key);
+                items.emplace_back(enif_make_tuple2(env, key_handle, put(value)));
+            }
+        } else {
+            val = nullptr;
+        }
+    }
+
+    if (val == nullptr) {
+        PyErr_SetString(PyExc_TypeError, "expected a list, a tuple or a dict");
+        return pythonx_current_pyerr(env);
+    }
+    return enif_make_list_from_array(env, items.data(), (unsigned)items.size());
+}
+
+// Gets several attributes of one object, as handles.
+static ERL_NIF_TERM pythonx_handle_get_attrs(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    unsigned length;
+    if (!enif_get_list_length(env, argv[1], &length)) return enif_make_badarg(env);
+    std::vector<std::string> names(length);
+    ERL_NIF_TERM head, tail = argv[1];
+    for (unsigned i = 0; enif_get_list_cell(env, tail, &head, &tail); ++i) {
+        if (!erlang::nif::get(env, head, names[i])) return enif_make_badarg(env);
+    }
+    PyArenaNifRes *arena;
+    if (!pyhandle_get_arena(env, argv[2], &arena)) return enif_make_badarg(env);
+
+    PyObject *val = pyhandle_get(env, argv[0]);
+    if (unlikely(val == nullptr)) return enif_make_badarg(env);
+
+    std::vector<PyObject *> attrs;
+    attrs.reserve(length);
+    for (auto &name : names) {
+        PyObject *attr = PyObject_GetAttrString(val, name.c_str());
+        if (attr == nullptr) break;
+        attrs.emplace_back(attr);
+    }
+    Py_DECREF(val);
+
+    if (attrs.size() < names.size()) {
+        for (PyObject *attr : attrs) Py_DECREF(attr);
+        return pythonx_current_pyerr(env);
+    }
+    PyHandleLock lock;
+    return pyhandle_put_list_locked(env, attrs, arena);
+}
+
+static ERL_NIF_TERM pythonx_arena_new(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    PyArenaNifRes *res = allocate_resource<PyArenaNifRes>();
+    if (unlikely(res == nullptr)) return enif_make_badarg(env);
+
+    res->handles = new std::vector<PyHandle>();
+    ERL_NIF_TERM ret = enif_make_resource(env, res);
+    enif_release_resource(res);
+    return ret;
+}
+
+static ERL_NIF_TERM pythonx_arena_adopt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    PyArenaNifRes *arena = get_resource<PyArenaNifRes>(env, argv[0]);
+    if (unlikely(arena == nullptr)) return enif_make_badarg(env);
+    unsigned length;
+    if (!enif_get_list_length(env, argv[1], &length)) return enif_make_badarg(env);
+
+    PyHandleLock lock;
+    ERL_NIF_TERM head, tail = argv[1];
+    while (enif_get_list_cell(env, tail, &head, &tail)) {
+        PyHandle handle;
+        if (!erlang::nif::get(env, head, &handle) || pyhandle_slot_locked(handle) == nullptr) {
+            return enif_make_badarg(env);
+        }
+        arena->handles->emplace_back(handle);
+    }
+    return kAtomOk;
+}
+
+static ERL_NIF_TERM pythonx_arena_release(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    PyArenaNifRes *arena = get_resource<PyArenaNifRes>(env, argv[0]);
+    if (unlikely(arena == nullptr)) return enif_make_badarg(env);
+
+    // must hold the python mutex, finalizers may run arbitrary code
+    std::vector<PyObject *> released = pyarena_take(arena);
+    for (PyObject *val : released) Py_DECREF(val);
+    return enif_make_uint64(env, released.size());
+}
+
+static ERL_NIF_TERM pythonx_arena_size(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    PyArenaNifRes *arena = get_resource<PyArenaNifRes>(env, argv[0]);
+    if (unlikely(arena == nullptr)) return enif_make_badarg(env);
+
+    PyHandleLock lock;
+    size_t live = 0;
+    for (PyHandle handle : *arena->handles) {
+        if (pyhandle_slot_locked(handle) != nullptr) ++live;
+    }
+    return enif_make_uint64(env, live);
+}
+
+#endif  // PYTHONX_HANDLE_HPP
@@ -0,0 +1,76 @@
+#ifndef PYTHONX_ITER_HPP
+#define PYTHONX_ITER_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <erl_nif.h>
+#include <vector>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+#include "pythonx_convert.hpp"
+#include "pythonx_handle.hpp"
+#include "pythonx_pyerr.hpp"
+
+// Reading a Python iterator in chunks that are sent straight to a process.
+//
+// Each call takes up to `count` items, decodes them, and sends them as one
+// `{ref, {:chunk, items}}` message. The chunk is built in an env of its own,
+// so it is copied once, into the heap of the receiver. `Pythonx.Iter` makes
+// these calls from a producer process, which stops reading ahead of the
+// consumer until it acknowledges the chunks it got.
+
+// Returns a reference to an iterator over the object behind a handle or a `Pythonx.C` reference.
+static ERL_NIF_TERM pythonx_iter_open(ErlNifEnv *env, ERL_NIF_TERM iterable) {
+    PyObject *val = pyhandle_or_ref_get(env, iterable);
+    if (unlikely(val == nullptr)) return enif_make_badarg(env);
+
+    PyObject *iterator = PyObject_GetIter(val);
+    Py_DECREF(val);
+    return pyobject_to_nifres_or_pyerr(env, iterator);
+}
+
+// Sends the next chunk of up to `count` items to `pid`. Returns `:ok` after a
+// full chunk, `:done` once the iterator is exhausted, after sending the items
+// left if there were any, or the error raised by the iterator, after sending
+// the items read before it.
+static ERL_NIF_TERM pythonx_iter_send_chunk(ErlNifEnv *env, PyObject *iterator, int64_t count, ErlNifPid *pid, ERL_NIF_TERM tag) {
+    ErlNifEnv *msg_env = enif_alloc_env();
+    if (unlikely(msg_env == nullptr)) return erlang::nif::error(env, "cannot allocate the chunk");
+
+    std::vector<ERL_NIF_TERM> items;
+    items.reserve(count);
+    bool done = false;
+    while ((int64_t)items.size() < count) {
+        PyObject *item = PyIter_Next(iterator);
+        if (item == nullptr) {
+            done = true;
+            break;
+        }
+        auto term = python_to(msg_env, item);
+        if (!term && !PyErr_Occurred()) {
+            PyErr_Format(PyExc_TypeError, "cannot convert %s to a term", Py_TYPE(item)->tp_name);
+        }
+        Py_DECREF(item);
+        if (!term) break;
+        items.emplace_back(term.value());
+    }
+
+    bool sent = true;
+    if (!items.empty()) {
+        ERL_NIF_TERM chunk = enif_make_tuple2(
+            msg_env,
+            enif_make_atom(msg_env, "chunk"),
+            enif_make_list_from_array(msg_env, items.data(), (unsigned)items.size())
+        );
+        sent = enif_send(env, pid, msg_env, enif_make_tuple2(msg_env, enif_make_copy(msg_env, tag), chunk));
+    }
+    enif_free_env(msg_env);
+
+    if (PyErr_Occurred()) return pythonx_current_pyerr(env);
+    // nobody is left to read the rest
+    if (done || !sent) return enif_make_atom(env, "done");
+    return kAtomOk;
+}
+
+#endif  // PYTHONX_ITER_HPP
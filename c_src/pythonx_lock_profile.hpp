@@ -0,0 +1,194 @@
+#ifndef PYTHONX_LOCK_PROFILE_HPP
+#define PYTHONX_LOCK_PROFILE_HPP
+#pragma once
+
+#include <erl_nif.h>
+#include <atomic>
+#include <chrono>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+
+// Contention profile of the python mutex.
+//
+// Every acquisition records how long it waited for the mutex and how long it
+// held it, per call site, in histograms with power-of-two nanosecond buckets.
+// The number of callers waiting at once is tracked as the queue depth.
+//
+// Only the NIFs that take the mutex are seen. The py_* NIFs behind Pythonx.C
+// run on the GIL alone, and the NIFs that only read native state, such as the
+// stats readers, output_flush/ack, handle_count and arena_new/adopt/size, do
+// not lock. A new locking NIF gets its own site here and in Pythonx.LockProfiler.
+
+enum PythonxLockSite {
+    kPythonxLockInitialize = 0,
+    kPythonxLockInline,
+    kPythonxLockPreloadModule,
+    kPythonxLockPrecompile,
+    kPythonxLockFinalize,
+    kPythonxLockPipeline,
+    kPythonxLockCall,
+    kPythonxLockIter,
+    kPythonxLockPickle,
+    kPythonxLockArena,
+    kPythonxLockGC,
+    kPythonxLockProfiler,
+    kPythonxLockCensus,
+    kPythonxLockVector,
+    kPythonxLockHandle,
+    kPythonxLockOutput,
+    kPythonxLockEtf,
+    kPythonxLockSites,
+};
+
+static const char *pythonx_lock_site_names[kPythonxLockSites] = {
+    "initialize",
+    "inline",
+    "preload_module",
+    "precompile",
+    "finalize",
+    "pipeline",
+    "call",
+    "iter",
+    "pickle",
+    "arena",
+    "gc",
+    "profiler",
+    "census",
+    "vector",
+    "handle",
+    "output",
+    "etf",
+};
+
+// bucket i counts durations under 2^i ns, the last bucket is open-ended
+static constexpr int kPythonxLockBuckets = 40;
+
+struct PythonxLockSiteStats {
+    std::atomic<int64_t> acquisitions{0};
+    std::atomic<int64_t> wait_ns{0};
+    std::atomic<int64_t> hold_ns{0};
+    std::atomic<int64_t> max_wait_ns{0};
+    std::atomic<int64_t> max_hold_ns{0};
+    std::atomic<int64_t> wait_histogram[kPythonxLockBuckets];
+    std::atomic<int64_t> hold_histogram[kPythonxLockBuckets];
+};
+
+static PythonxLockSiteStats pythonx_lock_sites[kPythonxLockSites];
+static std::atomic<int64_t> pythonx_lock_waiting{0};
+static std::atomic<int64_t> pythonx_lock_max_queue_depth{0};
+// only touched by the holder of the mutex
+static std::chrono::steady_clock::time_point pythonx_lock_acquired_at;
+
+static inline void pythonx_lock_record(std::atomic<int64_t> &total, std::atomic<int64_t> &max, std::atomic<int64_t> *histogram, int64_t ns) {
+    total.fetch_add(ns, std::memory_order_relaxed);
+    int64_t current = max.load(std::memory_order_relaxed);
+    while (ns > current && !max.compare_exchange_weak(current, ns, std::memory_order_relaxed)) {}
+
+    int bucket = 0;
+    while (bucket < kPythonxLockBuckets - 1 && ns >= ((int64_t)1 << bucket)) ++bucket;
+    histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline void pythonx_lock(ErlNifMutex *mutex, PythonxLockSite site) {
+    int64_t depth = pythonx_lock_waiting.fetch_add(1, std::memory_order_relaxed) + 1;
+    int64_t max_depth = pythonx_lock_max_queue_depth.load(std::memory_order_relaxed);
+    while (depth > max_depth && !pythonx_lock_max_queue_depth.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed)) {}
+
+    auto start = std::chrono::steady_clock::now();
+    enif_mutex_lock(mutex);
+    pythonx_lock_acquired_at = std::chrono::steady_clock::now();
+    pythonx_lock_waiting.fetch_sub(1, std::memory_order_relaxed);
+
+    PythonxLockSiteStats &stats = pythonx_lock_sites[site];
+    stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    int64_t waited = std::chrono::duration_cast<std::chrono::nanoseconds>(pythonx_lock_acquired_at - start).count();
+    pythonx_lock_record(stats.wait_ns, stats.max_wait_ns, stats.wait_histogram, waited);
+}
+
+static inline void pythonx_unlock(ErlNifMutex *mutex, PythonxLockSite site) {
+    int64_t held = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - pythonx_lock_acquired_at).count();
+    enif_mutex_unlock(mutex);
+
+    PythonxLockSiteStats &stats = pythonx_lock_sites[site];
+    pythonx_lock_record(stats.hold_ns, stats.max_hold_ns, stats.hold_histogram, held);
+}
+
+// non-empty buckets as `[{upper_bound_ns | :infinity, count}]`
+static ERL_NIF_TERM pythonx_lock_histogram(ErlNifEnv *env, std::atomic<int64_t> *histogram) {
+    ERL_NIF_TERM list = enif_make_list(env, 0);
+    for (int i = kPythonxLockBuckets - 1; i >= 0; --i) {
+        int64_t count = histogram[i].load(std::memory_order_relaxed);
+        if (count == 0) continue;
+
+        ERL_NIF_TERM upper = i == kPythonxLockBuckets - 1
+            ? enif_make_atom(env, "infinity")
+            : enif_make_int64(env, (int64_t)1 << i);
+        list = enif_make_list_cell(env, enif_make_tuple2(env, upper, enif_make_int64(env, count)), list);
+    }
+    return list;
+}
+
+// ------- NIF functions -------
+
+static ERL_NIF_TERM pythonx_lock_stats(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    ERL_NIF_TERM site_keys[kPythonxLockSites], site_values[kPythonxLockSites];
+    for (int i = 0; i < kPythonxLockSites; ++i) {
+        PythonxLockSiteStats &stats = pythonx_lock_sites[i];
+        ERL_NIF_TERM keys[] = {
+            enif_make_atom(env, "acquisitions"),
+            enif_make_atom(env, "wait_ns"),
+            enif_make_atom(env, "hold_ns"),
+            enif_make_atom(env, "max_wait_ns"),
+            enif_make_atom(env, "max_hold_ns"),
+            enif_make_atom(env, "wait_histogram"),
+            enif_make_atom(env, "hold_histogram"),
+        };
+        ERL_NIF_TERM values[] = {
+            enif_make_int64(env, stats.acquisitions.load(std::memory_order_relaxed)),
+            enif_make_int64(env, stats.wait_ns.load(std::memory_order_relaxed)),
+            enif_make_int64(env, stats.hold_ns.load(std::memory_order_relaxed)),
+            enif_make_int64(env, stats.max_wait_ns.load(std::memory_order_relaxed)),
+            enif_make_int64(env, stats.max_hold_ns.load(std::memory_order_relaxed)),
+            pythonx_lock_histogram(env, stats.wait_histogram),
+            pythonx_lock_histogram(env, stats.hold_histogram),
+        };
+        site_keys[i] = enif_make_atom(env, pythonx_lock_site_names[i]);
+        enif_make_map_from_arrays(env, keys, values, sizeof(keys) / sizeof(keys[0]), &site_values[i]);
+    }
+
+    ERL_NIF_TERM sites;
+    enif_make_map_from_arrays(env, site_keys, site_values, kPythonxLockSites, &sites);
+
+    ERL_NIF_TERM keys[] = {
+        enif_make_atom(env, "waiting"),
+        enif_make_atom(env, "max_queue_depth"),
+        enif_make_atom(env, "sites"),
+    };
+    ERL_NIF_TERM values[] = {
+        enif_make_int64(env, pythonx_lock_waiting.load(std::memory_order_relaxed)),
+        enif_make_int64(env, pythonx_lock_max_queue_depth.load(std::memory_order_relaxed)),
+        sites,
+    };
+    ERL_NIF_TERM ret;
+    enif_make_map_from_arrays(env, keys, values, 3, &ret);
+    return ret;
+}
+
+static ERL_NIF_TERM pythonx_lock_stats_reset(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    for (auto &stats : pythonx_lock_sites) {
+        stats.acquisitions.store(0, std::memory_order_relaxed);
+        stats.wait_ns.store(0, std::memory_order_relaxed);
+        stats.hold_ns.store(0, std::memory_order_relaxed);
+        stats.max_wait_ns.store(0, std::memory_order_relaxed);
+        stats.max_hold_ns.store(0, std::memory_order_relaxed);
+        for (int i = 0; i < kPythonxLockBuckets; ++i) {
+            stats.wait_histogram[i].store(0, std::memory_order_relaxed);
+            stats.hold_histogram[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    // callers still waiting are counted again in the new profile
+    pythonx_lock_max_queue_depth.store(pythonx_lock_waiting.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return kAtomOk;
+}
+
+#endif  // PYTHONX_LOCK_PROFILE_HPP
@@ -0,0 +1,440 @@
+#ifndef PYTHONX_OUTPUT_HPP
+#define PYTHONX_OUTPUT_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <erl_nif.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+#include "pythonx_pyerr.hpp"
+
+// Capture of `sys.stdout` and `sys.stderr`.
+//
+// While a capture is active, both streams are replaced by writers that append
+// the UTF-8 of what is written to a ring buffer. A sender thread sends the
+// buffered output to the subscriber as
+// `{:pythonx_output, ref, bytes, [{:stdout | :stderr | :dropped, binary | n}]}`,
+// once `batch` bytes are buffered, when a stream is flushed, and at the end of
+// every inline call. Sent bytes keep their room in the buffer until the
+// subscriber acknowledges them, so a write that does not fit is either dropped
+// and counted, or waits for the subscriber, up to a timeout.
+//
+// The sender thread never touches Python, and writers never send, so a writer
+// that waits holds the python mutex but cannot block the sender or the acks.
+
+// a batch is also sent once this many segments are buffered, e.g. after many
+// short writes alternating between stdout and stderr
+static constexpr size_t kPythonxOutputMaxSegments = 1024;
+
+enum PythonxOutputSegment {
+    kOutputStdout = 0,
+    kOutputStderr,
+    kOutputDropped,
+};
+
+struct PythonxOutput {
+    bool active = false;
+    bool block = false;
+    std::chrono::milliseconds block_timeout{0};
+    ErlNifPid subscriber;
+    // holds `ref`, which tags every batch
+    ErlNifEnv *ref_env = nullptr;
+    ERL_NIF_TERM ref;
+
+    std::vector<char> ring;
+    size_t head = 0;
+    size_t buffered = 0;
+    size_t in_flight = 0;
+    size_t batch = 0;
+    // consecutive writes to the same stream share a segment, drops take no room
+    std::deque<std::pair<PythonxOutputSegment, size_t>> segments;
+
+    bool flush = false;
+    bool stopping = false;
+    // set once a send fails, the output is discarded from then on
+    bool subscriber_gone = false;
+    std::thread sender;
+};
+
+// guards pythonx_output, writers wait on it for room and the sender for output
+static std::mutex pythonx_output_mutex;
+static std::condition_variable pythonx_output_cond;
+static PythonxOutput pythonx_output;
+// the replaced streams and the writer type, only touched with the GIL held
+static PyObject *pythonx_output_saved[2] = {nullptr, nullptr};
+static PyTypeObject *pythonx_output_writer_type = nullptr;
+// set while a capture with `block` is active, read without any lock
+static std::atomic<bool> pythonx_output_blocking{false};
+
+// Whether a write may wait for the subscriber. Python code must then run on a
+// dirty scheduler, so that a wait never stalls a normal one.
+static inline bool pythonx_output_may_block() {
+    return pythonx_output_blocking.load(std::memory_order_relaxed);
+}
+
+static size_t pythonx_output_room() {
+    return pythonx_output.ring.size() - pythonx_output.buffered - pythonx_output.in_flight;
+}
+
+static void pythonx_output_segment(PythonxOutputSegment kind, size_t len) {
+    auto &segments = pythonx_output.segments;
+    if (!segments.empty() && segments.back().first == kind) {
+        segments.back().second += len;
+    } else {
+        segments.emplace_back(kind, len);
+    }
+}
+
+// Must hold pythonx_output_mutex, and `len` must fit.
+static void pythonx_output_append(PythonxOutputSegment stream, const char *data, size_t len) {
+    auto &out = pythonx_output;
+    size_t capacity = out.ring.size();
+    // sent bytes are the ones right before head, they are only overwritten once acknowledged
+    size_t tail = (out.head + out.buffered) % capacity;
+    size_t first = std::min(len, capacity - tail);
+    memcpy(out.ring.data() + tail, data, first);
+    memcpy(out.ring.data(), data + first, len - first);
+    out.buffered += len;
+    pythonx_output_segment(stream, len);
+}
+
+// Appends `len` bytes, or drops what does not fit. Must hold pythonx_output_mutex.
+static void pythonx_output_put(std::unique_lock<std::mutex> &lock, PythonxOutputSegment stream, const char *data, size_t len) {
+    auto &out = pythonx_output;
+    if (out.subscriber_gone || len == 0) return;
+
+    if (!out.block) {
+        if (len <= pythonx_output_room()) {
+            pythonx_output_append(stream, data, len);
+        } else {
+            pythonx_output_segment(kOutputDropped, len);
+        }
+    } else {
+        auto deadline = std::chrono::steady_clock::now() + out.block_timeout;
+        while (len > 0 && out.active && !out.subscriber_gone) {
+            size_t n = std::min(len, pythonx_output_room());
+            if (n > 0) {
+                pythonx_output_append(stream, data, n);
+                data += n;
+                len -= n;
+                continue;
+            }
+            // no room left, what is buffered must go out before it is acknowledged
+            out.flush = true;
+            pythonx_output_cond.notify_all();
+            if (pythonx_output_cond.wait_until(lock, deadline) == std::cv_status::timeout && pythonx_output_room() == 0) break;
+        }
+        if (len > 0 && !out.subscriber_gone) pythonx_output_segment(kOutputDropped, len);
+    }
+
+    if (out.buffered >= out.batch || out.segments.size() >= kPythonxOutputMaxSegments) pythonx_output_cond.notify_all();
+}
+
+static void pythonx_output_request_flush() {
+    std::lock_guard<std::mutex> guard(pythonx_output_mutex);
+    if (pythonx_output.active && !pythonx_output.segments.empty()) {
+        pythonx_output.flush = true;
+        pythonx_output_cond.notify_all();
+    }
+}
+
+// Takes all buffered segments as the terms of one batch. Must hold pythonx_output_mutex.
+static ERL_NIF_TERM pythonx_output_take_batch(ErlNifEnv *msg_env, size_t &bytes) {
+    auto &out = pythonx_output;
+    size_t capacity = out.ring.size();
+    std::vector<ERL_NIF_TERM> items;
+    items.reserve(out.segments.size());
+    bytes = 0;
+    for (auto &segment : out.segments) {
+        if (segment.first == kOutputDropped) {
+            items.emplace_back(enif_make_tuple2(msg_env, enif_make_atom(msg_env, "dropped"), enif_make_uint64(msg_env, segment.second)));
+            continue;
+        }
+        ERL_NIF_TERM binary;
+        unsigned char *ptr = enif_make_new_binary(msg_env, segment.second, &binary);
+        size_t start = (out.head + bytes) % capacity;
+        size_t first = std::min(segment.second, capacity - start);
+        memcpy(ptr, out.ring.data() + start, first);
+        memcpy(ptr + first, out.ring.data(), segment.second - first);
+        bytes += segment.second;
+        const char *name = segment.first == kOutputStdout ? "stdout" : "stderr";
+        items.emplace_back(enif_make_tuple2(msg_env, enif_make_atom(msg_env, name), binary));
+    }
+    out.segments.clear();
+    out.head = (out.head + bytes) % capacity;
+    out.buffered = 0;
+    out.in_flight += bytes;
+    out.flush = false;
+    return enif_make_list_from_array(msg_env, items.data(), (unsigned)items.size());
+}
+
+static void pythonx_output_sender() {
+    auto &out = pythonx_output;
+    std::unique_lock<std::mutex> lock(pythonx_output_mutex);
+    while (true) {
+        pythonx_output_cond.wait(lock, [&out] {
+            return out.stopping || (!out.segments.empty() && (out.flush || out.buffered >= out.batch || out.segments.size() >= kPythonxOutputMaxSegments));
+        });
+        if (out.segments.empty()) {
+            if (out.stopping) return;
+            continue;
+        }
+
+        ErlNifEnv *msg_env = enif_alloc_env();
+        size_t bytes;
+        ERL_NIF_TERM chunks = pythonx_output_take_batch(msg_env, bytes);
+        ERL_NIF_TERM msg = enif_make_tuple4(
+            msg_env,
+            enif_make_atom(msg_env, "pythonx_output"),
+            enif_make_copy(msg_env, out.ref),
+            enif_make_uint64(msg_env, bytes),
+            chunks
+        );
+        ErlNifPid subscriber = out.subscriber;
+
+        lock.unlock();
+        bool sent = enif_send(nullptr, &subscriber, msg_env, msg);
+        enif_free_env(msg_env);
+        lock.lock();
+
+        if (!sent) {
+            // nobody will acknowledge anything anymore
+            out.subscriber_gone = true;
+            out.segments.clear();
+            out.head = 0;
+            out.buffered = 0;
+            out.in_flight = 0;
+            pythonx_output_cond.notify_all();
+        }
+    }
+}
+
+// ------- the writers -------
+
+struct PythonxOutputWriter {
+    PyObject_HEAD
+    PythonxOutputSegment stream;
+};
+
+static PyObject * pythonx_output_writer_write(PyObject *self, PyObject *text) {
+    if (!PyUnicode_Check(text)) {
+        PyErr_Format(PyExc_TypeError, "write() argument must be str, not %s", Py_TYPE(text)->tp_name);
+        return nullptr;
+    }
+    Py_ssize_t length = PyUnicode_GetLength(text);
+    PyObject *encoded = PyUnicode_AsEncodedString(text, "utf-8", "backslashreplace");
+    if (encoded == nullptr) return nullptr;
+
+    {
+        std::unique_lock<std::mutex> lock(pythonx_output_mutex);
+        if (pythonx_output.active) {
+            pythonx_output_put(lock, ((PythonxOutputWriter *)self)->stream, PyBytes_AS_STRING(encoded), (size_t)PyBytes_GET_SIZE(encoded));
+        }
+    }
+    Py_DECREF(encoded);
+    return PyLong_FromSsize_t(length);
+}
+
+static PyObject * pythonx_output_writer_flush(PyObject *self, PyObject *) {
+    pythonx_output_request_flush();
+    Py_RETURN_NONE;
+}
+
+static PyObject * pythonx_output_writer_false(PyObject *self, PyObject *) {
+    Py_RETURN_FALSE;
+}
+
+static PyObject * pythonx_output_writer_true(PyObject *self, PyObject *) {
+    Py_RETURN_TRUE;
+}
+
+static PyObject * pythonx_output_writer_encoding(PyObject *self, void *) {
+    return PyUnicode_FromString("utf-8");
+}
+
+static PyObject * pythonx_output_writer_errors(PyObject *self, void *) {
+    return PyUnicode_FromString("backslashreplace");
+}
+
+static PyObject * pythonx_output_writer_closed(PyObject *self, void *) {
+    Py_RETURN_FALSE;
+}
+
+static void pythonx_output_writer_dealloc(PyObject *self) {
+    PyTypeObject *type = Py_TYPE(self);
+    type->tp_free(self);
+    Py_DECREF(type);
+}
+
+static PyMethodDef pythonx_output_writer_methods[] = {
+    {"write", pythonx_output_writer_write, METH_O, nullptr},
+    {"flush", pythonx_output_writer_flush, METH_NOARGS, nullptr},
+    {"isatty", pythonx_output_writer_false, METH_NOARGS, nullptr},
+    {"readable", pythonx_output_writer_false, METH_NOARGS, nullptr},
+    {"seekable", pythonx_output_writer_false, METH_NOARGS, nullptr},
+    {"writable", pythonx_output_writer_true, METH_NOARGS, nullptr},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+static PyGetSetDef pythonx_output_writer_getset[] = {
+    {"encoding", pythonx_output_writer_encoding, nullptr, nullptr, nullptr},
+    {"errors", pythonx_output_writer_errors, nullptr, nullptr, nullptr},
+    {"closed", pythonx_output_writer_closed, nullptr, nullptr, nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr},
+};
+
+static PyType_Slot pythonx_output_writer_slots[] = {
+    {Py_tp_dealloc, (void *)pythonx_output_writer_dealloc},
+    {Py_tp_methods, pythonx_output_writer_methods},
+    {Py_tp_getset, pythonx_output_writer_getset},
+    {0, nullptr},
+};
+
+static PyType_Spec pythonx_output_writer_spec = {
+    "pythonx.OutputWriter",
+    sizeof(PythonxOutputWriter),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    pythonx_output_writer_slots,
+};
+
+static PyObject * pythonx_output_writer_new(PythonxOutputSegment stream) {
+    if (pythonx_output_writer_type == nullptr) {
+        pythonx_output_writer_type = (PyTypeObject *)PyType_FromSpec(&pythonx_output_writer_spec);
+        if (pythonx_output_writer_type == nullptr) return nullptr;
+    }
+    PyObject *writer = PyType_GenericAlloc(pythonx_output_writer_type, 0);
+    if (writer != nullptr) ((PythonxOutputWriter *)writer)->stream = stream;
+    return writer;
+}
+
+// Puts back the original streams, and sends what is left. Returns false if no capture was active.
+static bool pythonx_output_stop() {
+    if (!pythonx_output.active) return false;
+
+    const char *names[] = {"stdout", "stderr"};
+    for (int i = 0; i < 2; ++i) {
+        if (pythonx_output_saved[i] != nullptr && PySys_SetObject(names[i], pythonx_output_saved[i]) != 0) PyErr_Clear();
+        Py_CLEAR(pythonx_output_saved[i]);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(pythonx_output_mutex);
+        pythonx_output.active = false;
+        pythonx_output.stopping = true;
+        pythonx_output_blocking.store(false, std::memory_order_relaxed);
+        pythonx_output_cond.notify_all();
+    }
+    pythonx_output.sender.join();
+
+    std::lock_guard<std::mutex> guard(pythonx_output_mutex);
+    enif_free_env(pythonx_output.ref_env);
+    pythonx_output.ref_env = nullptr;
+    pythonx_output.ring = std::vector<char>();
+    pythonx_output.segments.clear();
+    return true;
+}
+
+// Called before Python is finalized.
+static void pythonx_output_detach() {
+    pythonx_output_stop();
+    Py_CLEAR(pythonx_output_writer_type);
+}
+
+// ------- NIF functions -------
+
+// output_capture(pid, ref, capacity, batch, block, block_timeout_ms)
+static ERL_NIF_TERM pythonx_output_capture(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    ErlNifPid subscriber;
+    int64_t capacity, batch, block_timeout_ms;
+    bool block;
+    if (!enif_get_local_pid(env, argv[0], &subscriber) || !enif_is_ref(env, argv[1]) ||
+        !erlang::nif::get(env, argv[2], &capacity) || capacity <= 0 ||
+        !erlang::nif::get(env, argv[3], &batch) || batch <= 0 ||
+        !erlang::nif::get(env, argv[4], &block) ||
+        !erlang::nif::get(env, argv[5], &block_timeout_ms) || block_timeout_ms < 0) {
+        return enif_make_badarg(env);
+    }
+    if (pythonx_output.active) {
+        return erlang::nif::error(env, "output is already captured");
+    }
+
+    PyObject *writers[2] = {pythonx_output_writer_new(kOutputStdout), pythonx_output_writer_new(kOutputStderr)};
+    if (writers[0] == nullptr || writers[1] == nullptr) {
+        Py_XDECREF(writers[0]);
+        Py_XDECREF(writers[1]);
+        return pythonx_current_pyerr(env);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(pythonx_output_mutex);
+        auto &out = pythonx_output;
+        out.subscriber = subscriber;
+        out.ref_env = enif_alloc_env();
+        out.ref = enif_make_copy(out.ref_env, argv[1]);
+        out.ring.assign((size_t)capacity, 0);
+        out.head = 0;
+        out.buffered = 0;
+        out.in_flight = 0;
+        out.batch = (size_t)std::min(batch, capacity);
+        out.block = block;
+        out.block_timeout = std::chrono::milliseconds(block_timeout_ms);
+        out.flush = false;
+        out.stopping = false;
+        out.subscriber_gone = false;
+        out.active = true;
+        out.sender = std::thread(pythonx_output_sender);
+        pythonx_output_blocking.store(block, std::memory_order_relaxed);
+    }
+
+    const char *names[] = {"stdout", "stderr"};
+    for (int i = 0; i < 2; ++i) {
+        // sys.stdout may be None, e.g. without a console
+        pythonx_output_saved[i] = PySys_GetObject(names[i]);
+        if (pythonx_output_saved[i] == nullptr) pythonx_output_saved[i] = Py_None;
+        Py_INCREF(pythonx_output_saved[i]);
+        PySys_SetObject(names[i], writers[i]);
+        Py_DECREF(writers[i]);
+    }
+    return kAtomOk;
+}
+
+static ERL_NIF_TERM pythonx_output_release(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (!pythonx_output_stop()) {
+        return erlang::nif::error(env, "output is not captured");
+    }
+    return kAtomOk;
+}
+
+static ERL_NIF_TERM pythonx_output_flush(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    pythonx_output_request_flush();
+    return kAtomOk;
+}
+
+// output_ack(ref, bytes), acknowledgements of an earlier capture are ignored.
+static ERL_NIF_TERM pythonx_output_ack(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    uint64_t bytes;
+    if (!enif_is_ref(env, argv[0]) || !erlang::nif::get(env, argv[1], &bytes)) {
+        return enif_make_badarg(env);
+    }
+
+    std::lock_guard<std::mutex> guard(pythonx_output_mutex);
+    auto &out = pythonx_output;
+    if (out.ref_env != nullptr && enif_is_identical(out.ref, argv[0])) {
+        out.in_flight -= std::min((size_t)bytes, out.in_flight);
+        pythonx_output_cond.notify_all();
+    }
+    return kAtomOk;
+}
+
+#endif  // PYTHONX_OUTPUT_HPP
@@ -0,0 +1,238 @@
+#ifndef PYTHONX_PICKLE_HPP
+#define PYTHONX_PICKLE_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <erl_nif.h>
+#include <cstring>
+#include <vector>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+#include "pythonx_deferred.hpp"
+#include "pythonx_utils.hpp"
+#include "pythonx_pyerr.hpp"
+
+// Keeps a read-only Python buffer exported while the VM holds on to a
+// resource binary that points into it, so that pickled payloads and
+// out-of-band buffers can be handed to Elixir without copying.
+struct PyBufferNifRes {
+    PyObject * obj;
+    Py_buffer view;
+    // the interpreter the buffer belongs to, see pythonx_deferred.hpp
+    uint64_t epoch;
+    static ErlNifResourceType *type;
+};
+
+static void destruct_py_buffer(ErlNifEnv *env, void * args) {
+    auto res = (struct PyBufferNifRes *)args;
+    if (res->obj != nullptr) pythonx_defer_buffer_release(res->obj, res->view, res->epoch);
+}
+
+// Returns a binary with the bytes of `obj`, or nullopt with a Python error set.
+//
+// Read-only buffers are shared with the binary. Writable ones are copied, as
+// Python code could still change a binary that is meant to be immutable.
+static std::optional<ERL_NIF_TERM> pybuffer_to_resource_binary(ErlNifEnv *env, PyObject *obj) {
+    // Non-contiguous buffers are copied into a contiguous memoryview first.
+    PyObject *contiguous = PyMemoryView_GetContiguous(obj, PyBUF_READ, 'C');
+    if (contiguous == nullptr) return std::nullopt;
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(contiguous, &view, PyBUF_SIMPLE) != 0) {
+        Py_DECREF(contiguous);
+        return std::nullopt;
+    }
+
+    ERL_NIF_TERM ret;
+    if (!view.readonly) {
+        unsigned char *ptr = enif_make_new_binary(env, (size_t)view.len, &ret);
+        if (ptr != nullptr) memcpy(ptr, view.buf, (size_t)view.len);
+        PyBuffer_Release(&view);
+        Py_DECREF(contiguous);
+        if (ptr == nullptr) {
+            PyErr_NoMemory();
+            return std::nullopt;
+        }
+        return ret;
+    }
+
+    PyBufferNifRes *res = allocate_resource<PyBufferNifRes>();
+    if (unlikely(res == nullptr)) {
+        PyBuffer_Release(&view);
+        Py_DECREF(contiguous);
+        PyErr_NoMemory();
+        return std::nullopt;
+    }
+    res->obj = contiguous;
+    res->view = view;
+    res->epoch = pythonx_current_epoch();
+
+    ret = enif_make_resource_binary(env, res, res->view.buf, res->view.len);
+    enif_release_resource(res);
+    return ret;
+}
+
+// A read-only Python buffer backed by a BEAM binary. The binary is copied
+// into a private environment, which for refc binaries only bumps the
+// reference count, so unpickled objects may keep referencing its memory.
+struct PythonxBeamBinaryObject {
+    PyObject_HEAD
+    ErlNifEnv *env;
+    ErlNifBinary bin;
+};
+
+static int pythonx_beam_binary_getbuffer(PyObject *self, Py_buffer *view, int flags) {
+    auto obj = (PythonxBeamBinaryObject *)self;
+    return PyBuffer_FillInfo(view, self, obj->bin.data, (Py_ssize_t)obj->bin.size, 1, flags);
+}
+
+static void pythonx_beam_binary_dealloc(PyObject *self) {
+    auto obj = (PythonxBeamBinaryObject *)self;
+    if (obj->env != nullptr) enif_free_env(obj->env);
+    Py_TYPE(self)->tp_free(self);
+}
+
+static PyBufferProcs pythonx_beam_binary_as_buffer = {
+    pythonx_beam_binary_getbuffer,
+    nullptr
+};
+
+static PyTypeObject PythonxBeamBinaryType = {
+    PyVarObject_HEAD_INIT(nullptr, 0)
+};
+
+static PyObject *pythonx_beam_binary_new(ErlNifEnv *env, ERL_NIF_TERM term) {
+    if (PythonxBeamBinaryType.tp_name == nullptr) {
+        PythonxBeamBinaryType.tp_name = "pythonx.BeamBinary";
+        PythonxBeamBinaryType.tp_basicsize = sizeof(PythonxBeamBinaryObject);
+        PythonxBeamBinaryType.tp_dealloc = pythonx_beam_binary_dealloc;
+        PythonxBeamBinaryType.tp_as_buffer = &pythonx_beam_binary_as_buffer;
+        PythonxBeamBinaryType.tp_flags = Py_TPFLAGS_DEFAULT;
+        PythonxBeamBinaryType.tp_doc = "Read-only view of a BEAM binary";
+    }
+    if (PyType_Ready(&PythonxBeamBinaryType) != 0) return nullptr;
+
+    auto obj = PyObject_New(PythonxBeamBinaryObject, &PythonxBeamBinaryType);
+    if (obj == nullptr) return nullptr;
+
+    obj->env = enif_alloc_env();
+    if (obj->env == nullptr || !enif_inspect_binary(obj->env, enif_make_copy(obj->env, term), &obj->bin)) {
+        Py_DECREF(obj);
+        PyErr_SetString(PyExc_TypeError, "out-of-band buffers must be binaries");
+        return nullptr;
+    }
+    return (PyObject *)obj;
+}
+
+// ------- NIF functions -------
+
+static ERL_NIF_TERM pythonx_pickle_dumps(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    PyObjectNifRes *res = get_resource<PyObjectNifRes>(env, argv[0]);
+    if (unlikely(res == nullptr)) return enif_make_badarg(env);
+
+    ERL_NIF_TERM ret = kAtomError;
+    PyObject *pickle = nullptr, *dumps = nullptr, *buffers = nullptr, *buffer_callback = nullptr;
+    PyObject *args = nullptr, *kwargs = nullptr, *data = nullptr;
+    std::optional<ERL_NIF_TERM> data_term;
+    std::vector<ERL_NIF_TERM> buffer_terms;
+
+    pickle = PyImport_ImportModule("pickle");
+    if (pickle == nullptr) goto pyerr;
+    dumps = PyObject_GetAttrString(pickle, "dumps");
+    if (dumps == nullptr) goto pyerr;
+    buffers = PyList_New(0);
+    if (buffers == nullptr) goto pyerr;
+    buffer_callback = PyObject_GetAttrString(buffers, "append");
+    if (buffer_callback == nullptr) goto pyerr;
+
+    args = PyTuple_Pack(1, res->val);
+    kwargs = Py_BuildValue("{s:i,s:O}", "protocol", 5, "buffer_callback", buffer_callback);
+    if (args == nullptr || kwargs == nullptr) goto pyerr;
+
+    data = PyObject_Call(dumps, args, kwargs);
+    if (data == nullptr) goto pyerr;
+
+    data_term = pybuffer_to_resource_binary(env, data);
+    if (!data_term) goto pyerr;
+
+    buffer_terms.reserve(PyList_GET_SIZE(buffers));
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(buffers); ++i) {
+        auto buffer_term = pybuffer_to_resource_binary(env, PyList_GET_ITEM(buffers, i));
+        if (!buffer_term) goto pyerr;
+        buffer_terms.emplace_back(buffer_term.value());
+    }
+
+    ret = enif_make_tuple2(env,
+        data_term.value(),
+        enif_make_list_from_array(env, buffer_terms.data(), (unsigned)buffer_terms.size())
+    );
+    goto cleanup;
+
+pyerr:
+    ret = pythonx_current_pyerr(env);
+
+cleanup:
+    Py_XDECREF(pickle);
+    Py_XDECREF(dumps);
+    Py_XDECREF(buffers);
+    Py_XDECREF(buffer_callback);
+    Py_XDECREF(args);
+    Py_XDECREF(kwargs);
+    Py_XDECREF(data);
+    return ret;
+}
+
+static ERL_NIF_TERM pythonx_pickle_loads(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    ErlNifBinary data;
+    if (!enif_inspect_iolist_as_binary(env, argv[0], &data)) return enif_make_badarg(env);
+
+    unsigned num_buffers;
+    if (!enif_get_list_length(env, argv[1], &num_buffers)) return enif_make_badarg(env);
+
+    PyObject *result = nullptr;
+    PyObject *pickle = nullptr, *loads = nullptr, *buffers = nullptr;
+    PyObject *args = nullptr, *kwargs = nullptr, *view = nullptr;
+    ERL_NIF_TERM head, tail = argv[1];
+
+    buffers = PyList_New(num_buffers);
+    if (buffers == nullptr) goto cleanup;
+    for (unsigned i = 0; enif_get_list_cell(env, tail, &head, &tail); ++i) {
+        if (!enif_is_binary(env, head)) {
+            Py_DECREF(buffers);
+            return enif_make_badarg(env);
+        }
+        PyObject *buffer = pythonx_beam_binary_new(env, head);
+        if (buffer == nullptr) goto cleanup;
+        PyObject *buffer_view = PyMemoryView_FromObject(buffer);
+        Py_DECREF(buffer);
+        if (buffer_view == nullptr) goto cleanup;
+        PyList_SET_ITEM(buffers, i, buffer_view);
+    }
+
+    pickle = PyImport_ImportModule("pickle");
+    if (pickle == nullptr) goto cleanup;
+    loads = PyObject_GetAttrString(pickle, "loads");
+    if (loads == nullptr) goto cleanup;
+
+    // `pickle.loads` copies everything it needs out of the main payload,
+    // so a view that is only valid during this call is enough here.
+    view = PyMemoryView_FromMemory((char *)data.data, (Py_ssize_t)data.size, PyBUF_READ);
+    if (view == nullptr) goto cleanup;
+    args = PyTuple_Pack(1, view);
+    kwargs = Py_BuildValue("{s:O}", "buffers", buffers);
+    if (args == nullptr || kwargs == nullptr) goto cleanup;
+
+    result = PyObject_Call(loads, args, kwargs);
+
+cleanup:
+    Py_XDECREF(pickle);
+    Py_XDECREF(loads);
+    Py_XDECREF(buffers);
+    Py_XDECREF(args);
+    Py_XDECREF(kwargs);
+    Py_XDECREF(view);
+    return pyobject_to_nifres_or_pyerr(env, result);
+}
+
+#endif  // PYTHONX_PICKLE_HPP
@@ -0,0 +1,462 @@
+#ifndef PYTHONX_PIPELINE_HPP
+#define PYTHONX_PIPELINE_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <erl_nif.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+#include "pythonx_convert.hpp"
+#include "pythonx_handle.hpp"
+#include "pythonx_pyerr.hpp"
+
+// A batch of C API operations over numbered registers, run in one NIF call.
+//
+// Instructions are tuples named after the `Pythonx.C` functions they stand for,
+// with registers in place of objects:
+//
+//     [{:load, 0, handle}, {:object_get_attr_string, 1, 0, "x"}, {:number_add, 2, 1, 1}]
+//
+// The whole batch is decoded and checked before any of it runs, so a
+// malformed batch raises ArgumentError without side effects. Every register
+// must be written before it is read, and holds a strong reference until the
+// batch ends. Selected registers are returned as handles or as terms.
+
+static constexpr uint32_t kPythonxPipelineMaxRegisters = 1 << 16;
+
+enum PythonxPipelineOp {
+    kPipelineLoad,
+    kPipelineLong,
+    kPipelineFloat,
+    kPipelineUnicode,
+    kPipelineBool,
+    kPipelineNone,
+    kPipelineNumberBinary,
+    kPipelineNumberUnary,
+    kPipelineGetAttr,
+    kPipelineSetAttr,
+    kPipelineGetItem,
+    kPipelineSetItem,
+    kPipelineLength,
+    kPipelineIsTrue,
+    kPipelineStr,
+    kPipelineRepr,
+    kPipelineCall,
+    kPipelineListNew,
+    kPipelineListAppend,
+    kPipelineListGetItem,
+    kPipelineListSetItem,
+    kPipelineListAsTuple,
+    kPipelineDictNew,
+    kPipelineDictGetItem,
+    kPipelineDictGetItemString,
+    kPipelineDictSetItem,
+    kPipelineDictSetItemString,
+    kPipelineTupleNew,
+};
+
+// Operands are described by one letter each:
+//   d - destination register, r - source register, R - list of source registers,
+//   i - integer, f - float, s - binary, b - boolean, h - handle or Pythonx.C reference
+struct PythonxPipelineOpSpec {
+    const char *name;
+    PythonxPipelineOp op;
+    const char *operands;
+};
+
+static const PythonxPipelineOpSpec pythonx_pipeline_ops[] = {
+    {"load", kPipelineLoad, "dh"},
+    {"long", kPipelineLong, "di"},
+    {"float", kPipelineFloat, "df"},
+    {"unicode", kPipelineUnicode, "ds"},
+    {"bool", kPipelineBool, "db"},
+    {"none", kPipelineNone, "d"},
+    {"object_get_attr_string", kPipelineGetAttr, "drs"},
+    {"object_set_attr_string", kPipelineSetAttr, "rsr"},
+    {"object_get_item", kPipelineGetItem, "drr"},
+    {"object_set_item", kPipelineSetItem, "rrr"},
+    {"object_length", kPipelineLength, "dr"},
+    {"object_is_true", kPipelineIsTrue, "dr"},
+    {"object_str", kPipelineStr, "dr"},
+    {"object_repr", kPipelineRepr, "dr"},
+    {"object_call", kPipelineCall, "drR"},
+    {"list_new", kPipelineListNew, "di"},
+    {"list_append", kPipelineListAppend, "rr"},
+    {"list_get_item", kPipelineListGetItem, "dri"},
+    {"list_set_item", kPipelineListSetItem, "rir"},
+    {"list_as_tuple", kPipelineListAsTuple, "dr"},
+    {"dict_new", kPipelineDictNew, "d"},
+    {"dict_get_item", kPipelineDictGetItem, "drr"},
+    {"dict_get_item_string", kPipelineDictGetItemString, "drs"},
+    {"dict_set_item", kPipelineDictSetItem, "rrr"},
+    {"dict_set_item_string", kPipelineDictSetItemString, "rsr"},
+    {"tuple_new", kPipelineTupleNew, "dR"},
+};
+
+static const struct { const char *name; unaryfunc fn; } pythonx_pipeline_unary_ops[] = {
+    {"negative", PyNumber_Negative},
+    {"positive", PyNumber_Positive},
+    {"absolute", PyNumber_Absolute},
+    {"invert", PyNumber_Invert},
+    {"long", PyNumber_Long},
+    {"float", PyNumber_Float},
+    {"index", PyNumber_Index},
+};
+
+struct PythonxPipelineInstr {
+    PythonxPipelineOp op;
+    uint32_t regs[3] = {0, 0, 0};
+    std::vector<uint32_t> args;
+    int64_t integer = 0;
+    double number = 0;
+    std::string string;
+    PyHandle handle = 0;
+    PyObjectNifRes *ref = nullptr;
+    // the object of a load, resolved before the batch runs
+    PyObject *loaded = nullptr;
+    binaryfunc binary = nullptr;
+    unaryfunc unary = nullptr;
+};
+
+struct PythonxPipelineOutput {
+    uint32_t reg;
+    bool as_term;
+};
+
+struct PythonxPipeline {
+    std::vector<PythonxPipelineInstr> instrs;
+    std::vector<PythonxPipelineOutput> outputs;
+    uint32_t registers = 0;
+    PyArenaNifRes *arena = nullptr;
+};
+
+static bool pythonx_pipeline_get_reg(ErlNifEnv *env, ERL_NIF_TERM term, uint32_t *reg) {
+    int64_t value;
+    if (!erlang::nif::get(env, term, &value) || value < 0 || value >= kPythonxPipelineMaxRegisters) return false;
+    *reg = (uint32_t)value;
+    return true;
+}
+
+// Decodes one instruction, `defined` tracks the registers written so far.
+static bool pythonx_pipeline_parse_instr(ErlNifEnv *env, ERL_NIF_TERM term, std::vector<bool> &defined, PythonxPipelineInstr &instr) {
+    int arity;
+    const ERL_NIF_TERM *elems;
+    std::string name;
+    if (!enif_get_tuple(env, term, &arity, &elems) || arity < 1 || !erlang::nif::get_atom(env, elems[0], name)) return false;
+
+    const char *operands = nullptr;
+    for (auto &spec : pythonx_pipeline_ops) {
+        if (name == spec.name) {
+            instr.op = spec.op;
+            operands = spec.operands;
+            break;
+        }
+    }
+    if (operands == nullptr && name.rfind("number_", 0) == 0) {
+        const char *op_name = name.c_str() + strlen("number_");
+        if ((instr.binary = pyhandle_number_op(op_name)) != nullptr) {
+            instr.op = kPipelineNumberBinary;
+            operands = "drr";
+        }
+        for (auto &op : pythonx_pipeline_unary_ops) {
+            if (strcmp(op_name, op.name) == 0) {
+                instr.op = kPipelineNumberUnary;
+                instr.unary = op.fn;
+                operands = "dr";
+            }
+        }
+    }
+    if (operands == nullptr || (size_t)arity != strlen(operands) + 1) return false;
+
+    // sources are checked before the destination is marked, `{:number_add, 0, 0, 0}` needs 0 first
+    int reg = 0;
+    int dst = -1;
+    for (int i = 0; operands[i] != '\0'; ++i) {
+        ERL_NIF_TERM operand = elems[i + 1];
+        switch (operands[i]) {
+            case 'd':
+                if (!pythonx_pipeline_get_reg(env, operand, &instr.regs[reg])) return false;
+                dst = reg++;
+                break;
+            case 'r':
+                if (!pythonx_pipeline_get_reg(env, operand, &instr.regs[reg]) || !defined[instr.regs[reg]]) return false;
+                ++reg;
+                break;
+            case 'R': {
+                ERL_NIF_TERM head, tail = operand;
+                while (enif_get_list_cell(env, tail, &head, &tail)) {
+                    uint32_t arg;
+                    if (!pythonx_pipeline_get_reg(env, head, &arg) || !defined[arg]) return false;
+                    instr.args.push_back(arg);
+                }
+                if (!enif_is_empty_list(env, tail)) return false;
+                break;
+            }
+            case 'i':
+                if (!erlang::nif::get(env, operand, &instr.integer)) return false;
+                break;
+            case 'f':
+                if (!enif_get_double(env, operand, &instr.number)) {
+                    int64_t integer;
+                    if (!erlang::nif::get(env, operand, &integer)) return false;
+                    instr.number = (double)integer;
+                }
+                break;
+            case 's':
+                if (!erlang::nif::get(env, operand, instr.string)) return false;
+                break;
+            case 'b': {
+                bool value;
+                if (!erlang::nif::get(env, operand, &value)) return false;
+                instr.integer = value;
+                break;
+            }
+            case 'h':
+                if ((instr.ref = get_resource<PyObjectNifRes>(env, operand)) == nullptr && !erlang::nif::get(env, operand, &instr.handle)) return false;
+                break;
+        }
+    }
+    if (dst >= 0) defined[instr.regs[dst]] = true;
+    return true;
+}
+
+// Decodes a batch without touching any Python object, so that it can run before taking the lock.
+static bool pythonx_pipeline_parse(ErlNifEnv *env, ERL_NIF_TERM instructions, ERL_NIF_TERM outputs, ERL_NIF_TERM arena, PythonxPipeline &pipeline) {
+    if (!pyhandle_get_arena(env, arena, &pipeline.arena)) return false;
+
+    std::vector<bool> defined(kPythonxPipelineMaxRegisters, false);
+    ERL_NIF_TERM head, tail = instructions;
+    while (enif_get_list_cell(env, tail, &head, &tail)) {
+        PythonxPipelineInstr instr;
+        if (!pythonx_pipeline_parse_instr(env, head, defined, instr)) return false;
+        for (uint32_t reg : instr.regs) pipeline.registers = std::max(pipeline.registers, reg + 1);
+        pipeline.instrs.emplace_back(std::move(instr));
+    }
+    if (!enif_is_empty_list(env, tail)) return false;
+
+    tail = outputs;
+    while (enif_get_list_cell(env, tail, &head, &tail)) {
+        PythonxPipelineOutput output{0, false};
+        int arity;
+        const ERL_NIF_TERM *elems;
+        if (enif_get_tuple(env, head, &arity, &elems)) {
+            std::string as;
+            if (arity != 2 || !erlang::nif::get_atom(env, elems[0], as) || as != "term") return false;
+            output.as_term = true;
+            head = elems[1];
+        }
+        if (!pythonx_pipeline_get_reg(env, head, &output.reg) || !defined[output.reg]) return false;
+        pipeline.outputs.push_back(output);
+    }
+    return enif_is_empty_list(env, tail);
+}
+
+// Runs one instruction, returns false with a Python error set if it failed.
+static bool pythonx_pipeline_step(PythonxPipelineInstr &instr, std::vector<PyObject *> &regs) {
+    PyObject *result = nullptr;
+    PyObject **r = regs.data();
+    uint32_t *a = instr.regs;
+    switch (instr.op) {
+        case kPipelineLoad:
+            result = instr.loaded;
+            instr.loaded = nullptr;
+            break;
+        case kPipelineLong:
+            result = PyLong_FromLongLong(instr.integer);
+            break;
+        case kPipelineFloat:
+            result = PyFloat_FromDouble(instr.number);
+            break;
+        case kPipelineUnicode:
+            result = PyUnicode_DecodeUTF8(instr.string.data(), instr.string.size(), "strict");
+            break;
+        case kPipelineBool:
+            result = PyBool_FromLong((long)instr.integer);
+            break;
+        case kPipelineNone:
+            Py_INCREF(Py_None);
+            result = Py_None;
+            break;
+        case kPipelineNumberBinary:
+            result = instr.binary(r[a[1]], r[a[2]]);
+            break;
+        case kPipelineNumberUnary:
+            result = instr.unary(r[a[1]]);
+            break;
+        case kPipelineGetAttr:
+            result = PyObject_GetAttrString(r[a[1]], instr.string.c_str());
+            break;
+        case kPipelineSetAttr:
+            return PyObject_SetAttrString(r[a[0]], instr.string.c_str(), r[a[1]]) == 0;
+        case kPipelineGetItem:
+            result = PyObject_GetItem(r[a[1]], r[a[2]]);
+            break;
+        case kPipelineSetItem:
+            return PyObject_SetItem(r[a[0]], r[a[1]], r[a[2]]) == 0;
+        case kPipelineLength: {
+            Py_ssize_t length = PyObject_Length(r[a[1]]);
+            if (length < 0) return false;
+            result = PyLong_FromSsize_t(length);
+            break;
+        }
+        case kPipelineIsTrue: {
+            int truth = PyObject_IsTrue(r[a[1]]);
+            if (truth < 0) return false;
+            result = PyBool_FromLong(truth);
+            break;
+        }
+        case kPipelineStr:
+            result = PyObject_Str(r[a[1]]);
+            break;
+        case kPipelineRepr:
+            result = PyObject_Repr(r[a[1]]);
+            break;
+        case kPipelineCall:
+        case kPipelineTupleNew: {
+            PyObject *tuple = PyTuple_New(instr.args.size());
+            if (tuple == nullptr) return false;
+            for (size_t i = 0; i < instr.args.size(); ++i) {
+                Py_INCREF(r[instr.args[i]]);
+                PyTuple_SET_ITEM(tuple, i, r[instr.args[i]]);
+            }
+            if (instr.op == kPipelineTupleNew) {
+                result = tuple;
+            } else {
+                result = PyObject_Call(r[a[1]], tuple, nullptr);
+                Py_DECREF(tuple);
+            }
+            break;
+        }
+        case kPipelineListNew:
+            result = PyList_New((Py_ssize_t)instr.integer);
+            // items of a sized list are set with list_set_item, None until then
+            if (result != nullptr) {
+                for (Py_ssize_t i = 0; i < (Py_ssize_t)instr.integer; ++i) {
+                    Py_INCREF(Py_None);
+                    PyList_SET_ITEM(result, i, Py_None);
+                }
+            }
+            break;
+        case kPipelineListAppend:
+            return PyList_Append(r[a[0]], r[a[1]]) == 0;
+        case kPipelineListGetItem:
+            result = PyList_GetItem(r[a[1]], (Py_ssize_t)instr.integer);
+            Py_XINCREF(result);
+            break;
+        case kPipelineListSetItem:
+            Py_INCREF(r[a[1]]);
+            return PyList_SetItem(r[a[0]], (Py_ssize_t)instr.integer, r[a[1]]) == 0;
+        case kPipelineListAsTuple:
+            result = PyList_AsTuple(r[a[1]]);
+            break;
+        case kPipelineDictNew:
+            result = PyDict_New();
+            break;
+        case kPipelineDictGetItem:
+        case kPipelineDictGetItemString:
+            if (!PyDict_Check(r[a[1]])) {
+                PyErr_BadInternalCall();
+                return false;
+            }
+            if (instr.op == kPipelineDictGetItem) {
+                result = PyDict_GetItemWithError(r[a[1]], r[a[2]]);
+            } else {
+                PyObject *key = PyUnicode_FromString(instr.string.c_str());
+                if (key == nullptr) return false;
+                result = PyDict_GetItemWithError(r[a[1]], key);
+                Py_DECREF(key);
+            }
+            if (result == nullptr && PyErr_Occurred()) return false;
+            // a missing key reads as None, like Pythonx.C.PyDict.get_item/2 reads as nil
+            result = result ? result : Py_None;
+            Py_INCREF(result);
+            break;
+        case kPipelineDictSetItem:
+            return PyDict_SetItem(r[a[0]], r[a[1]], r[a[2]]) == 0;
+        case kPipelineDictSetItemString:
+            return PyDict_SetItemString(r[a[0]], instr.string.c_str(), r[a[1]]) == 0;
+    }
+
+    if (result == nullptr) return false;
+    Py_XSETREF(r[a[0]], result);
+    return true;
+}
+
+// Runs a decoded batch. Must hold the python mutex.
+//
+// Returns the list of outputs, or `{:error, index, pyerr}` for the first instruction that failed.
+static ERL_NIF_TERM pythonx_pipeline_run(ErlNifEnv *env, PythonxPipeline &pipeline) {
+    std::vector<PyObject *> regs(pipeline.registers, nullptr);
+    ERL_NIF_TERM ret;
+    size_t failed = 0;
+    bool ok = true;
+
+    {
+        PyHandleLock lock;
+        for (size_t i = 0; i < pipeline.instrs.size(); ++i) {
+            auto &instr = pipeline.instrs[i];
+            if (instr.op != kPipelineLoad) continue;
+
+            PyObject *val;
+            if (instr.ref != nullptr) {
+                val = instr.ref->val;
+            } else {
+                PyHandleSlot *slot = pyhandle_slot_locked(instr.handle);
+                val = slot ? slot->val : nullptr;
+            }
+            if (val == nullptr) {
+                PyErr_SetString(PyExc_ValueError, "the handle was released");
+                ok = false;
+                failed = i;
+                break;
+            }
+            Py_INCREF(val);
+            instr.loaded = val;
+        }
+    }
+
+    for (size_t i = 0; ok && i < pipeline.instrs.size(); ++i) {
+        if (!pythonx_pipeline_step(pipeline.instrs[i], regs)) {
+            ok = false;
+            failed = i;
+        }
+    }
+
+    std::vector<ERL_NIF_TERM> outputs(pipeline.outputs.size());
+    for (size_t i = 0; ok && i < pipeline.outputs.size(); ++i) {
+        if (!pipeline.outputs[i].as_term) continue;
+        auto term = python_to(env, regs[pipeline.outputs[i].reg]);
+        if (term) {
+            outputs[i] = term.value();
+        } else {
+            ok = false;
+            failed = pipeline.instrs.size();
+        }
+    }
+    if (ok) {
+        PyHandleLock lock;
+        for (size_t i = 0; i < pipeline.outputs.size(); ++i) {
+            if (pipeline.outputs[i].as_term) continue;
+            PyObject *val = regs[pipeline.outputs[i].reg];
+            Py_INCREF(val);
+            PyHandle handle = pyhandle_put_locked(val);
+            if (pipeline.arena != nullptr) pipeline.arena->handles->emplace_back(handle);
+            outputs[i] = enif_make_uint64(env, handle);
+        }
+        ret = enif_make_list_from_array(env, outputs.data(), (unsigned)outputs.size());
+    }
+    if (!ok) {
+        if (!PyErr_Occurred()) PyErr_SetString(PyExc_RuntimeError, "cannot convert an output of the pipeline");
+        ret = enif_make_tuple3(env, kAtomError, enif_make_uint64(env, failed), pythonx_current_pyerr(env));
+    }
+
+    for (PyObject *val : regs) Py_XDECREF(val);
+    for (auto &instr : pipeline.instrs) Py_CLEAR(instr.loaded);
+    return ret;
+}
+
+#endif  // PYTHONX_PIPELINE_HPP
@@ -0,0 +1,226 @@
+#ifndef PYTHONX_PROFILE_HPP
+#define PYTHONX_PROFILE_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <frameobject.h>
+#include <erl_nif.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+
+// Sampling profiler for Python code.
+//
+// Python code only runs while one of our NIFs holds the GIL, so instead of
+// interrupting it from another thread, the profile function installed with
+// `PyEval_SetProfile` takes a sample at the first call or return event after
+// each interval. A sample is weighted by the number of intervals that elapsed
+// since the previous one, so a long call into C is charged to the stack it
+// returns from. The clock restarts whenever a top-level frame is entered,
+// which keeps the time between two NIF calls out of the profile.
+//
+// Stacks are aggregated per session, from `profiler_start` to `profiler_stop`,
+// and exported in the collapsed format of flamegraph.pl and speedscope.
+
+static constexpr int kPythonxProfileMaxDepth = 256;
+
+// only touched with the python mutex held
+static bool pythonx_profile_active = false;
+static std::chrono::nanoseconds pythonx_profile_interval{0};
+// both only touched by the profile function, which runs with the GIL held
+static std::chrono::steady_clock::time_point pythonx_profile_next_sample;
+static std::string pythonx_profile_stack;
+
+// guards the aggregated stacks, which are read without the GIL
+static std::mutex pythonx_profile_mutex;
+static std::unordered_map<std::string, int64_t> pythonx_profile_stacks;
+static int64_t pythonx_profile_samples = 0;
+static int64_t pythonx_profile_truncated = 0;
+
+// new reference
+static PyCodeObject * pythonx_frame_code(PyFrameObject *frame) {
+#if PY_VERSION_HEX >= 0x03090000
+    return PyFrame_GetCode(frame);
+#else
+    Py_INCREF(frame->f_code);
+    return frame->f_code;
+#endif
+}
+
+// new reference
+static PyFrameObject * pythonx_frame_back(PyFrameObject *frame) {
+#if PY_VERSION_HEX >= 0x03090000
+    return PyFrame_GetBack(frame);
+#else
+    Py_XINCREF(frame->f_back);
+    return frame->f_back;
+#endif
+}
+
+// `name (filename:first line)`, without the separators of the collapsed format
+static void pythonx_profile_append_label(std::string &out, const char *name, const char *filename, int line) {
+    size_t start = out.size();
+    out += name ? name : "?";
+    if (filename) {
+        out += " (";
+        out += filename;
+        if (line > 0) {
+            out += ':';
+            out += std::to_string(line);
+        }
+        out += ')';
+    }
+    std::replace(out.begin() + start, out.end(), ';', ':');
+    std::replace(out.begin() + start, out.end(), '\n', ' ');
+}
+
+static void pythonx_profile_sample(PyFrameObject *frame, int what, PyObject *arg, int64_t weight) {
+    std::vector<PyFrameObject *> frames;
+    Py_XINCREF(frame);
+    while (frame != nullptr && (int)frames.size() < kPythonxProfileMaxDepth) {
+        frames.push_back(frame);
+        frame = pythonx_frame_back(frame);
+    }
+    bool truncated = frame != nullptr;
+    Py_XDECREF(frame);
+
+    // root first
+    std::string &stack = pythonx_profile_stack;
+    stack.clear();
+    if (truncated) stack += "[truncated];";
+    for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+        PyCodeObject *code = pythonx_frame_code(*it);
+        if (it != frames.rbegin()) stack += ';';
+        pythonx_profile_append_label(stack, PyUnicode_AsUTF8(code->co_name), PyUnicode_AsUTF8(code->co_filename), code->co_firstlineno);
+        Py_DECREF(code);
+        Py_DECREF(*it);
+    }
+    if (what == PyTrace_C_CALL || what == PyTrace_C_RETURN || what == PyTrace_C_EXCEPTION) {
+        stack += ';';
+        pythonx_profile_append_label(stack, PyEval_GetFuncName(arg), nullptr, 0);
+    }
+    // the labels are only read from Python objects, never fail
+    if (PyErr_Occurred()) PyErr_Clear();
+
+    std::lock_guard<std::mutex> guard(pythonx_profile_mutex);
+    pythonx_profile_stacks[stack] += weight;
+    pythonx_profile_samples += weight;
+    if (truncated) pythonx_profile_truncated += weight;
+}
+
+static int pythonx_profile_callback(PyObject *obj, PyFrameObject *frame, int what, PyObject *arg) {
+    auto now = std::chrono::steady_clock::now();
+    if (what == PyTrace_CALL && frame != nullptr) {
+        PyFrameObject *back = pythonx_frame_back(frame);
+        Py_XDECREF(back);
+        if (back == nullptr) {
+            pythonx_profile_next_sample = now + pythonx_profile_interval;
+            return 0;
+        }
+    }
+    if (now < pythonx_profile_next_sample) return 0;
+
+    int64_t elapsed = 1 + (now - pythonx_profile_next_sample) / pythonx_profile_interval;
+    pythonx_profile_next_sample += elapsed * pythonx_profile_interval;
+
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    pythonx_profile_sample(frame, what, arg, elapsed);
+    PyErr_Restore(type, value, traceback);
+    return 0;
+}
+
+// Called before Python is finalized, the session can still be exported.
+static void pythonx_profile_detach() {
+    if (pythonx_profile_active) {
+        PyEval_SetProfile(nullptr, nullptr);
+        pythonx_profile_active = false;
+    }
+}
+
+// ------- NIF functions -------
+
+static ERL_NIF_TERM pythonx_profiler_start(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    int64_t interval_us;
+    if (!erlang::nif::get(env, argv[0], &interval_us) || interval_us <= 0) {
+        return enif_make_badarg(env);
+    }
+    if (pythonx_profile_active) {
+        return erlang::nif::error(env, "profiler is already running");
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(pythonx_profile_mutex);
+        pythonx_profile_stacks.clear();
+        pythonx_profile_samples = 0;
+        pythonx_profile_truncated = 0;
+    }
+    pythonx_profile_interval = std::chrono::microseconds(interval_us);
+    pythonx_profile_next_sample = std::chrono::steady_clock::now() + pythonx_profile_interval;
+    PyEval_SetProfile(pythonx_profile_callback, nullptr);
+    pythonx_profile_active = true;
+    return kAtomOk;
+}
+
+static ERL_NIF_TERM pythonx_profiler_stop(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    if (!pythonx_profile_active) {
+        return erlang::nif::error(env, "profiler is not running");
+    }
+    pythonx_profile_detach();
+    return kAtomOk;
+}
+
+// The stacks of the current or last session, one `frame;frame;... count` line
+// per stack, sorted by count.
+static ERL_NIF_TERM pythonx_profiler_collapsed(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    std::vector<std::pair<std::string, int64_t>> stacks;
+    int64_t samples, truncated;
+    {
+        std::lock_guard<std::mutex> guard(pythonx_profile_mutex);
+        stacks.assign(pythonx_profile_stacks.begin(), pythonx_profile_stacks.end());
+        samples = pythonx_profile_samples;
+        truncated = pythonx_profile_truncated;
+    }
+    std::sort(stacks.begin(), stacks.end(), [](const auto &a, const auto &b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+
+    std::string out;
+    for (auto &stack : stacks) {
+        out += stack.first;
+        out += ' ';
+        out += std::to_string(stack.second);
+        out += '\n';
+    }
+
+    ERL_NIF_TERM collapsed;
+    unsigned char *ptr = enif_make_new_binary(env, out.size(), &collapsed);
+    if (ptr == nullptr) return erlang::nif::error(env, "cannot allocate the collapsed stacks");
+    memcpy(ptr, out.data(), out.size());
+
+    ERL_NIF_TERM keys[] = {
+        enif_make_atom(env, "running"),
+        enif_make_atom(env, "interval_us"),
+        enif_make_atom(env, "samples"),
+        enif_make_atom(env, "truncated"),
+        enif_make_atom(env, "collapsed"),
+    };
+    ERL_NIF_TERM values[] = {
+        pythonx_profile_active ? kAtomTrue : kAtomFalse,
+        enif_make_int64(env, std::chrono::duration_cast<std::chrono::microseconds>(pythonx_profile_interval).count()),
+        enif_make_int64(env, samples),
+        enif_make_int64(env, truncated),
+        collapsed,
+    };
+    ERL_NIF_TERM ret;
+    enif_make_map_from_arrays(env, keys, values, 5, &ret);
+    return ret;
+}
+
+#endif  // PYTHONX_PROFILE_HPP
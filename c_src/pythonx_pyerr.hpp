@@ -25,6 +25,7 @@ static inline ERL_NIF_TERM nonnull_pyobject_to_nifres(ErlNifEnv *env, PyObject *
 
     result_res->val = result;
     result_res->borrowed = borrowed;
+    pythonx_census_track(env, result_res);
     ERL_NIF_TERM ret = enif_make_resource(env, result_res);
     enif_release_resource(result_res);
     return ret;
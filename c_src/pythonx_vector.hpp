@@ -0,0 +1,571 @@
+#ifndef PYTHONX_VECTOR_HPP
+#define PYTHONX_VECTOR_HPP
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <erl_nif.h>
+#include <cmath>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+#include "nif_utils.hpp"
+#include "pythonx_consts.hpp"
+#include "pythonx_convert.hpp"
+#include "pythonx_handle.hpp"
+#include "pythonx_pyerr.hpp"
+
+// Elementwise number protocol operations over whole vectors, in one NIF call.
+//
+// Each operand is a scalar, which is broadcast, a list of numbers, handles,
+// or a packed binary of native endian int64 or double values:
+//
+//     5 | 2.5 | [1, 2.5] | {:handle, h} | {:handles, [h]} | {:s64, binary} | {:f64, binary}
+//
+// When both operands hold exact ints or floats, add, subtract, multiply,
+// true_divide, and, or and xor run as plain loops over int64_t and double
+// that the compiler can vectorize, without a Python object per element. The
+// loops give up whenever Python could give a different result: on an int64
+// overflow, a division by zero, or an int too large to be divided exactly as
+// a double. The PyNumber functions then run the whole vector, and return the
+// big ints or raise the errors.
+
+enum PythonxVectorKind {
+    kVectorInt,
+    kVectorFloat,
+    kVectorObject,
+};
+
+enum PythonxVectorOutput {
+    kVectorOutS64,
+    kVectorOutF64,
+    kVectorOutList,
+    kVectorOutHandles,
+};
+
+enum PythonxVectorNative {
+    kVectorNativeNone,
+    kVectorNativeAdd,
+    kVectorNativeSubtract,
+    kVectorNativeMultiply,
+    kVectorNativeTrueDivide,
+    kVectorNativeAnd,
+    kVectorNativeOr,
+    kVectorNativeXor,
+};
+
+struct PythonxVectorOperand {
+    PythonxVectorKind kind = kVectorInt;
+    bool scalar = false;
+    size_t length = 1;
+    std::vector<int64_t> ints;
+    std::vector<double> floats;
+    // numbers that are neither all int64 nor all floats, converted one by one
+    std::vector<ERL_NIF_TERM> terms;
+    std::vector<PyHandle> handles;
+    // the objects behind `handles`, as new references
+    std::vector<PyObject *> objects;
+
+    ~PythonxVectorOperand() {
+        release();
+    }
+
+    // Drops the references taken by pythonx_vector_resolve. Must hold the python mutex.
+    void release() {
+        for (PyObject *val : objects) Py_DECREF(val);
+        objects.clear();
+    }
+
+    // Returns a new reference to element `i`, or nullptr with a Python error set.
+    PyObject * object_at(ErlNifEnv *env, size_t i) const {
+        size_t at = scalar ? 0 : i;
+        if (kind == kVectorInt) return PyLong_FromLongLong(ints[at]);
+        if (kind == kVectorFloat) return PyFloat_FromDouble(floats[at]);
+        if (!objects.empty()) {
+            Py_INCREF(objects[at]);
+            return objects[at];
+        }
+        auto val = erl_to_python(env, terms[at]);
+        return val ? val.value() : nullptr;
+    }
+};
+
+struct PythonxVectorResult {
+    PythonxVectorKind kind;
+    std::vector<int64_t> ints;
+    std::vector<double> floats;
+};
+
+// A decoded `number_vector(op, a, b, into, arena)` call.
+struct PythonxVector {
+    binaryfunc op;
+    PythonxVectorNative native;
+    PythonxVectorOperand a, b;
+    size_t n;
+    PythonxVectorOutput out;
+    PyArenaNifRes *arena;
+};
+
+static PythonxVectorNative pythonx_vector_native_op(const char *name) {
+    static const struct { const char *name; PythonxVectorNative op; } ops[] = {
+        {"add", kVectorNativeAdd},
+        {"subtract", kVectorNativeSubtract},
+        {"multiply", kVectorNativeMultiply},
+        {"true_divide", kVectorNativeTrueDivide},
+        {"and", kVectorNativeAnd},
+        {"or", kVectorNativeOr},
+        {"xor", kVectorNativeXor},
+    };
+    for (auto &op : ops) {
+        if (strcmp(op.name, name) == 0) return op.op;
+    }
+    return kVectorNativeNone;
+}
+
+static bool pythonx_vector_get_numbers(ErlNifEnv *env, ERL_NIF_TERM list, PythonxVectorOperand &operand) {
+    unsigned length;
+    if (!enif_get_list_length(env, list, &length)) return false;
+    operand.length = length;
+    operand.terms.reserve(length);
+    ERL_NIF_TERM head, tail = list;
+    while (enif_get_list_cell(env, tail, &head, &tail)) {
+        if (!enif_is_number(env, head)) return false;
+        operand.terms.emplace_back(head);
+    }
+
+    operand.ints.resize(length);
+    size_t i = 0;
+    while (i < length && erlang::nif::get(env, operand.terms[i], &operand.ints[i])) ++i;
+    if (i == length) {
+        operand.kind = kVectorInt;
+        operand.terms.clear();
+        return true;
+    }
+    operand.ints.clear();
+
+    operand.floats.resize(length);
+    i = 0;
+    while (i < length && erlang::nif::get(env, operand.terms[i], &operand.floats[i])) ++i;
+    if (i == length) {
+        operand.kind = kVectorFloat;
+        operand.terms.clear();
+        return true;
+    }
+    operand.floats.clear();
+
+    operand.kind = kVectorObject;
+    return true;
+}
+
+static bool pythonx_vector_get_operand(ErlNifEnv *env, ERL_NIF_TERM term, PythonxVectorOperand &operand) {
+    int64_t integer;
+    double number;
+    if (erlang::nif::get(env, term, &integer)) {
+        operand.scalar = true;
+        operand.ints.emplace_back(integer);
+        return true;
+    }
+    if (erlang::nif::get(env, term, &number)) {
+        operand.scalar = true;
+        operand.kind = kVectorFloat;
+        operand.floats.emplace_back(number);
+        return true;
+    }
+    if (enif_is_number(env, term)) {
+        operand.scalar = true;
+        operand.kind = kVectorObject;
+        operand.terms.emplace_back(term);
+        return true;
+    }
+    if (enif_is_list(env, term)) return pythonx_vector_get_numbers(env, term, operand);
+
+    int arity;
+    const ERL_NIF_TERM *elems;
+    std::string tag;
+    if (!enif_get_tuple(env, term, &arity, &elems) || arity != 2 || !erlang::nif::get_atom(env, elems[0], tag)) return false;
+
+    if (tag == "s64" || tag == "f64") {
+        ErlNifBinary binary;
+        if (!enif_inspect_binary(env, elems[1], &binary) || binary.size % 8 != 0) return false;
+        operand.length = binary.size / 8;
+        if (tag == "s64") {
+            operand.ints.resize(operand.length);
+            if (binary.size > 0) memcpy(operand.ints.data(), binary.data, binary.size);
+        } else {
+            operand.kind = kVectorFloat;
+            operand.floats.resize(operand.length);
+            if (binary.size > 0) memcpy(operand.floats.data(), binary.data, binary.size);
+        }
+        return true;
+    }
+
+    operand.kind = kVectorObject;
+    if (tag == "handle") {
+        PyHandle handle;
+        if (!erlang::nif::get(env, elems[1], &handle)) return false;
+        operand.scalar = true;
+        operand.handles.emplace_back(handle);
+        return true;
+    }
+    if (tag == "handles") {
+        unsigned length;
+        if (!enif_get_list_length(env, elems[1], &length)) return false;
+        operand.length = length;
+        operand.handles.reserve(length);
+        ERL_NIF_TERM head, tail = elems[1];
+        while (enif_get_list_cell(env, tail, &head, &tail)) {
+            PyHandle handle;
+            if (!erlang::nif::get(env, head, &handle)) return false;
+            operand.handles.emplace_back(handle);
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool pythonx_vector_get_output(ErlNifEnv *env, ERL_NIF_TERM term, PythonxVectorOutput *out) {
+    std::string name;
+    if (!erlang::nif::get_atom(env, term, name)) return false;
+    if (name == "s64") *out = kVectorOutS64;
+    else if (name == "f64") *out = kVectorOutF64;
+    else if (name == "list") *out = kVectorOutList;
+    else if (name == "handles") *out = kVectorOutHandles;
+    else return false;
+    return true;
+}
+
+// Takes a reference to the objects behind the handles of both operands under
+// one lock. Returns false if a handle was released.
+static bool pythonx_vector_resolve(PythonxVectorOperand &a, PythonxVectorOperand &b) {
+    PyHandleLock lock;
+    for (PythonxVectorOperand *operand : {&a, &b}) {
+        operand->objects.reserve(operand->handles.size());
+        for (PyHandle handle : operand->handles) {
+            PyHandleSlot *slot = pyhandle_slot_locked(handle);
+            if (slot == nullptr) return false;
+            Py_INCREF(slot->val);
+            operand->objects.emplace_back(slot->val);
+        }
+    }
+    return true;
+}
+
+// ------- Native loops -------
+
+// Returns false if a result overflowed int64.
+static bool pythonx_vector_ints(PythonxVectorNative op, const int64_t *a, const int64_t *b, int64_t *out, size_t n) {
+    // the sign bit of `overflow` is set once a sum or a difference wrapped around
+    int64_t overflow = 0;
+    bool multiply_overflow = false;
+    switch (op) {
+        case kVectorNativeAdd:
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = (int64_t)((uint64_t)a[i] + (uint64_t)b[i]);
+                overflow |= (a[i] ^ out[i]) & (b[i] ^ out[i]);
+            }
+            break;
+        case kVectorNativeSubtract:
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = (int64_t)((uint64_t)a[i] - (uint64_t)b[i]);
+                overflow |= (a[i] ^ b[i]) & (a[i] ^ out[i]);
+            }
+            break;
+        case kVectorNativeMultiply:
+            for (size_t i = 0; i < n; ++i) {
+                long long product;
+                multiply_overflow |= __builtin_mul_overflow((long long)a[i], (long long)b[i], &product);
+                out[i] = product;
+            }
+            break;
+        case kVectorNativeAnd:
+            for (size_t i = 0; i < n; ++i) out[i] = a[i] & b[i];
+            break;
+        case kVectorNativeOr:
+            for (size_t i = 0; i < n; ++i) out[i] = a[i] | b[i];
+            break;
+        case kVectorNativeXor:
+            for (size_t i = 0; i < n; ++i) out[i] = a[i] ^ b[i];
+            break;
+        default:
+            return false;
+    }
+    return overflow >= 0 && !multiply_overflow;
+}
+
+// Python divides two ints as doubles when both are exact in a double, so
+// that the quotient is rounded once. Returns false if any of them is not.
+static bool pythonx_vector_int_divide(const int64_t *a, const int64_t *b, double *out, size_t n) {
+    const uint64_t limit = (uint64_t)1 << 53;
+    uint64_t inexact = 0;
+    for (size_t i = 0; i < n; ++i) {
+        // |x| <= 2^53, counted without branches
+        inexact |= ((uint64_t)a[i] + limit > 2 * limit) | ((uint64_t)b[i] + limit > 2 * limit) | (b[i] == 0);
+        out[i] = (double)a[i] / (double)b[i];
+    }
+    return inexact == 0;
+}
+
+// Returns false on a division by zero, which raises in Python.
+static bool pythonx_vector_floats(PythonxVectorNative op, const double *a, const double *b, double *out, size_t n) {
+    int64_t zero = 0;
+    switch (op) {
+        case kVectorNativeAdd:
+            for (size_t i = 0; i < n; ++i) out[i] = a[i] + b[i];
+            break;
+        case kVectorNativeSubtract:
+            for (size_t i = 0; i < n; ++i) out[i] = a[i] - b[i];
+            break;
+        case kVectorNativeMultiply:
+            for (size_t i = 0; i < n; ++i) out[i] = a[i] * b[i];
+            break;
+        case kVectorNativeTrueDivide:
+            for (size_t i = 0; i < n; ++i) {
+                zero |= b[i] == 0.0;
+                out[i] = a[i] / b[i];
+            }
+            break;
+        default:
+            return false;
+    }
+    return zero == 0;
+}
+
+static void pythonx_vector_broadcast(PythonxVectorOperand &operand, size_t n) {
+    if (!operand.scalar) return;
+    if (operand.kind == kVectorInt) operand.ints.assign(n, operand.ints[0]);
+    else operand.floats.assign(n, operand.floats[0]);
+    operand.scalar = false;
+    operand.length = n;
+}
+
+// Ints mixed with floats are converted to double first, like Python does.
+static const double * pythonx_vector_as_floats(const PythonxVectorOperand &operand, std::vector<double> &converted) {
+    if (operand.kind == kVectorFloat) return operand.floats.data();
+    converted.resize(operand.ints.size());
+    for (size_t i = 0; i < converted.size(); ++i) converted[i] = (double)operand.ints[i];
+    return converted.data();
+}
+
+// Runs `op` in the native loops if both operands are exact ints or floats.
+// Returns false if Python has to run it instead.
+static bool pythonx_vector_native(PythonxVectorNative op, PythonxVectorOperand &a, PythonxVectorOperand &b, size_t n, PythonxVectorOutput out, PythonxVectorResult &result) {
+    if (op == kVectorNativeNone || a.kind == kVectorObject || b.kind == kVectorObject) return false;
+    bool ints = a.kind == kVectorInt && b.kind == kVectorInt;
+    if (!ints && op != kVectorNativeAdd && op != kVectorNativeSubtract && op != kVectorNativeMultiply && op != kVectorNativeTrueDivide) return false;
+    // a float result into :s64 raises, let Python report it
+    if ((!ints || op == kVectorNativeTrueDivide) && out == kVectorOutS64) return false;
+
+    pythonx_vector_broadcast(a, n);
+    pythonx_vector_broadcast(b, n);
+    if (ints && op != kVectorNativeTrueDivide) {
+        result.kind = kVectorInt;
+        result.ints.resize(n);
+        return pythonx_vector_ints(op, a.ints.data(), b.ints.data(), result.ints.data(), n);
+    }
+
+    result.kind = kVectorFloat;
+    result.floats.resize(n);
+    bool done;
+    if (ints) {
+        done = pythonx_vector_int_divide(a.ints.data(), b.ints.data(), result.floats.data(), n);
+    } else {
+        std::vector<double> a_floats, b_floats;
+        done = pythonx_vector_floats(op, pythonx_vector_as_floats(a, a_floats), pythonx_vector_as_floats(b, b_floats), result.floats.data(), n);
+    }
+    if (done && out == kVectorOutList) {
+        // inf and nan have no term, let Python report it
+        for (double v : result.floats) done &= std::isfinite(v);
+    }
+    return done;
+}
+
+// ------- Results -------
+
+static ERL_NIF_TERM pythonx_vector_error(ErlNifEnv *env, size_t index) {
+    return enif_make_tuple3(env, kAtomError, enif_make_uint64(env, index), pythonx_current_pyerr(env));
+}
+
+// Stores `results` in handles under one lock, stealing the references.
+static ERL_NIF_TERM pythonx_vector_put_handles(ErlNifEnv *env, std::vector<PyObject *> &results, PyArenaNifRes *arena) {
+    PyHandleLock lock;
+    return pyhandle_put_list_locked(env, results, arena);
+}
+
+// Numbers as terms, unlike python_to an int beyond int64 or a float without a term raises.
+static std::optional<ERL_NIF_TERM> pythonx_vector_to_term(ErlNifEnv *env, PyObject *val) {
+    if (PyLong_Check(val)) {
+        long long v = PyLong_AsLongLong(val);
+        if (v == -1 && PyErr_Occurred()) return std::nullopt;
+        return enif_make_int64(env, v);
+    }
+    if (PyFloat_Check(val) && !std::isfinite(PyFloat_AS_DOUBLE(val))) {
+        PyErr_SetString(PyExc_ValueError, "cannot convert inf or nan to a term");
+        return std::nullopt;
+    }
+    auto term = python_to(env, val);
+    if (!term && !PyErr_Occurred()) {
+        PyErr_Format(PyExc_TypeError, "cannot convert %s to a term", Py_TYPE(val)->tp_name);
+    }
+    return term;
+}
+
+static ERL_NIF_TERM pythonx_vector_native_to_term(ErlNifEnv *env, PythonxVectorResult &result, PythonxVectorOutput out, PyArenaNifRes *arena) {
+    bool ints = result.kind == kVectorInt;
+    size_t n = ints ? result.ints.size() : result.floats.size();
+    switch (out) {
+        case kVectorOutS64:
+        case kVectorOutF64: {
+            ERL_NIF_TERM packed;
+            unsigned char *data = enif_make_new_binary(env, n * 8, &packed);
+            if (data == nullptr) return erlang::nif::error(env, "cannot allocate the result");
+            if (ints && out == kVectorOutF64) {
+                result.floats.resize(n);
+                for (size_t i = 0; i < n; ++i) result.floats[i] = (double)result.ints[i];
+                ints = false;
+            }
+            if (n > 0) memcpy(data, ints ? (const void *)result.ints.data() : (const void *)result.floats.data(), n * 8);
+            return packed;
+        }
+        case kVectorOutList: {
+            std::vector<ERL_NIF_TERM> terms(n);
+            for (size_t i = 0; i < n; ++i) {
+                terms[i] = ints ? enif_make_int64(env, result.ints[i]) : enif_make_double(env, result.floats[i]);
+            }
+            return enif_make_list_from_array(env, terms.data(), (unsigned)n);
+        }
+        case kVectorOutHandles: {
+            std::vector<PyObject *> results;
+            results.reserve(n);
+            for (size_t i = 0; i < n; ++i) {
+                PyObject *val = ints ? PyLong_FromLongLong(result.ints[i]) : PyFloat_FromDouble(result.floats[i]);
+                if (val == nullptr) {
+                    for (PyObject *done : results) Py_DECREF(done);
+                    return pythonx_vector_error(env, i);
+                }
+                results.emplace_back(val);
+            }
+            return pythonx_vector_put_handles(env, results, arena);
+        }
+    }
+    return enif_make_badarg(env);
+}
+
+// Applies `op` one element at a time with the number protocol.
+static ERL_NIF_TERM pythonx_vector_python(ErlNifEnv *env, binaryfunc op, const PythonxVectorOperand &a, const PythonxVectorOperand &b, size_t n, PythonxVectorOutput out, PyArenaNifRes *arena) {
+    ERL_NIF_TERM packed;
+    unsigned char *data = nullptr;
+    if (out == kVectorOutS64 || out == kVectorOutF64) {
+        data = enif_make_new_binary(env, n * 8, &packed);
+        if (data == nullptr) return erlang::nif::error(env, "cannot allocate the result");
+    }
+    std::vector<ERL_NIF_TERM> terms;
+    std::vector<PyObject *> results;
+    if (out == kVectorOutList) terms.reserve(n);
+    if (out == kVectorOutHandles) results.reserve(n);
+
+    for (size_t i = 0; i < n; ++i) {
+        PyObject *o1 = a.object_at(env, i);
+        PyObject *o2 = o1 ? b.object_at(env, i) : nullptr;
+        PyObject *result = o2 ? op(o1, o2) : nullptr;
+        Py_XDECREF(o1);
+        Py_XDECREF(o2);
+
+        bool ok = result != nullptr;
+        if (ok) {
+            switch (out) {
+                case kVectorOutS64: {
+                    if (!PyLong_Check(result)) {
+                        PyErr_Format(PyExc_TypeError, "expected an int result for :s64, got %s", Py_TYPE(result)->tp_name);
+                        ok = false;
+                        break;
+                    }
+                    long long v = PyLong_AsLongLong(result);
+                    ok = !(v == -1 && PyErr_Occurred());
+                    memcpy(data + i * 8, &v, 8);
+                    break;
+                }
+                case kVectorOutF64: {
+                    double v = PyFloat_AsDouble(result);
+                    ok = !(v == -1.0 && PyErr_Occurred());
+                    memcpy(data + i * 8, &v, 8);
+                    break;
+                }
+                case kVectorOutList: {
+                    auto term = pythonx_vector_to_term(env, result);
+                    ok = term.has_value();
+                    if (ok) terms.emplace_back(term.value());
+                    break;
+                }
+                case kVectorOutHandles:
+                    Py_INCREF(result);
+                    results.emplace_back(result);
+                    break;
+            }
+            Py_DECREF(result);
+        }
+
+        if (!ok) {
+            for (PyObject *val : results) Py_DECREF(val);
+            return pythonx_vector_error(env, i);
+        }
+    }
+
+    switch (out) {
+        case kVectorOutList:
+            return enif_make_list_from_array(env, terms.data(), (unsigned)terms.size());
+        case kVectorOutHandles:
+            return pythonx_vector_put_handles(env, results, arena);
+        default:
+            return packed;
+    }
+}
+
+// ------- Calls -------
+
+// Decodes the arguments of number_vector without touching any Python object,
+// so that it can run before taking the lock.
+static bool pythonx_vector_parse(ErlNifEnv *env, const ERL_NIF_TERM argv[], PythonxVector &vector) {
+    char name[32];
+    if (!enif_get_atom(env, argv[0], name, sizeof(name), ERL_NIF_LATIN1)) return false;
+    vector.op = pyhandle_number_op(name);
+    if (unlikely(vector.op == nullptr)) return false;
+    vector.native = pythonx_vector_native_op(name);
+
+    PythonxVectorOperand &a = vector.a, &b = vector.b;
+    if (!pythonx_vector_get_operand(env, argv[1], a) || !pythonx_vector_get_operand(env, argv[2], b)) return false;
+    if (!a.scalar && !b.scalar && a.length != b.length) return false;
+    vector.n = a.scalar ? b.length : a.length;
+
+    return pythonx_vector_get_output(env, argv[3], &vector.out) && pyhandle_get_arena(env, argv[4], &vector.arena);
+}
+
+// Runs the native loops when neither the operands nor the results are Python
+// objects, which needs no python mutex. Returns false if Python has to run it.
+static bool pythonx_vector_run_native(ErlNifEnv *env, PythonxVector &vector, ERL_NIF_TERM *ret) {
+    if (vector.out == kVectorOutHandles) return false;
+
+    PythonxVectorResult result;
+    if (!pythonx_vector_native(vector.native, vector.a, vector.b, vector.n, vector.out, result)) return false;
+    *ret = pythonx_vector_native_to_term(env, result, vector.out, vector.arena);
+    return true;
+}
+
+// Runs what pythonx_vector_run_native could not. Must hold the python mutex.
+static ERL_NIF_TERM pythonx_vector_run(ErlNifEnv *env, PythonxVector &vector) {
+    ERL_NIF_TERM ret;
+    PythonxVectorResult result;
+    if (!pythonx_vector_resolve(vector.a, vector.b)) {
+        ret = enif_make_badarg(env);
+    } else if (vector.out == kVectorOutHandles && pythonx_vector_native(vector.native, vector.a, vector.b, vector.n, vector.out, result)) {
+        // the other outputs already went through the native loops
+        ret = pythonx_vector_native_to_term(env, result, vector.out, vector.arena);
+    } else {
+        ret = pythonx_vector_python(env, vector.op, vector.a, vector.b, vector.n, vector.out, vector.arena);
+    }
+    vector.a.release();
+    vector.b.release();
+    return ret;
+}
+
+#endif  // PYTHONX_VECTOR_HPP
@@ -15,12 +15,22 @@ defmodule Pythonx do
 
   @doc """
   Evaluates the given python code and returns the variables specified in the `return` option.
+
+  When `code` is a literal string, it is compiled to bytecode at compile time.
   """
   defmacro pyeval(code, opts) do
     vars = Keyword.get(opts, :return, [])
     opts = [locals: false, globals: false, return: vars]
     quoted_vars = Enum.map(vars, fn var -> Macro.var(var, nil) end)
 
+    opts =
+      with true <- is_binary(code),
+           {:ok, analysis} <- Pythonx.Symtable.analyze(code) do
+        opts ++ [bytecode: {analysis.magic, analysis.bytecode}]
+      else
+        _ -> opts
+      end
+
     quote do
       [unquote_splicing(quoted_vars)] = Pythonx.inline!(unquote(code), unquote(opts))
     end
@@ -31,100 +41,25 @@ defmodule Pythonx do
     opts = [locals: false, globals: false, return: vars]
     quoted_vars = Enum.map(vars, fn var -> Macro.var(var, nil) end)
 
-    python3_root = "#{:code.priv_dir(:pythonx)}/python3"
-    embedded_python3_executable = "#{python3_root}/bin/python3"
-
-    envs =
-      case :os.type() do
-        {:unix, :darwin} ->
-          [{"DYLD_INSERT_LIBRARIES", "#{python3_root}/lib/libpython3.dylib"}]
-
-        {:unix, _} ->
-          [{"LD_LIBRARY_PATH", "#{python3_root}/lib"}]
-
-        _ ->
-          []
-      end
-
-    args = [
-      "-c",
-      """
-      import symtable
-      import json
-
-      def analyze_code(code):
-          try:
-              sym_table = symtable.symtable(code, '<string>', 'exec')
-              def gather_symbols(table):
-                  globals_used = set()
-                  for symbol in table.get_symbols():
-                      if symbol.is_global():
-                          globals_used.add(symbol.get_name())
-                  for child in table.get_children():
-                      child_globals = gather_symbols(child)
-                      globals_used.update(child_globals)
-                  return globals_used
-              return {"status": "ok", "globals": list(gather_symbols(sym_table))}
-          except SyntaxError as e:
-              return {"status": "error", "error": e.msg, "lineno": e.lineno, "offset": e.offset}
-
-      code_snippet = \"\"\"
-      #{String.replace(code, "\"", "\\\"")}
-      \"\"\"
-
-      print(json.dumps(analyze_code(code_snippet)))
-      """
-    ]
-
-    get_globals = fn python3_executable ->
-      case System.cmd(python3_executable, args, env: envs, stderr_to_stdout: true) do
-        {outputs, 0} ->
-          case Jason.decode(outputs) do
-            {:ok, %{"status" => "ok", "globals" => globals}} ->
-              {:ok, Macro.escape(Map.new(Enum.map(globals, fn global -> {global, true} end)))}
-
-            {:ok, %{"status" => "error", "error" => error, "lineno" => lineno, "offset" => offset}} ->
-              description = """
-              The inline Python code contains syntax errors: #{error} at line #{__CALLER__.line + lineno}, column #{offset}
-              """
-
-              {:error, {CompileError, file: __CALLER__.file, line: __CALLER__.line + lineno, description: description}}
-
-            _ ->
-              description = """
-              The inline Python code contains unknown errors. #{outputs}
-              """
-
-              {:error, {CompileError, file: __CALLER__.file, line: __CALLER__.line, description: description}}
-          end
-
-        {outputs, _} ->
-          description = """
-          Failed to analyze the inline python code: #{outputs}
-          """
-
-          {:error, {CompileError, file: __CALLER__.file, line: __CALLER__.line, description: description}}
-      end
-    end
-
-    globals =
-      case get_globals.(embedded_python3_executable) do
-        {:error, {CompileError, reason}} ->
-          case reason[:description] do
-            "Failed to analyze" <> _ ->
-              # Retry with the python3 executable from the host
-              # as we can't use the python3 executable from the embedded python when cross-compiling
-              case get_globals.(System.find_executable("python3")) do
-                {:error, {CompileError, reason}} -> raise CompileError, reason
-                {:ok, globals} -> globals
-              end
-
-            _ ->
-              raise CompileError, reason
-          end
-
-        {:ok, globals} ->
-          globals
+    {globals, opts} =
+      case Pythonx.Symtable.analyze(code) do
+        {:ok, analysis} ->
+          {Macro.escape(Map.new(analysis.globals, fn global -> {global, true} end)),
+           opts ++ [bytecode: {analysis.magic, analysis.bytecode}]}
+
+        {:error, {:analyzer, reason}} ->
+          raise CompileError,
+            file: __CALLER__.file,
+            line: __CALLER__.line,
+            description: "Failed to analyze the inline python code: #{reason}"
+
+        {:error, %{"error" => error, "lineno" => lineno, "offset" => offset}} ->
+          line = __CALLER__.line + (lineno || 0)
+
+          raise CompileError,
+            file: __CALLER__.file,
+            line: line,
+            description: "The inline Python code contains syntax errors: #{error} at line #{line}, column #{offset}"
       end
 
     quote do
@@ -166,39 +101,103 @@ defmodule Pythonx do
   ```
 
   It's also expected that this function to be called only once, and it must be called before any other function.
+
+  `python_home` can be omitted to use the embedded python, in which case the options can be given
+  as the only argument.
+
+  ## Options
+
+    * `:preload` - a list of module names to import right after the interpreter starts,
+      so that the first call using them does not pay for the import.
+
+    * `:precompile` - a list of python snippets to compile right after the interpreter starts.
+      Later calls to `inline/2` with exactly the same code reuse the compiled code object.
+
+    * `:allocator` - the allocator used by the interpreter, one of `:default`, `:counting` or `:enif`.
+      `:counting` keeps the default allocators but counts the bytes and blocks held by each domain,
+      `:enif` also allocates through `enif_alloc/1` so that the memory used by Python is part of
+      `:erlang.memory/0`. See `Pythonx.Memory`. Can only be set the first time Python is initialized.
+      Defaults to `:default`.
+
+  The time spent in each phase is available from `startup_report/0`.
   """
-  def initialize(python_home) do
-    unless Pythonx.Nif.nif_loaded() do
-      Pythonx.Nif.load_nif({:custom, python_home})
-    end
+  def initialize(python_home_or_opts \\ [])
+
+  def initialize(opts) when is_list(opts), do: do_initialize(:embedded, python_home(), opts)
+  def initialize(python_home) when is_binary(python_home), do: initialize(python_home, [])
 
-    Pythonx.Nif.initialize(python_home)
+  def initialize(python_home, opts) when is_binary(python_home) and is_list(opts) do
+    do_initialize({:custom, python_home}, python_home, opts)
   end
 
-  def initialize do
-    unless Pythonx.Nif.nif_loaded() do
-      Pythonx.Nif.load_nif(:embedded)
-    end
+  @doc """
+  Same as `initialize/2`, but does nothing if the NIF is already loaded.
+  """
+  def initialize_once(python_home_or_opts \\ [])
 
-    Pythonx.Nif.initialize(python_home())
+  def initialize_once(opts) when is_list(opts) do
+    unless Pythonx.Nif.nif_loaded(), do: do_initialize(:embedded, python_home(), opts)
+    :ok
   end
 
-  def initialize_once(python_home) do
-    unless Pythonx.Nif.nif_loaded() do
-      Pythonx.Nif.load_nif({:custom, python_home})
-      Pythonx.Nif.initialize(python_home)
-    end
+  def initialize_once(python_home) when is_binary(python_home), do: initialize_once(python_home, [])
 
+  def initialize_once(python_home, opts) when is_binary(python_home) and is_list(opts) do
+    unless Pythonx.Nif.nif_loaded(), do: do_initialize({:custom, python_home}, python_home, opts)
     :ok
   end
 
-  def initialize_once do
-    unless Pythonx.Nif.nif_loaded() do
-      Pythonx.Nif.load_nif(:embedded)
-      Pythonx.Nif.initialize(python_home())
+  defp do_initialize(with_python, python_home, opts) do
+    opts = Keyword.validate!(opts, preload: [], precompile: [], allocator: :default)
+
+    {load_nif, _} =
+      :timer.tc(fn ->
+        unless Pythonx.Nif.nif_loaded() do
+          Pythonx.Nif.load_nif(with_python)
+        end
+      end)
+
+    with :ok <- Pythonx.Nif.initialize(python_home, opts[:allocator]),
+         {:ok, imports} <- warmup(opts[:preload], &Pythonx.Nif.preload_module/1),
+         {:ok, precompiled} <- warmup(opts[:precompile], &Pythonx.Nif.precompile/1) do
+      report =
+        Map.merge(Pythonx.Nif.init_timings(), %{
+          load_nif: load_nif,
+          imports: imports,
+          precompile: precompiled
+        })
+
+      :persistent_term.put({__MODULE__, :startup_report}, report)
+      :ok
     end
+  end
 
-    :ok
+  defp warmup(items, fun) do
+    Enum.reduce_while(items, {:ok, []}, fn item, {:ok, acc} ->
+      case fun.(item) do
+        {:ok, elapsed} -> {:cont, {:ok, [{item, elapsed} | acc]}}
+        error -> {:halt, {:error, {item, error}}}
+      end
+    end)
+    |> case do
+      {:ok, acc} -> {:ok, Enum.reverse(acc)}
+      error -> error
+    end
+  end
+
+  @doc """
+  Returns the time spent in each phase of the last `initialize/2` call, in microseconds.
+
+    * `:load_nif` - loading the NIF library, `0` if it was already loaded;
+    * `:dlopen` - loading libpython, `nil` on platforms where it is linked to the NIF;
+    * `:init` - starting the interpreter;
+    * `:imports` - a list of `{module, time}` for each module in the `:preload` option;
+    * `:precompile` - a list of `{code, time}` for each snippet in the `:precompile` option.
+
+  Returns `nil` if Python has not been initialized yet.
+  """
+  def startup_report do
+    :persistent_term.get({__MODULE__, :startup_report}, nil)
   end
 
   def finalize do
@@ -268,10 +267,7 @@ defmodule Pythonx do
   end
 
   def eval(code, opts \\ []) do
-    vars = opts[:return] || []
-    locals = opts[:locals] || false
-    globals = opts[:globals] || false
-    Pythonx.Nif.inline(code, vars, locals, globals, [])
+    Pythonx.inline(code, Keyword.take(opts, [:return, :locals, :globals]))
   end
 
   def eval!(code, opts \\ []) do
@@ -281,14 +277,84 @@ defmodule Pythonx do
     end
   end
 
+  @doc """
+  Executes the given python code.
+
+  ## Options
+
+    * `:return` - names of the local variables to return. Defaults to `[]`.
+
+    * `:locals` - whether to also return all local variables. Defaults to `false`.
+
+    * `:globals` - whether to also return all global variables. Defaults to `false`.
+
+    * `:elixir_vars` - a keyword list of Elixir values to bind as local variables before running the code.
+
+    * `:bytecode` - a `{magic, bytecode}` tuple with `code` already compiled to a marshalled
+      code object, as returned by `Pythonx.Symtable.analyze/1`. It is used instead of compiling
+      `code` when `magic` matches the running interpreter, otherwise `code` is compiled as usual.
+
+    * `:memory_limit` - the number of bytes the interpreter may take while running `code`,
+      or `:infinity`. Allocations over the limit raise `MemoryError` in Python, and the call
+      returns `{:error, %Pythonx.MemoryLimitError{}}`. Needs Python to be initialized with the
+      `:counting` or `:enif` allocator, see `Pythonx.Memory`. Memory allocated by other Python
+      threads while `code` runs is charged to the call as well.
+
+  When `:locals`, `:globals` or `:memory_limit` is given, the result is a `{values, metadata}` tuple.
+  `metadata` has the `:locals` and `:globals` requested, and with `:memory_limit`, a `:memory` map with
+  the `:peak_bytes` the interpreter took on top of what it held before the call.
+
+  ## Telemetry
+
+  Each call is wrapped in a `[:pythonx, :inline]` span, see `:telemetry.span/3`.
+  The start event has the `:code` in its metadata. The stop event adds the time spent in
+  each phase to the `:duration` measurement, all in `:native` units:
+
+    * `:mutex_wait` - waiting for the interpreter;
+    * `:inject` - converting and binding the `:elixir_vars`;
+    * `:compile` - compiling the code, or loading its bytecode;
+    * `:execute` - running the code;
+    * `:convert` - converting the values returned.
+
+  It also measures the `:code_bytes` compiled or loaded, the number of values `:injected`
+  and `:returned`. The stop metadata has the `:code`, where it was `:compiled_from`
+  (`:bytecode`, `:precompiled` or `:source`), and the type name of the Python exception
+  raised as `:error`, or `nil`.
+  """
   def inline(code, opts \\ []) do
     vars = opts[:return] || []
     locals = opts[:locals] || false
     globals = opts[:globals] || false
     elixir_vars = opts[:elixir_vars] || []
-    Pythonx.Nif.inline(code, vars, locals, globals, elixir_vars)
+    memory_limit = opts[:memory_limit]
+
+    :telemetry.span([:pythonx, :inline], %{code: code}, fn ->
+      {result, stats} =
+        case opts[:bytecode] do
+          {magic, bytecode} ->
+            Pythonx.Nif.inline_bytecode(code, magic, bytecode, vars, locals, globals, elixir_vars, memory_limit)
+
+          nil ->
+            Pythonx.Nif.inline(code, vars, locals, globals, elixir_vars, memory_limit)
+        end
+
+      measurements = %{
+        mutex_wait: native_time(stats.mutex_wait),
+        inject: native_time(stats.inject),
+        compile: native_time(stats.compile),
+        execute: native_time(stats.execute),
+        convert: native_time(stats.convert),
+        code_bytes: stats.code_bytes,
+        injected: stats.injected,
+        returned: stats.returned
+      }
+
+      {result, measurements, %{code: code, compiled_from: stats.compiled_from, error: stats.error}}
+    end)
   end
 
+  defp native_time(nanoseconds), do: System.convert_time_unit(nanoseconds, :nanosecond, :native)
+
   def inline!(code, opts \\ []) do
     case Pythonx.inline(code, opts) do
       {:ok, result} -> result
@@ -0,0 +1,65 @@
+defmodule Pythonx.Arena do
+  @moduledoc """
+  Scopes for `Pythonx.Handle` handles that are released in one call.
+
+  Handles created in an arena, or adopted by it, are all released by
+  `release/1`, which takes one lock and drops every reference at once. This
+  makes it possible to reclaim the Python memory used by request-scoped work
+  at a known point, instead of whenever the BEAM garbage collector runs.
+
+      Pythonx.Arena.run(fn arena ->
+        a = Pythonx.Handle.from_long(20, arena)
+        b = Pythonx.Handle.from_long(22, arena)
+        Pythonx.Handle.as_long(Pythonx.Handle.number(:add, a, b, arena))
+      end)
+      #=> 42
+
+  Using a handle after its arena is released raises `ArgumentError`. An arena
+  that is garbage collected releases the handles it still holds, their objects
+  are dropped by the next call that takes the interpreter.
+  """
+
+  @type t :: reference()
+
+  @doc """
+  Creates an empty arena.
+  """
+  @spec new() :: t()
+  def new, do: Pythonx.Nif.arena_new()
+
+  @doc """
+  Calls `fun` with a new arena, and releases the arena when `fun` returns or raises.
+  """
+  @spec run((t() -> result)) :: result when result: var
+  def run(fun) when is_function(fun, 1) do
+    arena = new()
+
+    try do
+      fun.(arena)
+    after
+      release(arena)
+    end
+  end
+
+  @doc """
+  Moves handles created outside of the arena into it.
+
+  Raises `ArgumentError` if any of the handles was already released.
+  """
+  @spec adopt(t(), [Pythonx.Handle.t()]) :: :ok
+  def adopt(arena, handles) when is_reference(arena) and is_list(handles), do: Pythonx.Nif.arena_adopt(arena, handles)
+
+  @doc """
+  Releases every handle in the arena, and returns how many were released.
+
+  The arena is empty afterwards and can be reused.
+  """
+  @spec release(t()) :: non_neg_integer()
+  def release(arena) when is_reference(arena), do: Pythonx.Nif.arena_release(arena)
+
+  @doc """
+  Returns the number of live handles in the arena.
+  """
+  @spec size(t()) :: non_neg_integer()
+  def size(arena) when is_reference(arena), do: Pythonx.Nif.arena_size(arena)
+end
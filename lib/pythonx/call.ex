@@ -0,0 +1,60 @@
+defmodule Pythonx.Call do
+  @moduledoc """
+  Calls Python callables and methods without going through Python source.
+
+      sorted = Pythonx.C.PyDict.get_item_string(Pythonx.C.PyEval.get_builtins(), "sorted")
+      Pythonx.Call.call(sorted, [[3, 1, 2]], reverse: true)
+      #=> [3, 2, 1]
+
+      Pythonx.Call.method(string, :split, [","], maxsplit: 1)
+      #=> ["a", "b,c"]
+
+  The target is a `Pythonx.C` reference or a `Pythonx.Handle`. Arguments are
+  `Pythonx.C` references, `{:handle, handle}` tuples, or terms, which are
+  converted like the results of `Pythonx.C.PyObject` functions are decoded.
+  Keyword arguments are a keyword list or a map with atom or string keys.
+
+  Arguments are passed with the vectorcall protocol, without building an
+  argument tuple or a keyword dict, and method and keyword names are interned
+  once. Calls take the interpreter lock, and are reported as `:call` by
+  `Pythonx.LockProfiler`.
+  """
+
+  alias Pythonx.C.PyErr
+  alias Pythonx.C.PyObject, as: CPyObject
+
+  @type target :: CPyObject.t() | Pythonx.Handle.t()
+  @type arg :: CPyObject.t() | {:handle, Pythonx.Handle.t()} | term()
+  @type kwargs :: keyword() | %{optional(atom() | String.t()) => arg()}
+
+  @doc """
+  Calls `callable` with positional `args` and keyword `kwargs`.
+
+  ## Options
+
+    * `:into` - `:term` to decode the result, the default, `:handle` to return a
+      handle to it, or `:ref` to return a `Pythonx.C` reference.
+    * `:arena` - the `Pythonx.Arena` of the handle, when `into: :handle`.
+
+  Returns the result, or the Python exception raised by the call.
+  """
+  @spec call(target(), [arg()], kwargs(), keyword()) :: term() | PyErr.t()
+  def call(callable, args \\ [], kwargs \\ [], opts \\ []) when is_list(args) do
+    run(callable, nil, args, kwargs, opts)
+  end
+
+  @doc """
+  Calls the method `name` of `object`, see `call/4` for the options.
+  """
+  @spec method(target(), atom() | String.t(), [arg()], kwargs(), keyword()) :: term() | PyErr.t()
+  def method(object, name, args \\ [], kwargs \\ [], opts \\ [])
+      when (is_atom(name) or is_binary(name)) and is_list(args) do
+    run(object, name, args, kwargs, opts)
+  end
+
+  defp run(target, name, args, kwargs, opts) do
+    into = Keyword.get(opts, :into, :term)
+    arena = Keyword.get(opts, :arena)
+    Pythonx.Nif.call(target, name, args, kwargs, into, arena)
+  end
+end
@@ -0,0 +1,122 @@
+defmodule Pythonx.Census do
+  @moduledoc """
+  Census of the Python objects referenced from the BEAM.
+
+  Every `Pythonx.C` reference keeps its Python object alive until the
+  reference is garbage collected. References that are kept around, in ETS or
+  in the state of a long-lived process, keep growing Python memory without
+  any trace on the Python side. `count/0` tells how many references are alive.
+  Once enabled, the census lists the objects behind the references created
+  from then on by type:
+
+      Pythonx.Census.enable()
+      # ...
+      Pythonx.Census.top(5)
+      #=> [%{type: "dict", count: 10_240, bytes: 2_375_680, sites: %{nil => 10_240}}, ...]
+
+  Comparing two censuses taken some time apart shows which types leak. To find
+  who creates them, tag the references made by a process:
+
+      Pythonx.Census.with_tag(:importer, fn -> import_batch() end)
+
+  The counts of every type are then split by tag in `:sites`, with tags as
+  strings, and references created by untagged processes counted under `nil`.
+
+  References to objects that were borrowed from another object are counted
+  under the type `"(borrowed)"`, their objects may be gone already.
+
+  While enabled, creating and collecting a reference takes a lock shared by all
+  schedulers, so keep the census disabled outside of an investigation.
+  """
+
+  @type tag :: String.t() | nil
+
+  @type entry :: %{
+          type: String.t(),
+          count: pos_integer(),
+          bytes: non_neg_integer() | nil,
+          sites: %{tag() => pos_integer()}
+        }
+
+  @doc """
+  Returns the number of live references.
+
+  This is cheap enough to be polled by a metrics reporter.
+  """
+  @spec count() :: non_neg_integer()
+  def count, do: Pythonx.Nif.census_count()
+
+  @doc """
+  Starts recording the references created from now on, returns whether it was enabled.
+  """
+  @spec enable() :: boolean()
+  def enable, do: Pythonx.Nif.census_set_enabled(true)
+
+  @doc """
+  Stops recording references and forgets the recorded ones, returns whether it was enabled.
+  """
+  @spec disable() :: boolean()
+  def disable, do: Pythonx.Nif.census_set_enabled(false)
+
+  @doc """
+  Returns the live references recorded since `enable/0`, grouped by the type name of their objects.
+
+  ## Options
+
+    * `:sizes` - whether to add up the `:bytes` of the objects of each type with
+      `sys.getsizeof`, which only counts the object itself and not the objects it
+      refers to. It calls into Python once per object. Defaults to `true`.
+    * `:sort_by` - `:count` or `:bytes`. Defaults to `:count`.
+
+  The census takes the interpreter, and waits for the call running in it.
+  Returns an error while the census is disabled.
+  """
+  @spec take(keyword()) :: [entry()] | {:error, String.t()}
+  def take(opts \\ []) do
+    sizes = Keyword.get(opts, :sizes, true)
+    sort_by = Keyword.get(opts, :sort_by, :count)
+
+    unless sort_by in [:count, :bytes] do
+      raise ArgumentError, "expected :sort_by to be :count or :bytes, got: #{inspect(sort_by)}"
+    end
+
+    case Pythonx.Nif.census(sizes or sort_by == :bytes) do
+      entries when is_list(entries) and sort_by == :bytes -> Enum.sort_by(entries, &(&1.bytes || 0), :desc)
+      result -> result
+    end
+  end
+
+  @doc """
+  Returns the `n` types with the most live references, see `take/1` for the options.
+  """
+  @spec top(pos_integer(), keyword()) :: [entry()] | {:error, String.t()}
+  def top(n, opts \\ []) when is_integer(n) and n > 0 do
+    case take(opts) do
+      entries when is_list(entries) -> Enum.take(entries, n)
+      error -> error
+    end
+  end
+
+  @doc """
+  Tags the references created by the calling process from now on, `nil` removes the tag.
+
+  Returns the previous tag. Prefer `with_tag/2`, which removes the tag again. The tag of a
+  process that exits is forgotten.
+  """
+  @spec tag(atom() | String.t() | nil) :: tag()
+  def tag(tag) when is_atom(tag) or is_binary(tag), do: Pythonx.Nif.census_tag(tag)
+
+  @doc """
+  Runs `fun` with the references created by the calling process tagged with `tag`.
+  """
+  @spec with_tag(atom() | String.t(), (-> result)) :: result when result: var
+  def with_tag(tag, fun) when (is_atom(tag) or is_binary(tag)) and is_function(fun, 0) do
+    previous = tag(tag)
+
+    try do
+      fun.()
+    after
+      tag(previous)
+    end
+  end
+end
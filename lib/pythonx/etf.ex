@@ -0,0 +1,51 @@
+defmodule Pythonx.ETF do
+  @moduledoc """
+  Serializes Python objects to and from the Erlang External Term Format.
+
+  Unlike decoding a Python object to BEAM terms and then calling
+  `:erlang.term_to_binary/1`, `encode/1` writes the ETF binary directly
+  from the Python object graph in one pass, without building the
+  intermediate terms on the process heap.
+
+  The type mapping follows `Pythonx.inline/2`:
+
+  | Python                   | Elixir                  |
+  |--------------------------|-------------------------|
+  | `None`, `True`, `False`  | `nil`, `true`, `false`  |
+  | `int`                    | `integer()`             |
+  | `float`                  | `float()`               |
+  | `str`                    | `String.t()`            |
+  | `list`                   | `list()`                |
+  | `tuple`                  | `tuple()`               |
+  | `dict`                   | `map()`                 |
+
+  Objects of any other type are encoded as `nil`, except in dict keys, where
+  two of them would collide. When decoding, atoms other than `nil`, `true`
+  and `false` become Python strings.
+  """
+
+  alias Pythonx.Beam.PyObject
+  alias Pythonx.C.PyErr
+  alias Pythonx.C.PyObject, as: CPyObject
+
+  @doc """
+  Encodes the Python object to an ETF binary that can be passed to `:erlang.binary_to_term/1`.
+
+  Returns `PyErr` with a `TypeError` if a dict key is, or contains, an object of a type
+  that is not in the table above.
+  """
+  @spec encode(CPyObject.t() | PyObject.t()) :: binary() | PyErr.t() | :error
+  def encode(%PyObject{ref: ref}), do: encode(ref)
+  def encode(ref) when is_reference(ref), do: Pythonx.Nif.etf_encode(ref)
+
+  @doc """
+  Decodes an ETF binary, as produced by `:erlang.term_to_binary/1`, into a Python object.
+
+  Returns `PyErr` with a `ValueError` if the binary is malformed or contains terms
+  that have no Python equivalent, such as pids, references, funs or improper lists.
+
+  Return value: New reference.
+  """
+  @spec decode(binary()) :: CPyObject.t() | PyErr.t()
+  def decode(binary) when is_binary(binary), do: Pythonx.Nif.etf_decode(binary)
+end
@@ -0,0 +1,125 @@
+defmodule Pythonx.GC do
+  @moduledoc """
+  Control of Python's cyclic garbage collector.
+
+  Reference counting frees most objects as soon as they are unused. The cyclic
+  collector only looks for unreachable reference cycles, but it runs whenever
+  enough objects have been allocated, which may be in the middle of a latency
+  sensitive call. The functions in this module move these pauses to points of
+  our choosing:
+
+      # keep everything loaded so far out of future collections
+      Pythonx.GC.freeze()
+
+      # no collections while running a batch, one collection afterwards
+      Pythonx.GC.without_gc(fn -> run_batch() end)
+      Pythonx.GC.collect()
+
+  Every collection is timed from the moment Python is initialized, see `stats/0`.
+
+  Apart from `reset_stats/0`, these functions take the interpreter, and wait
+  for the call running in it, like `Pythonx.inline/2` does.
+  """
+
+  alias Pythonx.C.PyErr
+
+  @type generation_stats :: %{
+          collections: non_neg_integer(),
+          collected: non_neg_integer(),
+          uncollectable: non_neg_integer(),
+          pause_us: non_neg_integer(),
+          max_pause_us: non_neg_integer()
+        }
+
+  @type stats :: %{
+          enabled: boolean(),
+          frozen: non_neg_integer(),
+          generations: [generation_stats()],
+          pauses: [{pos_integer() | :infinity, non_neg_integer()}]
+        }
+
+  @doc """
+  Runs a collection of the given generation, and all younger ones.
+
+  Returns the number of unreachable objects found.
+  """
+  @spec collect(0..2) :: non_neg_integer() | PyErr.t()
+  def collect(generation \\ 2) when generation in 0..2, do: Pythonx.Nif.gc_collect(generation)
+
+  @doc """
+  Enables automatic collection. Returns whether it was enabled before.
+  """
+  @spec enable() :: boolean() | PyErr.t()
+  def enable, do: Pythonx.Nif.gc_set_enabled(true)
+
+  @doc """
+  Disables automatic collection. Returns whether it was enabled before.
+
+  `collect/1` still works while automatic collection is disabled.
+  """
+  @spec disable() :: boolean() | PyErr.t()
+  def disable, do: Pythonx.Nif.gc_set_enabled(false)
+
+  @doc """
+  Runs `fun` with automatic collection disabled, and restores the previous state afterwards.
+  """
+  @spec without_gc((-> result)) :: result when result: var
+  def without_gc(fun) when is_function(fun, 0) do
+    was_enabled = disable()
+
+    try do
+      fun.()
+    after
+      if was_enabled == true, do: enable()
+    end
+  end
+
+  @doc """
+  Returns the collection thresholds of the three generations.
+  """
+  @spec threshold() :: {non_neg_integer(), non_neg_integer(), non_neg_integer()} | PyErr.t()
+  def threshold, do: Pythonx.Nif.gc_get_threshold()
+
+  @doc """
+  Sets the collection thresholds, see Python's `gc.set_threshold`.
+
+  A generation 0 collection runs when allocations minus deallocations exceed `threshold0`.
+  Setting it to `0` disables automatic collection.
+  """
+  @spec set_threshold(non_neg_integer(), non_neg_integer(), non_neg_integer()) :: :ok | PyErr.t()
+  def set_threshold(threshold0, threshold1, threshold2)
+      when is_integer(threshold0) and is_integer(threshold1) and is_integer(threshold2),
+      do: Pythonx.Nif.gc_set_threshold(threshold0, threshold1, threshold2)
+
+  @doc """
+  Moves every object tracked by the collector to a permanent generation that is never collected.
+
+  Call it once the long-lived objects, such as imported modules, are loaded. Needs Python 3.7+.
+  """
+  @spec freeze() :: :ok | PyErr.t()
+  def freeze, do: Pythonx.Nif.gc_freeze()
+
+  @doc """
+  Moves the frozen objects back to the oldest generation.
+  """
+  @spec unfreeze() :: :ok | PyErr.t()
+  def unfreeze, do: Pythonx.Nif.gc_unfreeze()
+
+  @doc """
+  Returns the state of the collector and statistics about past collections.
+
+    * `:enabled` - whether automatic collection is enabled;
+    * `:frozen` - the number of objects in the permanent generation;
+    * `:generations` - for each generation, the number of `:collections`, the objects
+      `:collected` and `:uncollectable`, and the total and maximum pause in microseconds;
+    * `:pauses` - a histogram of all pauses, as `{upper_bound_us, count}` in powers of two.
+  """
+  @spec stats() :: stats() | PyErr.t()
+  def stats, do: Pythonx.Nif.gc_stats()
+
+  @doc """
+  Resets the statistics returned by `stats/0`.
+  """
+  @spec reset_stats() :: :ok
+  def reset_stats, do: Pythonx.Nif.gc_stats_reset()
+end
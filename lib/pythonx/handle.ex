@@ -0,0 +1,136 @@
+defmodule Pythonx.Handle do
+  @moduledoc """
+  Integer handles to Python objects.
+
+  Every `Pythonx.C` function returns a NIF resource per Python object, which
+  costs an allocation when it is created and is only released when the BEAM
+  garbage collector finds it. Handles are an alternative for tight loops:
+  objects are kept in a slab of slots and addressed by a plain integer, so
+  creating one allocates nothing on the BEAM side, and slots are recycled as
+  soon as `release/1` is called.
+
+  A handle encodes the index of its slot and the generation of the slot.
+  Releasing a slot bumps its generation, so passing a released handle to any
+  function raises `ArgumentError` instead of reaching another object that now
+  lives in the same slot.
+
+  Handles are not garbage collected: every handle must be released with
+  `release/1`, or be created in a `Pythonx.Arena` that is released as a whole.
+  All handles are released when Python is finalized.
+
+  Functions that create handles take an optional arena as their last argument.
+  Apart from `count/0`, all functions take the interpreter, like `Pythonx.inline/2` does.
+  """
+
+  alias Pythonx.C.PyErr
+  alias Pythonx.C.PyObject, as: CPyObject
+
+  @type t :: non_neg_integer()
+  @type arena :: Pythonx.Arena.t() | nil
+
+  @type number_op ::
+          :add
+          | :subtract
+          | :multiply
+          | :matrix_multiply
+          | :floor_divide
+          | :true_divide
+          | :remainder
+          | :divmod
+          | :lshift
+          | :rshift
+          | :and
+          | :xor
+          | :or
+
+  @doc """
+  Returns a handle to the object referenced by `ref`.
+
+  The handle holds its own reference to the object.
+  """
+  @spec new(CPyObject.t(), arena()) :: t()
+  def new(ref, arena \\ nil) when is_reference(ref), do: Pythonx.Nif.handle_new(ref, arena)
+
+  @doc """
+  Returns a `Pythonx.C` reference to the object behind `handle`.
+
+  Return value: New reference.
+  """
+  @spec to_ref(t()) :: CPyObject.t()
+  def to_ref(handle) when is_integer(handle), do: Pythonx.Nif.handle_to_ref(handle)
+
+  @doc """
+  Releases the given handles at once.
+
+  Returns the number of handles that were released. Handles that were
+  already released are ignored.
+  """
+  @spec release(t() | [t()]) :: non_neg_integer()
+  def release(handles) when is_list(handles), do: Pythonx.Nif.handle_release(handles)
+  def release(handle) when is_integer(handle), do: Pythonx.Nif.handle_release([handle])
+
+  @doc """
+  Returns the number of live handles.
+  """
+  @spec count() :: non_neg_integer()
+  def count, do: Pythonx.Nif.handle_count()
+
+  @doc """
+  Returns a handle to a new Python integer.
+  """
+  @spec from_long(integer(), arena()) :: t() | PyErr.t()
+  def from_long(value, arena \\ nil) when is_integer(value), do: Pythonx.Nif.handle_from_long(value, arena)
+
+  @doc """
+  Returns the value of a Python integer.
+  """
+  @spec as_long(t()) :: integer() | PyErr.t()
+  def as_long(handle) when is_integer(handle), do: Pythonx.Nif.handle_as_long(handle)
+
+  @doc """
+  Applies a binary number protocol operation, named after its `Pythonx.C.PyNumber` function.
+
+  Returns a handle to the result.
+  """
+  @spec number(number_op(), t(), t(), arena()) :: t() | PyErr.t()
+  def number(op, h1, h2, arena \\ nil) when is_atom(op) and is_integer(h1) and is_integer(h2),
+    do: Pythonx.Nif.handle_number(op, h1, h2, arena)
+
+  @doc """
+  Returns a handle to a new list of the objects behind `handles`.
+
+  This is a single call in place of one `Pythonx.C.PyList.append/2` per item.
+  """
+  @spec list([t()], arena()) :: t() | PyErr.t()
+  def list(handles, arena \\ nil) when is_list(handles), do: Pythonx.Nif.handle_list(handles, arena)
+
+  @doc """
+  Returns a handle to a new tuple of the objects behind `handles`.
+  """
+  @spec tuple([t()], arena()) :: t() | PyErr.t()
+  def tuple(handles, arena \\ nil) when is_list(handles), do: Pythonx.Nif.handle_tuple(handles, arena)
+
+  @doc """
+  Returns a handle to a new dict of the given `{key, value}` handle pairs.
+
+  Later pairs replace earlier ones with an equal key.
+  """
+  @spec dict([{t(), t()}], arena()) :: t() | PyErr.t()
+  def dict(pairs, arena \\ nil) when is_list(pairs), do: Pythonx.Nif.handle_dict(pairs, arena)
+
+  @doc """
+  Returns new handles to the items of a list or a tuple, or to the
+  `{key, value}` pairs of a dict.
+  """
+  @spec items(t(), arena()) :: [t()] | [{t(), t()}] | PyErr.t()
+  def items(handle, arena \\ nil) when is_integer(handle), do: Pythonx.Nif.handle_items(handle, arena)
+
+  @doc """
+  Returns handles to the attributes `names` of the object behind `handle`, in order.
+
+  If any of the attributes cannot be read, returns the error and no handles.
+  """
+  @spec get_attrs(t(), [String.t()], arena()) :: [t()] | PyErr.t()
+  def get_attrs(handle, names, arena \\ nil) when is_integer(handle) and is_list(names),
+    do: Pythonx.Nif.handle_get_attrs(handle, names, arena)
+end
@@ -0,0 +1,155 @@
+defmodule Pythonx.Iter do
+  @moduledoc """
+  Walks Python iterables from Elixir in chunks.
+
+  Reading a Python collection element by element costs a NIF call, an item
+  lookup and a decode per element. `stream/2` instead iterates the object in
+  native code, and delivers its elements in chunks of decoded terms:
+
+      range = Pythonx.C.PyDict.get_item_string(Pythonx.C.PyEval.get_builtins(), "range")
+      numbers = Pythonx.Call.call(range, [1_000_000], [], into: :ref)
+      Pythonx.Iter.reduce(numbers, 0, &(&1 + &2))
+      #=> 499999500000
+
+  The iterable is a `Pythonx.C` reference or a `Pythonx.Handle`. Its elements
+  are decoded like the results of `Pythonx.C.PyObject` functions are.
+
+  A producer process reads the chunks, and sends each one straight to the
+  enumerating process. It stays at most `:max_ahead` chunks ahead, and reads
+  further as the chunks are acknowledged, so the memory held by a stream is
+  bounded by `:chunk_size` times `:max_ahead` elements. Each chunk is read
+  while holding the interpreter, and is reported as `:iter` by
+  `Pythonx.LockProfiler`.
+
+  ## Options
+
+    * `:chunk_size` - the number of elements read at once, defaults to `100`.
+    * `:max_ahead` - the number of chunks read before they are consumed, defaults to `2`.
+  """
+
+  alias Pythonx.C.PyErr
+  alias Pythonx.C.PyObject, as: CPyObject
+
+  @type iterable :: CPyObject.t() | Pythonx.Handle.t()
+
+  @doc """
+  Returns a stream of the elements of `iterable`.
+
+  The iterator is created when the stream is enumerated, raises `RuntimeError`
+  if the object is not iterable, or if the iterator raises an exception.
+  Halting the enumeration early stops the producer.
+  """
+  @spec stream(iterable(), keyword()) :: Enumerable.t()
+  def stream(iterable, opts \\ []) do
+    chunk_size = Keyword.get(opts, :chunk_size, 100)
+    max_ahead = Keyword.get(opts, :max_ahead, 2)
+
+    unless is_integer(chunk_size) and chunk_size > 0 do
+      raise ArgumentError, "expected :chunk_size to be a positive integer, got: #{inspect(chunk_size)}"
+    end
+
+    unless is_integer(max_ahead) and max_ahead > 0 do
+      raise ArgumentError, "expected :max_ahead to be a positive integer, got: #{inspect(max_ahead)}"
+    end
+
+    Stream.resource(
+      fn -> start(iterable, chunk_size, max_ahead) end,
+      &next/1,
+      &stop/1
+    )
+  end
+
+  @doc """
+  Applies `fun` to every element of `iterable`, see `stream/2` for the options.
+  """
+  @spec map(iterable(), (term() -> term()), keyword()) :: [term()]
+  def map(iterable, fun, opts \\ []) when is_function(fun, 1) do
+    iterable |> stream(opts) |> Enum.map(fun)
+  end
+
+  @doc """
+  Reduces the elements of `iterable` with `fun`, see `stream/2` for the options.
+  """
+  @spec reduce(iterable(), acc, (term(), acc -> acc), keyword()) :: acc when acc: term()
+  def reduce(iterable, acc, fun, opts \\ []) when is_function(fun, 2) do
+    iterable |> stream(opts) |> Enum.reduce(acc, fun)
+  end
+
+  defp start(iterable, chunk_size, max_ahead) do
+    case Pythonx.Nif.iter_new(iterable) do
+      %PyErr{} = error ->
+        raise RuntimeError, "cannot iterate the object: #{describe(error)}"
+
+      iterator ->
+        consumer = self()
+        ref = make_ref()
+
+        {pid, monitor} =
+          spawn_monitor(fn ->
+            consumer_monitor = Process.monitor(consumer)
+            produce(iterator, chunk_size, max_ahead, 0, consumer, ref, consumer_monitor)
+          end)
+
+        {ref, pid, monitor}
+    end
+  end
+
+  defp produce(iterator, chunk_size, max_ahead, in_flight, consumer, ref, consumer_monitor)
+       when in_flight < max_ahead do
+    case Pythonx.Nif.iter_send(iterator, chunk_size, consumer, ref) do
+      :ok -> produce(iterator, chunk_size, max_ahead, in_flight + 1, consumer, ref, consumer_monitor)
+      :done -> send(consumer, {ref, :done})
+      %PyErr{} = error -> send(consumer, {ref, {:error, error}})
+    end
+  end
+
+  defp produce(iterator, chunk_size, max_ahead, in_flight, consumer, ref, consumer_monitor) do
+    receive do
+      {^ref, :ack} ->
+        produce(iterator, chunk_size, max_ahead, in_flight - 1, consumer, ref, consumer_monitor)
+
+      {:DOWN, ^consumer_monitor, :process, _, _} ->
+        :ok
+    end
+  end
+
+  defp next({ref, pid, monitor} = state) do
+    receive do
+      {^ref, {:chunk, items}} ->
+        send(pid, {ref, :ack})
+        {items, state}
+
+      {^ref, :done} ->
+        {:halt, state}
+
+      {^ref, {:error, error}} ->
+        raise RuntimeError, "the iterator raised #{describe(error)}"
+
+      {:DOWN, ^monitor, :process, _, reason} ->
+        exit(reason)
+    end
+  end
+
+  defp stop({ref, pid, monitor}) do
+    Process.exit(pid, :kill)
+
+    # messages sent by the producer arrive before its DOWN
+    receive do
+      {:DOWN, ^monitor, :process, _, _} -> :ok
+    end
+
+    flush(ref)
+  end
+
+  defp flush(ref) do
+    receive do
+      {^ref, _} -> flush(ref)
+    after
+      0 -> :ok
+    end
+  end
+
+  defp describe(%PyErr{type: type, value: value}) do
+    "#{Pythonx.C.PyUnicode.as_utf8(CPyObject.repr(type))}: #{Pythonx.C.PyUnicode.as_utf8(CPyObject.str(value))}"
+  end
+end
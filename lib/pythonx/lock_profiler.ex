@@ -0,0 +1,97 @@
+defmodule Pythonx.LockProfiler do
+  @moduledoc """
+  Contention on the interpreter.
+
+  Calls that run Python code take a single mutex, so a slow call makes every
+  other caller queue. Each acquisition is recorded per call site: the time
+  spent waiting for the mutex tells queueing apart from execution, the time
+  spent holding it shows which callers keep the interpreter busy.
+
+  The sites, and the calls that take the mutex under each of them:
+
+    * `:initialize` and `:finalize` - `Pythonx.initialize/2` and `Pythonx.finalize/0`.
+    * `:preload_module` and `:precompile` - the `:preload` and `:precompile`
+      options of `Pythonx.initialize/2`.
+    * `:inline` - `Pythonx.inline/2` and `Pythonx.eval/2`.
+    * `:pipeline` - `Pythonx.Pipeline.run/3`.
+    * `:call` - `Pythonx.Call.call/4` and `Pythonx.Call.method/5`.
+    * `:iter` - the producers of `Pythonx.Iter`.
+    * `:pickle` - `Pythonx.Pickle.dumps/1` and `Pythonx.Pickle.loads/2`.
+    * `:arena` - `Pythonx.Arena.release/1`.
+    * `:gc` - `Pythonx.GC`, except `stats/0` and `reset_stats/0`.
+    * `:profiler` - `Pythonx.Profiler.start/1` and `Pythonx.Profiler.stop/0`.
+    * `:census` - `Pythonx.Census.take/1`.
+    * `:vector` - `Pythonx.Vector.number/4`, when it falls back to Python or
+      returns a handle.
+    * `:handle` - `Pythonx.Handle`, except `count/0`.
+    * `:output` - `Pythonx.Output.capture/1` and `Pythonx.Output.release/0`.
+    * `:etf` - `Pythonx.ETF.encode/1` and `Pythonx.ETF.decode/1`.
+
+  Not every call takes the mutex, so this is not all the queueing for the
+  interpreter. The functions of `Pythonx.C` call the C API directly and only
+  hold the GIL, and the calls that read native state do not lock at all:
+  `Pythonx.Output.flush/0` and `Pythonx.Output.ack/2`, `Pythonx.Handle.count/0`,
+  `Pythonx.Arena.new/0`, `Pythonx.Arena.adopt/2` and `Pythonx.Arena.size/1`,
+  `Pythonx.Census.count/0`, `Pythonx.Census.tag/1`, `Pythonx.Census.enable/0`
+  and `Pythonx.Census.disable/0`, and the readers of statistics such as
+  `stats/0` here. None of them is recorded.
+
+  The profile is always collected, at the cost of two clock reads per call.
+  """
+
+  @type site ::
+          :initialize
+          | :inline
+          | :preload_module
+          | :precompile
+          | :finalize
+          | :pipeline
+          | :call
+          | :iter
+          | :pickle
+          | :arena
+          | :gc
+          | :profiler
+          | :census
+          | :vector
+          | :handle
+          | :output
+          | :etf
+
+  @type histogram :: [{pos_integer() | :infinity, pos_integer()}]
+
+  @type site_stats :: %{
+          acquisitions: non_neg_integer(),
+          wait_ns: non_neg_integer(),
+          hold_ns: non_neg_integer(),
+          max_wait_ns: non_neg_integer(),
+          max_hold_ns: non_neg_integer(),
+          wait_histogram: histogram(),
+          hold_histogram: histogram()
+        }
+
+  @type stats :: %{
+          waiting: non_neg_integer(),
+          max_queue_depth: non_neg_integer(),
+          sites: %{site() => site_stats()}
+        }
+
+  @doc """
+  Returns the contention profile since the last `reset/0`.
+
+    * `:waiting` - the number of callers waiting for the interpreter right now;
+    * `:max_queue_depth` - the most callers ever waiting at once;
+    * `:sites` - for each call site, the number of `:acquisitions`, the total and maximum
+      time spent waiting for and holding the mutex, in nanoseconds, and histograms of both.
+      The histograms are lists of `{upper_bound_ns, count}` with power-of-two bounds,
+      empty buckets are left out.
+  """
+  @spec stats() :: stats()
+  def stats, do: Pythonx.Nif.lock_stats()
+
+  @doc """
+  Clears the profile.
+  """
+  @spec reset() :: :ok
+  def reset, do: Pythonx.Nif.lock_stats_reset()
+end
@@ -0,0 +1,59 @@
+defmodule Pythonx.Memory do
+  @moduledoc """
+  Memory used by the Python interpreter.
+
+  The statistics are only collected when Python is initialized with the
+  `:allocator` option set to `:counting` or `:enif`:
+
+      Pythonx.initialize(allocator: :counting)
+
+  Every allocation then carries a 16-byte header recording its size, and
+  goes through an extra indirection, so allocation-heavy code runs slower.
+  """
+
+  @type domain_stats :: %{
+          bytes: integer(),
+          blocks: integer(),
+          peak_bytes: non_neg_integer(),
+          allocations: non_neg_integer()
+        }
+
+  @type stats :: %{
+          allocator: :counting | :enif,
+          raw: domain_stats(),
+          mem: domain_stats(),
+          obj: domain_stats(),
+          arenas: domain_stats()
+        }
+
+  @doc """
+  Returns the memory held by the interpreter, per allocator domain.
+
+    * `:raw` - `PyMem_RawMalloc`, used before Python is initialized, from threads that
+      do not hold the GIL, and for blocks larger than 512 bytes in the other domains;
+    * `:mem` - `PyMem_Malloc`, mostly buffers;
+    * `:obj` - `PyObject_Malloc`, Python objects;
+    * `:arenas` - the arenas pymalloc carves the small blocks of `:mem` and `:obj` out of.
+      Freed blocks go back to their arena, which is only released once it is empty.
+
+  Each domain reports the `:bytes` and `:blocks` currently allocated, the highest `:peak_bytes`
+  ever allocated and the total number of `:allocations`.
+
+  Returns `nil` when the interpreter runs with the default allocator.
+  """
+  @spec stats() :: stats() | nil
+  def stats, do: Pythonx.Nif.memory_stats()
+
+  @doc """
+  Returns the number of bytes currently allocated by the interpreter, `nil` with the default allocator.
+
+  Blocks of the `:mem` and `:obj` domains are already counted in either `:raw` or `:arenas`.
+  """
+  @spec total_bytes() :: non_neg_integer() | nil
+  def total_bytes do
+    case stats() do
+      nil -> nil
+      stats -> stats.raw.bytes + stats.arenas.bytes
+    end
+  end
+end
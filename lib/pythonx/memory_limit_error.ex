@@ -0,0 +1,17 @@
+defmodule Pythonx.MemoryLimitError do
+  @moduledoc """
+  Returned by `Pythonx.inline/2` when the code went over its `:memory_limit`.
+
+  `:peak_bytes` is the most the interpreter took during the call before the
+  allocation that was refused.
+  """
+
+  defexception [:limit, :peak_bytes]
+
+  @type t :: %__MODULE__{limit: non_neg_integer(), peak_bytes: non_neg_integer()}
+
+  @impl true
+  def message(%__MODULE__{limit: limit, peak_bytes: peak_bytes}) do
+    "python code went over its memory limit of #{limit} bytes, after taking #{peak_bytes} bytes"
+  end
+end
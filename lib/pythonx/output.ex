@@ -0,0 +1,111 @@
+defmodule Pythonx.Output do
+  @moduledoc """
+  Captures what Python writes to `sys.stdout` and `sys.stderr`.
+
+  Without a capture, `print` and the tracebacks printed when `Pythonx.inline/2`
+  fails go to the standard streams of the operating system process, past the
+  Logger. While a capture is active, both streams are replaced by writers that
+  buffer the output in a ring buffer, and a native thread sends it in batches
+  to a subscriber process:
+
+      {:ok, ref} = Pythonx.Output.capture()
+      Pythonx.inline("print('hello')")
+
+      receive do
+        {:pythonx_output, ^ref, bytes, chunks} ->
+          Pythonx.Output.ack(ref, bytes)
+          chunks
+      end
+      #=> [stdout: "hello\\n"]
+
+  A batch is a list of `{:stdout, binary}` and `{:stderr, binary}` chunks in the
+  order they were written, and `{:dropped, bytes}` for output that did not fit
+  in the buffer. The binaries of a stream are its UTF-8 encoded output, a
+  character may be split between two batches. A batch is sent once `:batch`
+  bytes are buffered, when a stream is flushed, at the end of every
+  `Pythonx.inline/2` call, and on `flush/0`.
+
+  Sent bytes keep their room in the buffer until the subscriber acknowledges
+  them with `ack/2`, which bounds the memory held by the messages in its
+  mailbox. When a write does not fit, what happens depends on `:when_full`.
+  Once the subscriber is gone, the output is discarded until `release/0`.
+
+  One capture is active at a time, for the lifetime of the interpreter.
+  """
+
+  @doc """
+  Replaces `sys.stdout` and `sys.stderr`, and returns the reference that tags the batches.
+
+  ## Options
+
+    * `:to` - the subscriber, defaults to the calling process.
+    * `:capacity` - the size of the buffer in bytes, defaults to `65536`.
+    * `:batch` - the number of buffered bytes that are sent without waiting for
+      a flush, defaults to `4096`.
+    * `:when_full` - `:drop` to drop the writes that do not fit, the default, or
+      `:block` to wait until the subscriber acknowledges enough output. Waiting
+      holds the interpreter, so the subscriber must be another process than the
+      caller, and must not run Python code itself. While such a capture is active,
+      every call that runs Python code moves to a dirty IO scheduler first, so
+      that a wait never stalls a normal scheduler.
+    * `:block_timeout` - how long a write waits in milliseconds, before what is
+      left of it is dropped, defaults to `5000`.
+  """
+  @spec capture(keyword()) :: {:ok, reference()} | {:error, String.t()}
+  def capture(opts \\ []) do
+    to = Keyword.get(opts, :to, self())
+    capacity = Keyword.get(opts, :capacity, 65536)
+    batch = Keyword.get(opts, :batch, 4096)
+    when_full = Keyword.get(opts, :when_full, :drop)
+    block_timeout = Keyword.get(opts, :block_timeout, 5000)
+
+    for {name, value} <- [capacity: capacity, batch: batch] do
+      unless is_integer(value) and value > 0 do
+        raise ArgumentError, "expected #{inspect(name)} to be a positive integer, got: #{inspect(value)}"
+      end
+    end
+
+    unless when_full in [:drop, :block] do
+      raise ArgumentError, "expected :when_full to be :drop or :block, got: #{inspect(when_full)}"
+    end
+
+    if when_full == :block and to == self() do
+      raise ArgumentError,
+            "expected :to to be another process with :when_full set to :block, " <>
+              "the caller cannot acknowledge output while Python waits for it"
+    end
+
+    unless is_integer(block_timeout) and block_timeout >= 0 do
+      raise ArgumentError, "expected :block_timeout to be a non-negative integer, got: #{inspect(block_timeout)}"
+    end
+
+    ref = make_ref()
+
+    case Pythonx.Nif.output_capture(to, ref, capacity, batch, when_full == :block, block_timeout) do
+      :ok -> {:ok, ref}
+      error -> error
+    end
+  end
+
+  @doc """
+  Puts back the original streams.
+
+  Returns once the buffered output has been sent.
+  """
+  @spec release() :: :ok | {:error, String.t()}
+  def release, do: Pythonx.Nif.output_release()
+
+  @doc """
+  Sends the buffered output without waiting for `:batch` bytes.
+  """
+  @spec flush() :: :ok
+  def flush, do: Pythonx.Nif.output_flush()
+
+  @doc """
+  Acknowledges the `bytes` of a batch, making room for further output.
+  """
+  @spec ack(reference(), non_neg_integer()) :: :ok
+  def ack(ref, bytes) when is_reference(ref) and is_integer(bytes) and bytes >= 0 do
+    Pythonx.Nif.output_ack(ref, bytes)
+  end
+end
@@ -0,0 +1,44 @@
+defmodule Pythonx.Pickle do
+  @moduledoc """
+  Transports Python objects as pickle protocol 5 payloads.
+
+  This is meant for objects that have no BEAM equivalent, for example models or
+  array-like objects, that need to be cached in ETS, written to disk or sent
+  to another node.
+
+  Objects that support out-of-band serialization (`pickle.PickleBuffer`) are
+  not copied into the pickle stream. Their buffers are returned separately as
+  binaries. Read-only buffers are returned as binaries that point directly into
+  the Python memory, writable ones are copied, so that later changes made by
+  Python do not show through. The buffers passed to `loads/2` are handed to
+  Python without copying them.
+  """
+
+  alias Pythonx.Beam.PyObject
+  alias Pythonx.C.PyErr
+  alias Pythonx.C.PyObject, as: CPyObject
+
+  @doc """
+  Pickles the object with protocol 5.
+
+  Returns `{data, buffers}`, where `data` is the pickle stream and `buffers`
+  is the list of out-of-band buffers, in the order expected by `loads/2`.
+
+  Both `data` and the buffers keep the underlying Python objects alive until
+  they are garbage collected by the VM.
+  """
+  @spec dumps(CPyObject.t() | PyObject.t()) :: {binary(), [binary()]} | PyErr.t()
+  def dumps(%PyObject{ref: ref}), do: dumps(ref)
+  def dumps(ref) when is_reference(ref), do: Pythonx.Nif.pickle_dumps(ref)
+
+  @doc """
+  Unpickles `data` with the given out-of-band `buffers`.
+
+  `data` can be any iodata. Each buffer is exposed to Python as a read-only
+  `memoryview` over the binary.
+
+  Return value: New reference.
+  """
+  @spec loads(iodata(), [binary()]) :: CPyObject.t() | PyErr.t()
+  def loads(data, buffers \\ []) when is_list(buffers), do: Pythonx.Nif.pickle_loads(data, buffers)
+end
@@ -0,0 +1,78 @@
+defmodule Pythonx.Pipeline do
+  @moduledoc """
+  Runs a batch of `Pythonx.C` operations in one call.
+
+  Every `Pythonx.C` function is a NIF call of its own, which resolves its
+  arguments and enters the interpreter again. A pipeline instead describes
+  the operations as a list of instructions over numbered registers, and runs
+  all of them while holding the interpreter once:
+
+      Pythonx.Pipeline.run(
+        [
+          {:load, 0, point},
+          {:object_get_attr_string, 1, 0, "x"},
+          {:object_get_attr_string, 2, 0, "y"},
+          {:number_multiply, 1, 1, 1},
+          {:number_multiply, 2, 2, 2},
+          {:number_add, 3, 1, 2}
+        ],
+        [{:term, 3}]
+      )
+      #=> {:ok, [25]}
+
+  Instructions are named after the `Pythonx.C` functions they stand for, with
+  the destination register first:
+
+    * `{:load, dst, handle_or_ref}` - a `Pythonx.Handle` or a `Pythonx.C` reference,
+      a released handle fails with a `ValueError`;
+    * `{:long, dst, integer}`, `{:float, dst, number}`, `{:unicode, dst, binary}`,
+      `{:bool, dst, boolean}`, `{:none, dst}` - new objects;
+    * `{:number_<op>, dst, a, b}` - any operation of `t:Pythonx.Handle.number_op/0`;
+    * `{:number_<op>, dst, a}` - `:negative`, `:positive`, `:absolute`, `:invert`,
+      `:long`, `:float` and `:index`;
+    * `{:object_get_attr_string, dst, obj, name}`, `{:object_set_attr_string, obj, name, value}`;
+    * `{:object_get_item, dst, obj, key}`, `{:object_set_item, obj, key, value}`;
+    * `{:object_length, dst, obj}`, `{:object_is_true, dst, obj}`, `{:object_str, dst, obj}`,
+      `{:object_repr, dst, obj}`;
+    * `{:object_call, dst, callable, [arg]}` - calls with positional arguments;
+    * `{:list_new, dst, size}` - a list of `size` Nones, `{:list_append, list, item}`,
+      `{:list_get_item, dst, list, index}`, `{:list_set_item, list, index, item}`,
+      `{:list_as_tuple, dst, list}`;
+    * `{:dict_new, dst}`, `{:dict_get_item, dst, dict, key}`, `{:dict_get_item_string, dst, dict, key}`,
+      `{:dict_set_item, dict, key, value}`, `{:dict_set_item_string, dict, key, value}` -
+      a missing key reads as None;
+    * `{:tuple_new, dst, [item]}`.
+
+  Writing a register replaces its previous object. Registers are numbered from
+  0 to 65535, and must be written before they are read.
+
+  The batch is checked before it runs: an unknown instruction, a wrong number of
+  operands or a register read before it is written raises `ArgumentError`, and no
+  instruction runs.
+  """
+
+  alias Pythonx.C.PyErr
+
+  @type register :: 0..65535
+  @type instruction :: tuple()
+  @type output :: register() | {:term, register()}
+
+  @doc """
+  Runs `instructions` and returns the registers selected by `outputs`.
+
+  Each output is either a register, which is returned as a new `Pythonx.Handle`
+  created in `arena`, or `{:term, register}`, which is converted to an Elixir term.
+
+  If an instruction fails, returns `{:error, index, error}`, where `index` is the
+  position of the instruction in the list, and the instructions after it are not
+  run. Changes made by the instructions before it are kept.
+  """
+  @spec run([instruction()], [output()], Pythonx.Handle.arena()) ::
+          {:ok, [Pythonx.Handle.t() | term()]} | {:error, non_neg_integer(), PyErr.t()}
+  def run(instructions, outputs, arena \\ nil) when is_list(instructions) and is_list(outputs) do
+    case Pythonx.Nif.pipeline(instructions, outputs, arena) do
+      results when is_list(results) -> {:ok, results}
+      {:error, index, error} -> {:error, index, error}
+    end
+  end
+end
@@ -0,0 +1,99 @@
+defmodule Pythonx.Profiler do
+  @moduledoc """
+  Sampling profiler for Python code.
+
+  While the profiler runs, the Python stack is sampled about once per
+  interval, and identical stacks are aggregated. The result is exported in the
+  collapsed stack format, one line per stack with its frames from the root
+  down, separated by `;`, followed by the number of samples:
+
+      :ok = Pythonx.Profiler.start(interval_us: 500)
+      Pythonx.inline(slow_code)
+      :ok = Pythonx.Profiler.stop()
+      File.write!("python.folded", Pythonx.Profiler.collapsed())
+
+  which can be read by `flamegraph.pl python.folded > python.svg`, speedscope
+  and most other flamegraph tools. Frames are labelled as
+  `function (filename:first line)`, code given to `Pythonx.inline/2` has the
+  filename `<string>`, and calls into C functions are the last frame of their stack.
+
+  Samples are taken at Python call and return events, weighted by the time
+  elapsed since the previous sample, so code that calls no function for
+  longer than an interval is charged to the next call or return. Running the
+  profiler slows down every Python function call.
+
+  Only one session can run at a time, its stacks are kept until the next `start/1`.
+  """
+
+  @type stats :: %{
+          running: boolean(),
+          interval_us: non_neg_integer(),
+          samples: non_neg_integer(),
+          truncated: non_neg_integer(),
+          collapsed: binary()
+        }
+
+  @doc """
+  Starts a new profiling session, discarding the previous one.
+
+  ## Options
+
+    * `:interval_us` - the sampling interval in microseconds. Defaults to `1000`.
+  """
+  @spec start(keyword()) :: :ok | {:error, String.t()}
+  def start(opts \\ []) do
+    interval_us = Keyword.get(opts, :interval_us, 1000)
+
+    unless is_integer(interval_us) and interval_us > 0 do
+      raise ArgumentError, "expected :interval_us to be a positive integer, got: #{inspect(interval_us)}"
+    end
+
+    Pythonx.Nif.profiler_start(interval_us)
+  end
+
+  @doc """
+  Stops the current session. Its stacks can still be exported.
+  """
+  @spec stop() :: :ok | {:error, String.t()}
+  def stop, do: Pythonx.Nif.profiler_stop()
+
+  @doc """
+  Returns the stacks of the current or last session in the collapsed format.
+  """
+  @spec collapsed() :: binary()
+  def collapsed, do: stats().collapsed
+
+  @doc """
+  Returns the current or last session.
+
+    * `:running` - whether the session is still running;
+    * `:interval_us` - the sampling interval;
+    * `:samples` - the number of samples taken;
+    * `:truncated` - the number of samples whose stack was deeper than 256 frames,
+      only the innermost frames of these are kept under a `[truncated]` root;
+    * `:collapsed` - the stacks in the collapsed format.
+  """
+  @spec stats() :: stats()
+  def stats, do: Pythonx.Nif.profiler_collapsed()
+
+  @doc """
+  Runs `fun` in a new profiling session, returns its result and the collapsed stacks.
+
+  Takes the same options as `start/1`.
+  """
+  @spec profile((-> result), keyword()) :: {result, binary()} when result: var
+  def profile(fun, opts \\ []) when is_function(fun, 0) do
+    with {:error, reason} <- start(opts) do
+      raise RuntimeError, reason
+    end
+
+    result =
+      try do
+        fun.()
+      after
+        stop()
+      end
+
+    {result, collapsed()}
+  end
+end
@@ -0,0 +1,399 @@
+defmodule Pythonx.Symtable do
+  @moduledoc """
+  Compile-time analysis of inline Python code.
+
+  `Pythonx.pyinline/2` needs to know which global names a snippet uses so that
+  only the matching Elixir variables are sent to Python. The analysis runs the
+  `symtable` module in a `python3` process.
+
+  The same process also compiles the snippet and returns the marshalled code
+  object, together with the bytecode magic number of the interpreter that
+  produced it, so that call sites can skip compiling the source at runtime.
+
+  To keep compilation fast:
+
+    * one long-lived analyzer process serves every snippet that is expanded
+      while it is alive, and it exits after being idle for a while. Snippets
+      are sent to it one at a time, as each call site is expanded, rather than
+      batched per module;
+
+    * results are cached on disk, keyed by the hash of the code and of the
+      interpreter that analyzed it, its path and bytecode magic number. Which
+      interpreter the analyzer runs is recorded next to the results, so that a
+      fully cached compilation never starts it. The cache lives in `symtable`
+      under `Pythonx.Nif.cache_dir/0` by default. It can be moved with
+      `config :pythonx, symtable_cache: "/path/to/dir"`, or turned off with
+      `config :pythonx, symtable_cache: false`.
+
+  An analyzer that does not answer within a minute is stopped, and the snippet
+  fails to compile.
+  """
+
+  use GenServer
+
+  # bump this whenever the analyzer script or the shape of its results changes
+  @analyzer_version 2
+  @idle_timeout 30_000
+  @reply_timeout 60_000
+  @max_line_length 65_536
+
+  @analyzer_script """
+  import base64
+  import importlib.util
+  import json
+  import marshal
+  import symtable
+  import sys
+
+  def gather_symbols(table):
+      globals_used = set()
+      for symbol in table.get_symbols():
+          if symbol.is_global():
+              globals_used.add(symbol.get_name())
+      for child in table.get_children():
+          globals_used.update(gather_symbols(child))
+      return globals_used
+
+  def analyze_code(code):
+      try:
+          sym_table = symtable.symtable(code, '<string>', 'exec')
+          bytecode = marshal.dumps(compile(code, '<string>', 'exec'))
+          return {
+              "status": "ok",
+              "globals": sorted(gather_symbols(sym_table)),
+              "bytecode": base64.b64encode(bytecode).decode("ascii"),
+              "magic": int.from_bytes(importlib.util.MAGIC_NUMBER, "little"),
+          }
+      except SyntaxError as e:
+          return {"status": "error", "error": e.msg, "lineno": e.lineno, "offset": e.offset}
+      except ValueError as e:
+          return {"status": "error", "error": str(e), "lineno": None, "offset": None}
+
+  for line in sys.stdin:
+      request = json.loads(line)
+      sys.stdout.write(json.dumps(analyze_code(request["code"])) + "\\n")
+      sys.stdout.flush()
+  """
+
+  @type analysis :: %{
+          globals: [String.t()],
+          bytecode: binary(),
+          magic: non_neg_integer()
+        }
+
+  @type result ::
+          {:ok, analysis()}
+          | {:error, %{required(String.t()) => term()}}
+          | {:error, {:analyzer, String.t()}}
+
+  @doc """
+  Returns the global names used by `code`, and `code` compiled to a marshalled code object.
+
+  `:magic` is the bytecode magic number of the interpreter that compiled the
+  code, as returned by `PyImport_GetMagicNumber()`. The bytecode can only be
+  executed by an interpreter with the same magic number.
+
+  On a syntax error, returns `{:error, info}` where `info` has the `"error"`,
+  `"lineno"` and `"offset"` keys reported by Python.
+  """
+  @spec analyze(String.t()) :: result()
+  def analyze(code) when is_binary(code) do
+    cache_dir = cache_dir()
+    identity = if cache_dir, do: analyzer_identity(cache_dir)
+
+    case read_cache(cache_dir, identity, code) do
+      nil ->
+        {identity, result} = call_analyzer(code)
+        write_cache(cache_dir, identity, code, result)
+        result
+
+      result ->
+        result
+    end
+  end
+
+  @doc """
+  Removes all cached analysis results.
+  """
+  @spec clear_cache() :: :ok
+  def clear_cache do
+    if dir = cache_dir(), do: File.rm_rf!(dir)
+    :ok
+  end
+
+  @doc false
+  def cache_dir do
+    case Application.get_env(:pythonx, :symtable_cache, true) do
+      false -> nil
+      true -> Path.join(Pythonx.Nif.cache_dir(), "symtable")
+      dir when is_binary(dir) -> dir
+    end
+  end
+
+  defp cache_path(dir, {executable, magic}, code) do
+    key = [Integer.to_string(@analyzer_version), 0, executable, 0, Integer.to_string(magic), 0, code]
+    hash = Base.encode16(:crypto.hash(:sha256, key), case: :lower)
+    Path.join(dir, "#{hash}.json")
+  end
+
+  defp read_cache(nil, _identity, _code), do: nil
+  defp read_cache(_dir, nil, _code), do: nil
+
+  defp read_cache(dir, identity, code) do
+    with {:ok, contents} <- File.read(cache_path(dir, identity, code)),
+         {:ok, decoded} <- Jason.decode(contents) do
+      to_result(decoded)
+    else
+      _ -> nil
+    end
+  end
+
+  defp write_cache(nil, _identity, _code, _result), do: :ok
+  defp write_cache(_dir, nil, _code, _result), do: :ok
+  defp write_cache(_dir, _identity, _code, {:error, {:analyzer, _}}), do: :ok
+
+  defp write_cache(dir, identity, code, result) do
+    encoded =
+      case result do
+        {:ok, analysis} ->
+          %{
+            "status" => "ok",
+            "globals" => analysis.globals,
+            "bytecode" => Base.encode64(analysis.bytecode),
+            "magic" => analysis.magic
+          }
+
+        {:error, info} -> Map.put(info, "status", "error")
+      end
+
+    write_file(dir, cache_path(dir, identity, code), Jason.encode!(encoded))
+  end
+
+  # writes through a temporary file, so that concurrent compilers never read a partial file
+  defp write_file(dir, path, contents) do
+    tmp = "#{path}.#{System.unique_integer([:positive])}.tmp"
+
+    with :ok <- File.mkdir_p(dir),
+         :ok <- File.write(tmp, contents),
+         :ok <- File.rename(tmp, path) do
+      :ok
+    else
+      _ ->
+        File.rm(tmp)
+        :ok
+    end
+  end
+
+  defp to_result(%{"status" => "ok", "globals" => globals, "bytecode" => bytecode, "magic" => magic}) do
+    case Base.decode64(bytecode) do
+      {:ok, bytecode} -> {:ok, %{globals: globals, bytecode: bytecode, magic: magic}}
+      :error -> nil
+    end
+  end
+
+  defp to_result(%{"status" => "error"} = info), do: {:error, Map.delete(info, "status")}
+  defp to_result(_), do: nil
+
+  defp start_analyzer do
+    case GenServer.start(__MODULE__, [], name: __MODULE__) do
+      {:ok, pid} -> {:ok, pid}
+      {:error, {:already_started, pid}} -> {:ok, pid}
+      {:error, reason} -> {:error, reason}
+    end
+  end
+
+  # `{executable, magic}` of the analyzer. Taken from the last analyzer started,
+  # or from the identity file it wrote as long as the interpreters it picks from
+  # are unchanged, and only otherwise by starting one.
+  defp analyzer_identity(cache_dir) do
+    with nil <- :persistent_term.get({__MODULE__, :identity}, nil),
+         nil <- read_identity(cache_dir) do
+      case start_analyzer() do
+        {:ok, _pid} -> :persistent_term.get({__MODULE__, :identity}, nil)
+        {:error, _} -> nil
+      end
+    else
+      identity ->
+        put_identity(identity)
+        identity
+    end
+  end
+
+  defp put_identity(identity) do
+    if :persistent_term.get({__MODULE__, :identity}, nil) != identity do
+      :persistent_term.put({__MODULE__, :identity}, identity)
+    end
+  end
+
+  defp identity_path(dir), do: Path.join(dir, "analyzer.json")
+
+  defp read_identity(dir) do
+    with {:ok, contents} <- File.read(identity_path(dir)),
+         {:ok, %{"version" => @analyzer_version, "candidates" => stamp, "executable" => executable, "magic" => magic}} <-
+           Jason.decode(contents),
+         true <- stamp == candidates_stamp() do
+      {executable, magic}
+    else
+      _ -> nil
+    end
+  end
+
+  defp write_identity(nil, _identity), do: :ok
+
+  defp write_identity(dir, {executable, magic}) do
+    encoded = %{
+      "version" => @analyzer_version,
+      "candidates" => candidates_stamp(),
+      "executable" => executable,
+      "magic" => magic
+    }
+
+    write_file(dir, identity_path(dir), Jason.encode!(encoded))
+  end
+
+  # the interpreters the analyzer picks from, in order
+  defp candidates do
+    python3_root = Pythonx.python_home()
+
+    [
+      {Path.join([python3_root, "bin", "python3"]), embedded_envs(python3_root)},
+      # the embedded python3 cannot run when cross-compiling, fall back to the host one
+      {System.find_executable("python3"), []}
+    ]
+  end
+
+  # changes whenever one of the candidates is installed, replaced or removed
+  defp candidates_stamp do
+    Enum.map(candidates(), fn {executable, _envs} ->
+      case executable && File.stat(executable, time: :posix) do
+        {:ok, %File.Stat{mtime: mtime, size: size}} -> [executable, mtime, size]
+        _ -> nil
+      end
+    end)
+  end
+
+  # returns the result with the identity of the analyzer that produced it
+  defp call_analyzer(code) do
+    case start_analyzer() do
+      {:error, reason} ->
+        {nil, {:error, {:analyzer, "cannot start the analyzer: #{inspect(reason)}"}}}
+
+      {:ok, pid} ->
+        GenServer.call(pid, {:analyze, code}, :infinity)
+    end
+  end
+
+  # ------- Analyzer process -------
+
+  @impl true
+  def init(_) do
+    Enum.reduce_while(candidates(), {:stop, :no_python3}, fn {executable, envs}, acc ->
+      case open_analyzer(executable, envs) do
+        {:ok, port, magic} ->
+          identity = {executable, magic}
+          # cached results are keyed by it, see analyzer_identity/1
+          put_identity(identity)
+          write_identity(cache_dir(), identity)
+
+          {:halt, {:ok, {port, identity}, @idle_timeout}}
+
+        :error ->
+          {:cont, acc}
+      end
+    end)
+  end
+
+  @impl true
+  def handle_call({:analyze, code}, _from, {port, identity} = state) do
+    case analyze_one(port, code) do
+      {:ok, result} ->
+        {:reply, {identity, result}, state, @idle_timeout}
+
+      {:error, reason} ->
+        close_port(port)
+        {:stop, :normal, {nil, {:error, {:analyzer, reason}}}, state}
+    end
+  end
+
+  @impl true
+  def handle_info(:timeout, {port, _identity} = state) do
+    close_port(port)
+    {:stop, :normal, state}
+  end
+
+  def handle_info({port, {:exit_status, _status}}, {port, _identity} = state) do
+    {:stop, :normal, state}
+  end
+
+  def handle_info(_msg, state) do
+    {:noreply, state, @idle_timeout}
+  end
+
+  defp close_port(port) do
+    if Port.info(port), do: Port.close(port)
+    :ok
+  end
+
+  defp embedded_envs(python3_root) do
+    case :os.type() do
+      {:unix, :darwin} -> [{~c"DYLD_INSERT_LIBRARIES", ~c"#{python3_root}/lib/libpython3.dylib"}]
+      {:unix, _} -> [{~c"LD_LIBRARY_PATH", ~c"#{python3_root}/lib"}]
+      _ -> []
+    end
+  end
+
+  defp open_analyzer(nil, _envs), do: :error
+
+  defp open_analyzer(executable, envs) do
+    if File.exists?(executable) do
+      port =
+        Port.open({:spawn_executable, executable}, [
+          :binary,
+          :exit_status,
+          {:line, @max_line_length},
+          args: ["-u", "-c", @analyzer_script],
+          env: envs
+        ])
+
+      # make sure the interpreter can actually run before handing it out
+      case analyze_one(port, "") do
+        {:ok, {:ok, %{magic: magic}}} ->
+          {:ok, port, magic}
+
+        _ ->
+          close_port(port)
+          :error
+      end
+    else
+      :error
+    end
+  rescue
+    _ -> :error
+  end
+
+  defp analyze_one(port, code) do
+    Port.command(port, [Jason.encode!(%{"code" => code}), ?\n])
+
+    with {:ok, line} <- read_line(port, []) do
+      case Jason.decode(line) do
+        {:ok, decoded} when is_map(decoded) and is_map_key(decoded, "status") ->
+          {:ok, to_result(decoded)}
+
+        _ ->
+          {:error, "unexpected analyzer output: #{line}"}
+      end
+    end
+  end
+
+  defp read_line(port, chunks) do
+    receive do
+      {^port, {:data, {:eol, chunk}}} -> {:ok, IO.iodata_to_binary(Enum.reverse([chunk | chunks]))}
+      {^port, {:data, {:noeol, chunk}}} -> read_line(port, [chunk | chunks])
+      {^port, {:exit_status, status}} -> {:error, "the analyzer exited with status #{status}"}
+    after
+      @reply_timeout ->
+        close_port(port)
+        {:error, "analyzer timed out"}
+    end
+  end
+end
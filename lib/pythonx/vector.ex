@@ -0,0 +1,85 @@
+defmodule Pythonx.Vector do
+  @moduledoc """
+  Elementwise number protocol operations over whole vectors.
+
+  `Pythonx.C.PyNumber` and `Pythonx.Handle.number/4` apply an operation to
+  one pair of objects per call. `number/4` applies it to every pair of
+  elements of two vectors in a single call:
+
+      Pythonx.Vector.number(:multiply, [1, 2, 3], 2.5)
+      #=> {:ok, [2.5, 5.0, 7.5]}
+
+  An operand is one of:
+
+    * an integer or a float, which is used for every element;
+    * a list of numbers;
+    * `{:handle, handle}`, an object that is used for every element;
+    * `{:handles, [handle]}`;
+    * `{:s64, binary}` or `{:f64, binary}`, packed native endian signed
+      64-bit integers or doubles, as built by `pack/2`.
+
+  When both operands are made of integers or floats, `:add`, `:subtract`,
+  `:multiply`, `:true_divide`, `:and`, `:or` and `:xor` are computed natively
+  without creating Python objects. The results are the same as Python's: an
+  integer overflow, a division by zero or any other case where the native result
+  could differ is handed over to Python, which then returns big integers or the
+  error. Unless the results go `into: :handles`, these native calls do not wait for
+  the interpreter, every other call takes it like `Pythonx.inline/2` does.
+  """
+
+  alias Pythonx.C.PyErr
+
+  @type operand ::
+          number()
+          | [number()]
+          | {:handle, Pythonx.Handle.t()}
+          | {:handles, [Pythonx.Handle.t()]}
+          | {:s64, binary()}
+          | {:f64, binary()}
+
+  @type into :: :list | :s64 | :f64 | :handles
+
+  @doc """
+  Applies a binary number protocol operation, named after its `Pythonx.C.PyNumber`
+  function, to every pair of elements of `a` and `b`.
+
+  Both operands must have the same length, unless one of them is a single value.
+
+  ## Options
+
+    * `:into` - the result, one of:
+      * `:list` - a list of numbers, the default;
+      * `:s64` - a packed binary of signed 64-bit integers, every result must be
+        an integer that fits;
+      * `:f64` - a packed binary of doubles, the results are converted with `float()`;
+      * `:handles` - a list of handles.
+    * `:arena` - the `Pythonx.Arena` of the handles, when `into: :handles`.
+
+  If an element fails, returns `{:error, index, error}` with the index of the element.
+  """
+  @spec number(Pythonx.Handle.number_op(), operand(), operand(), keyword()) ::
+          {:ok, [number()] | [Pythonx.Handle.t()] | binary()} | {:error, non_neg_integer(), PyErr.t()}
+  def number(op, a, b, opts \\ []) when is_atom(op) do
+    into = Keyword.get(opts, :into, :list)
+    arena = Keyword.get(opts, :arena)
+
+    case Pythonx.Nif.number_vector(op, a, b, into, arena) do
+      {:error, index, error} -> {:error, index, error}
+      result -> {:ok, result}
+    end
+  end
+
+  @doc """
+  Packs a list of numbers into the binary of an `{:s64, binary}` or `{:f64, binary}` operand.
+  """
+  @spec pack([number()], :s64 | :f64) :: binary()
+  def pack(numbers, :s64) when is_list(numbers), do: for(n <- numbers, into: <<>>, do: <<n::signed-native-64>>)
+  def pack(numbers, :f64) when is_list(numbers), do: for(n <- numbers, into: <<>>, do: <<n::float-native-64>>)
+
+  @doc """
+  Unpacks a binary returned with `into: :s64` or `into: :f64`.
+  """
+  @spec unpack(binary(), :s64 | :f64) :: [number()]
+  def unpack(binary, :s64) when is_binary(binary), do: for(<<n::signed-native-64 <- binary>>, do: n)
+  def unpack(binary, :f64) when is_binary(binary), do: for(<<n::float-native-64 <- binary>>, do: n)
+end
@@ -253,7 +253,10 @@ defmodule Pythonx.Nif do
             File.ln_s!(so_file, "libpython3.#{file_ext}")
 
           [] ->
-            raise RuntimeError, "Failed to find any libpython3.x.#{file_ext} in #{lib_dir}"
+            # pythonx.so was built with PYTHONX_STATIC_LIBPYTHON=true
+            unless Enum.any?(File.ls!(), &String.match?(&1, ~r/libpython3\..+\.a$/)) do
+              raise RuntimeError, "Failed to find any libpython3.x.#{file_ext} in #{lib_dir}"
+            end
         end
       end)
     end
@@ -274,8 +277,17 @@ defmodule Pythonx.Nif do
     "#{:code.priv_dir(:pythonx)}"
   end
 
-  def initialize(_python_home), do: :erlang.nif_error(:not_loaded)
-  def inline(_string, _vars, _locals, _globals, _binding), do: :erlang.nif_error(:not_loaded)
+  def initialize(_python_home, _allocator), do: :erlang.nif_error(:not_loaded)
+  def inline(_string, _vars, _locals, _globals, _binding, _memory_limit), do: :erlang.nif_error(:not_loaded)
+
+  def inline_bytecode(_string, _magic, _bytecode, _vars, _locals, _globals, _binding, _memory_limit),
+    do: :erlang.nif_error(:not_loaded)
+  def init_timings, do: :erlang.nif_error(:not_loaded)
+  def preload_module(_name), do: :erlang.nif_error(:not_loaded)
+  def precompile(_code), do: :erlang.nif_error(:not_loaded)
+  def memory_stats, do: :erlang.nif_error(:not_loaded)
+  def lock_stats, do: :erlang.nif_error(:not_loaded)
+  def lock_stats_reset, do: :erlang.nif_error(:not_loaded)
   def finalize, do: :erlang.nif_error(:not_loaded)
   def nif_loaded, do: false
 
@@ -285,6 +297,56 @@ defmodule Pythonx.Nif do
   def py_incref(_ref), do: :erlang.nif_error(:not_loaded)
   def py_decref(_ref), do: :erlang.nif_error(:not_loaded)
 
+  def etf_encode(_ref), do: :erlang.nif_error(:not_loaded)
+  def etf_decode(_binary), do: :erlang.nif_error(:not_loaded)
+
+  def pickle_dumps(_ref), do: :erlang.nif_error(:not_loaded)
+  def pickle_loads(_data, _buffers), do: :erlang.nif_error(:not_loaded)
+
+  def gc_collect(_generation), do: :erlang.nif_error(:not_loaded)
+  def gc_set_enabled(_enabled), do: :erlang.nif_error(:not_loaded)
+  def gc_get_threshold, do: :erlang.nif_error(:not_loaded)
+  def gc_set_threshold(_threshold0, _threshold1, _threshold2), do: :erlang.nif_error(:not_loaded)
+  def gc_freeze, do: :erlang.nif_error(:not_loaded)
+  def gc_unfreeze, do: :erlang.nif_error(:not_loaded)
+  def gc_stats, do: :erlang.nif_error(:not_loaded)
+  def gc_stats_reset, do: :erlang.nif_error(:not_loaded)
+
+  def profiler_start(_interval_us), do: :erlang.nif_error(:not_loaded)
+  def profiler_stop, do: :erlang.nif_error(:not_loaded)
+  def profiler_collapsed, do: :erlang.nif_error(:not_loaded)
+  def output_capture(_pid, _ref, _capacity, _batch, _block, _block_timeout_ms), do: :erlang.nif_error(:not_loaded)
+  def output_release, do: :erlang.nif_error(:not_loaded)
+  def output_flush, do: :erlang.nif_error(:not_loaded)
+  def output_ack(_ref, _bytes), do: :erlang.nif_error(:not_loaded)
+
+  def handle_new(_ref, _arena), do: :erlang.nif_error(:not_loaded)
+  def handle_to_ref(_handle), do: :erlang.nif_error(:not_loaded)
+  def handle_release(_handles), do: :erlang.nif_error(:not_loaded)
+  def handle_count, do: :erlang.nif_error(:not_loaded)
+  def handle_from_long(_value, _arena), do: :erlang.nif_error(:not_loaded)
+  def handle_as_long(_handle), do: :erlang.nif_error(:not_loaded)
+  def handle_number(_op, _h1, _h2, _arena), do: :erlang.nif_error(:not_loaded)
+  def handle_list(_handles, _arena), do: :erlang.nif_error(:not_loaded)
+  def handle_tuple(_handles, _arena), do: :erlang.nif_error(:not_loaded)
+  def handle_dict(_pairs, _arena), do: :erlang.nif_error(:not_loaded)
+  def handle_items(_handle, _arena), do: :erlang.nif_error(:not_loaded)
+  def handle_get_attrs(_handle, _names, _arena), do: :erlang.nif_error(:not_loaded)
+  def pipeline(_instructions, _outputs, _arena), do: :erlang.nif_error(:not_loaded)
+  def call(_target, _method, _args, _kwargs, _into, _arena), do: :erlang.nif_error(:not_loaded)
+  def iter_new(_iterable), do: :erlang.nif_error(:not_loaded)
+  def iter_send(_iterator, _count, _pid, _ref), do: :erlang.nif_error(:not_loaded)
+  def number_vector(_op, _a, _b, _into, _arena), do: :erlang.nif_error(:not_loaded)
+  def arena_new, do: :erlang.nif_error(:not_loaded)
+  def arena_adopt(_arena, _handles), do: :erlang.nif_error(:not_loaded)
+  def arena_release(_arena), do: :erlang.nif_error(:not_loaded)
+  def arena_size(_arena), do: :erlang.nif_error(:not_loaded)
+
+  def census(_sizes), do: :erlang.nif_error(:not_loaded)
+  def census_count, do: :erlang.nif_error(:not_loaded)
+  def census_set_enabled(_enabled), do: :erlang.nif_error(:not_loaded)
+  def census_tag(_tag), do: :erlang.nif_error(:not_loaded)
+
   def py_anyset_check(_ref), do: :erlang.nif_error(:not_loaded)
   def py_anyset_check_exact(_ref), do: :erlang.nif_error(:not_loaded)
 
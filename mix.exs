@@ -28,6 +28,7 @@ defmodule Pythonx.MixProject do
       make_precompiler: {:nif, CCPrecompiler},
       make_precompiler_url: "#{@github_url}/releases/download/v#{@version}/@{artefact_filename}",
       make_precompiler_nif_versions: [versions: ["2.16"]],
+      make_force_build: force_build?(),
       cc_precompiler: [
         cleanup: "clean",
         only_listed_targets: true,
@@ -75,7 +76,7 @@ defmodule Pythonx.MixProject do
 
   def application do
     [
-      extra_applications: [:logger]
+      extra_applications: [:logger, :crypto]
     ]
   end
 
@@ -85,11 +86,17 @@ defmodule Pythonx.MixProject do
       {:cc_precompiler, "~> 0.1"},
       {:jason, "~> 1.2"},
       {:req, "~> 0.3"},
+      {:telemetry, "~> 1.1"},
       {:ex_doc, "~> 0.34", only: :docs, runtime: false},
       {:styler, "~> 0.11.9", only: [:dev, :test], runtime: false}
     ]
   end
 
+  # build variants that are never precompiled
+  defp force_build? do
+    System.get_env("PYTHONX_PGO", "off") != "off" or System.get_env("PYTHONX_STATIC_LIBPYTHON") == "true"
+  end
+
   defp docs do
     [
       main: "Pythonx",
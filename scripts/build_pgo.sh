@@ -0,0 +1,36 @@
+#!/usr/bin/env bash
+
+PYTHONX_PGO_PROFILE_DIR=$1
+
+if [ -z "$PYTHONX_PGO_PROFILE_DIR" ]; then
+  echo "[!] Usage: $0 <profile_dir>"
+  exit 1
+fi
+
+set -e
+
+export PYTHONX_PGO_PROFILE_DIR
+rm -rf "${PYTHONX_PGO_PROFILE_DIR}"
+mkdir -p "${PYTHONX_PGO_PROFILE_DIR}"
+
+echo "[+] Building an instrumented pythonx.so..."
+PYTHONX_PGO=generate mix compile
+
+echo "[+] Running the training workload..."
+PYTHONX_PGO=generate mix run --no-compile scripts/pgo_training.exs
+
+# clang writes raw profiles that have to be merged first
+if ls "${PYTHONX_PGO_PROFILE_DIR}"/*.profraw >/dev/null 2>&1 ; then
+  LLVM_PROFDATA="$(command -v llvm-profdata || true)"
+  if [ -z "${LLVM_PROFDATA}" ] && [ "$(uname -s)" = "Darwin" ]; then
+    LLVM_PROFDATA="xcrun llvm-profdata"
+  fi
+  if [ -z "${LLVM_PROFDATA}" ]; then
+    echo "[!] Cannot find llvm-profdata to merge the profiles"
+    exit 1
+  fi
+  ${LLVM_PROFDATA} merge -output="${PYTHONX_PGO_PROFILE_DIR}/default.profdata" "${PYTHONX_PGO_PROFILE_DIR}"/*.profraw
+fi
+
+echo "[+] Rebuilding pythonx.so with the profile..."
+PYTHONX_PGO=use mix compile
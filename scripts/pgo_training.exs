@@ -0,0 +1,52 @@
+# Training workload for the profile-guided build of pythonx.so.
+#
+# It is run by scripts/build_pgo.sh with an instrumented pythonx.so, and
+# should exercise the hot paths in roughly the proportions seen in
+# production: conversions, pythonx_inline, and the C API NIF prologues.
+
+alias Pythonx.C.{PyDict, PyList, PyLong, PyNumber, PyUnicode}
+
+Pythonx.initialize_once()
+
+iterations = String.to_integer(System.get_env("PYTHONX_PGO_ITERATIONS", "20000"))
+
+values = [
+  42,
+  -7,
+  3.14,
+  "hello",
+  String.duplicate("x", 1024),
+  [1, 2, 3, "four", 5.0],
+  {1, "two", 3.0},
+  %{"a" => 1, "b" => [1, 2, 3], "c" => %{"d" => "e"}},
+  Enum.to_list(1..256)
+]
+
+for _ <- 1..div(iterations, 10), value <- values do
+  ref = Pythonx.Codec.Encoder.encode_c(value)
+  ref |> Pythonx.ETF.encode() |> :erlang.binary_to_term()
+  Pythonx.ETF.decode(:erlang.term_to_binary(value))
+  {data, buffers} = Pythonx.Pickle.dumps(ref)
+  Pythonx.Pickle.loads(data, buffers)
+end
+
+for i <- 1..iterations do
+  a = PyLong.from_long(i)
+  b = PyLong.from_long(i * 3)
+  sum = PyNumber.add(a, b)
+  product = PyNumber.multiply(sum, b)
+  PyNumber.true_divide(product, a)
+  PyNumber.remainder(product, b)
+  PyLong.as_long(sum)
+
+  list = PyList.new(0)
+  PyList.append(list, a)
+  PyList.append(list, PyUnicode.from_string("item"))
+  dict = PyDict.new()
+  PyDict.set_item_string(dict, "list", list)
+  PyDict.get_item_string(dict, "list")
+end
+
+for i <- 1..div(iterations, 10) do
+  {:ok, [_]} = Pythonx.inline("b = [x * 2 for x in range(a)]", return: [:b], elixir_vars: [a: rem(i, 64)])
+end
@@ -0,0 +1,100 @@
+#!/usr/bin/env bash
+
+Python3_ROOT_DIR=$1
+LIBPYTHON3_MAJOR_VERSION=$2
+LIBPYTHON3_MINOR_VERSION=$3
+
+if [ -z "$Python3_ROOT_DIR" ] || [ -z "$LIBPYTHON3_MAJOR_VERSION" ] || [ -z "$LIBPYTHON3_MINOR_VERSION" ]; then
+  echo "[!] Usage: $0 <python3_root_dir> <python3_major_version> <python3_minor_version>"
+  exit 1
+fi
+
+STDLIB_DIR="${Python3_ROOT_DIR}/lib/python${LIBPYTHON3_MAJOR_VERSION}.${LIBPYTHON3_MINOR_VERSION}"
+STDLIB_ZIP="${Python3_ROOT_DIR}/lib/python${LIBPYTHON3_MAJOR_VERSION}${LIBPYTHON3_MINOR_VERSION}.zip"
+PYTHON3_EXECUTABLE="${Python3_ROOT_DIR}/bin/python3"
+
+if [ -f "${STDLIB_ZIP}" ]; then
+  echo "[+] ${STDLIB_ZIP} already exists"
+  exit 0
+fi
+
+if [ ! -d "${STDLIB_DIR}" ]; then
+  echo "[!] Cannot find the standard library at ${STDLIB_DIR}"
+  exit 1
+fi
+
+# The .pyc files in the zip must match the embedded interpreter, so they can
+# only be produced by running it. This is not possible when cross-compiling.
+export LD_LIBRARY_PATH="${Python3_ROOT_DIR}/lib:${LD_LIBRARY_PATH}"
+export DYLD_LIBRARY_PATH="${Python3_ROOT_DIR}/lib:${DYLD_LIBRARY_PATH}"
+if ! "${PYTHON3_EXECUTABLE}" -c "" >/dev/null 2>&1 ; then
+  echo "[!] Cannot run ${PYTHON3_EXECUTABLE}, leaving the standard library unzipped"
+  exit 0
+fi
+
+echo "[+] Packing ${STDLIB_DIR} into ${STDLIB_ZIP}..."
+
+# The interpreter puts `lib/pythonXY.zip` on sys.path before `lib/pythonX.Y`,
+# so modules found in the zip are imported with one open() instead of a stat()
+# per sys.path entry per module. zipimport cannot write bytecode caches, so
+# every module is stored with its compiled .pyc next to the source. Entries
+# are not compressed, reading them would otherwise need zlib, which may be an
+# extension module in lib-dynload.
+#
+# Packages that read data files relative to `__file__`, or that are meant to be
+# run as scripts, stay on disk. `os.py` stays too, as the landmark used to find
+# the standard library.
+"${PYTHON3_EXECUTABLE}" -I - "${STDLIB_DIR}" "${STDLIB_ZIP}" <<'EOF'
+import importlib.util
+import os
+import py_compile
+import sys
+import tempfile
+import zipfile
+
+stdlib_dir, stdlib_zip = sys.argv[1], sys.argv[2]
+keep_on_disk = {
+    "__pycache__", "site-packages", "lib-dynload", "test", "idlelib", "tkinter",
+    "turtledemo", "ensurepip", "lib2to3", "venv", "distutils", "pydoc_data",
+}
+zipped = []
+
+with tempfile.TemporaryDirectory() as tmp, zipfile.ZipFile(stdlib_zip + ".tmp", "w", zipfile.ZIP_STORED) as zf:
+    for root, dirs, files in os.walk(stdlib_dir):
+        rel_root = os.path.relpath(root, stdlib_dir)
+        if rel_root == ".":
+            dirs[:] = [d for d in dirs if d not in keep_on_disk and not d.startswith("config-")]
+        else:
+            dirs[:] = [d for d in dirs if d != "__pycache__"]
+        dirs.sort()
+
+        for name in sorted(files):
+            if not name.endswith(".py") or (rel_root == "." and name == "os.py"):
+                continue
+            path = os.path.join(root, name)
+            arcname = os.path.normpath(os.path.join(rel_root, name))
+            cfile = os.path.join(tmp, "module.pyc")
+            try:
+                py_compile.compile(path, cfile=cfile, dfile=arcname, doraise=True,
+                                   invalidation_mode=py_compile.PycInvalidationMode.UNCHECKED_HASH)
+            except py_compile.PyCompileError:
+                continue
+            zf.write(path, arcname)
+            zf.write(cfile, arcname + "c")
+            zipped.append(path)
+
+os.replace(stdlib_zip + ".tmp", stdlib_zip)
+
+# remove the loose copies, and the bytecode caches next to them
+for path in zipped:
+    os.remove(path)
+    for optimization in ("", 1, 2):
+        cache = importlib.util.cache_from_source(path, optimization=optimization)
+        if os.path.exists(cache):
+            os.remove(cache)
+for root, dirs, files in os.walk(stdlib_dir, topdown=False):
+    if root != stdlib_dir and not os.listdir(root):
+        os.rmdir(root)
+
+print(f"[+] Packed {len(zipped)} modules")
+EOF
@@ -0,0 +1,80 @@
+defmodule Pythonx.Arena.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.Arena
+  alias Pythonx.Handle
+
+  setup do
+    Pythonx.initialize_once()
+  end
+
+  defp eventually(fun, tries \\ 100) do
+    cond do
+      fun.() -> true
+      tries == 0 -> false
+      true ->
+        Process.sleep(10)
+        eventually(fun, tries - 1)
+    end
+  end
+
+  test "releases every handle at once" do
+    before = Handle.count()
+    arena = Arena.new()
+    handles = Enum.map(1..1000, &Handle.from_long(&1, arena))
+    sum = Enum.reduce(handles, fn h, acc -> Handle.number(:add, acc, h, arena) end)
+
+    assert 500_500 == Handle.as_long(sum)
+    assert 1999 == Arena.size(arena)
+    assert 1999 == Arena.release(arena)
+    assert 0 == Arena.size(arena)
+    assert before == Handle.count()
+
+    assert_raise ArgumentError, fn -> Handle.as_long(sum) end
+  end
+
+  test "skips handles released on their own" do
+    arena = Arena.new()
+    a = Handle.from_long(1, arena)
+    _b = Handle.from_long(2, arena)
+    assert 1 == Handle.release(a)
+    assert 1 == Arena.release(arena)
+  end
+
+  test "adopts handles" do
+    arena = Arena.new()
+    a = Handle.from_long(1)
+    assert :ok == Arena.adopt(arena, [a])
+    assert 1 == Arena.release(arena)
+    assert_raise ArgumentError, fn -> Arena.adopt(arena, [a]) end
+  end
+
+  test "releases the handles of a collected arena" do
+    before = Handle.count()
+
+    {pid, monitor} =
+      spawn_monitor(fn ->
+        arena = Arena.new()
+        Enum.each(1..100, &Handle.from_long(&1, arena))
+      end)
+
+    assert_receive {:DOWN, ^monitor, :process, ^pid, :normal}
+    # the arena is destructed once the heap of the process is freed
+    assert eventually(fn -> Handle.count() == before end)
+    # its references are dropped by the next call that takes the interpreter
+    assert {:ok, [3]} == Pythonx.inline("x = 1 + 2", return: [:x])
+  end
+
+  test "run/1 releases the arena" do
+    before = Handle.count()
+
+    assert 42 ==
+             Arena.run(fn arena ->
+               a = Handle.from_long(20, arena)
+               b = Handle.from_long(22, arena)
+               Handle.as_long(Handle.number(:add, a, b, arena))
+             end)
+
+    assert before == Handle.count()
+  end
+end
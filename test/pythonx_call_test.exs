@@ -0,0 +1,46 @@
+defmodule Pythonx.Call.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.C.{PyDict, PyErr, PyEval, PyUnicode}
+  alias Pythonx.Call
+  alias Pythonx.Handle
+
+  setup do
+    Pythonx.initialize_once()
+  end
+
+  defp builtin(name), do: PyDict.get_item_string(PyEval.get_builtins(), name)
+
+  test "calls with positional and keyword arguments" do
+    assert [3, 2, 1] == Call.call(builtin("sorted"), [[3, 1, 2]], reverse: true)
+    assert [3, 2, 1] == Call.call(builtin("sorted"), [[3, 1, 2]], %{"reverse" => true})
+    assert 3 == Call.call(builtin("len"), ["abc"])
+  end
+
+  test "calls methods" do
+    string = PyUnicode.from_string("a,b,c")
+    assert ["a", "b", "c"] == Call.method(string, :split, [","])
+    assert ["a", "b,c"] == Call.method(string, "split", [], sep: ",", maxsplit: 1)
+    assert "A,B,C" == Call.method(string, :upper)
+  end
+
+  test "handles as targets, arguments and results" do
+    string = Handle.new(PyUnicode.from_string("abcabc"))
+    sub = Handle.new(PyUnicode.from_string("bc"))
+    assert 2 == Call.method(string, :count, [{:handle, sub}])
+
+    upper = Call.method(string, :upper, [], [], into: :handle)
+    assert is_integer(upper)
+    assert "ABCABC" == PyUnicode.as_utf8(Handle.to_ref(upper))
+    assert is_reference(Call.method(string, :upper, [], [], into: :ref))
+
+    assert 3 == Handle.release([string, sub, upper])
+    assert_raise ArgumentError, fn -> Call.method(string, :upper) end
+  end
+
+  test "returns the exception raised by the call" do
+    assert %PyErr{} = Call.call(builtin("len"), [1])
+    assert %PyErr{} = Call.method(PyUnicode.from_string("a"), :no_such_method)
+    assert_raise ArgumentError, fn -> Call.call(builtin("len"), ["a"], [1]) end
+  end
+end
@@ -0,0 +1,64 @@
+defmodule Pythonx.Census.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.C.PyDict
+  alias Pythonx.Census
+
+  setup do
+    Pythonx.initialize_once()
+    Census.enable()
+    on_exit(fn -> Census.disable() end)
+  end
+
+  defp sites(type) do
+    case Enum.find(Census.take(), &(&1.type == type)) do
+      nil -> %{}
+      entry -> entry.sites
+    end
+  end
+
+  test "counts live references by type and tag" do
+    count = Census.count()
+    dicts = Census.with_tag(:census_test, fn -> for _ <- 1..50, do: PyDict.new() end)
+    assert Census.count() >= count + 50
+
+    entry = Enum.find(Census.take(), &(&1.type == "dict"))
+    assert entry.sites["census_test"] == 50
+    assert entry.bytes > 0
+    assert length(dicts) == 50
+  end
+
+  test "references are no longer counted once collected" do
+    {pid, ref} = spawn_monitor(fn -> Census.with_tag("short_lived", fn -> for _ <- 1..20, do: PyDict.new() end) end)
+    assert_receive {:DOWN, ^ref, :process, ^pid, :normal}
+
+    refute Map.has_key?(sites("dict"), "short_lived")
+  end
+
+  test "sorts by bytes" do
+    _keep = [PyDict.new()]
+    entries = Census.take(sort_by: :bytes)
+    bytes = Enum.map(entries, &(&1.bytes || 0))
+    assert bytes == Enum.sort(bytes, :desc)
+    assert [_] = Census.top(1, sizes: false)
+  end
+
+  test "records references only while enabled" do
+    assert Census.disable()
+    count = Census.count()
+    dicts = Census.with_tag(:disabled, fn -> for _ <- 1..10, do: PyDict.new() end)
+    assert Census.count() >= count + 10
+    assert {:error, "census is not enabled"} == Census.take()
+
+    refute Census.enable()
+    assert sites("dict") == %{}
+    assert length(dicts) == 10
+  end
+
+  test "tags are per process" do
+    assert nil == Census.tag(:first)
+    assert "first" == Census.tag("second")
+    assert nil == Task.await(Task.async(fn -> Census.tag(nil) end))
+    assert "second" == Census.tag(nil)
+  end
+end
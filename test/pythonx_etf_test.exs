@@ -0,0 +1,90 @@
+defmodule Pythonx.ETF.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.C
+  alias Pythonx.C.PyDict
+  alias Pythonx.C.PyErr
+  alias Pythonx.C.PyLong
+  alias Pythonx.C.PyObject
+  alias Pythonx.C.PyRun
+  alias Pythonx.C.PyUnicode
+  alias Pythonx.ETF
+
+  setup do
+    Pythonx.initialize_once()
+  end
+
+  defp eval(code) do
+    globals = PyDict.new()
+    PyRun.string(code, C.py_eval_input(), globals, globals)
+  end
+
+  describe "encode/1" do
+    test "encodes scalars" do
+      for value <- [0, 255, 256, -1, 2_147_483_648, -(2 ** 63), 4.2, "héllo"] do
+        obj = Pythonx.Codec.Encoder.encode_c(value)
+        assert value == :erlang.binary_to_term(ETF.encode(obj))
+      end
+    end
+
+    test "encodes None, True and False as atoms" do
+      assert nil == :erlang.binary_to_term(ETF.encode(PyObject.py_none()))
+      assert true == :erlang.binary_to_term(ETF.encode(PyObject.py_true()))
+      assert false == :erlang.binary_to_term(ETF.encode(PyObject.py_false()))
+    end
+
+    test "encodes containers" do
+      value = [1, [2, {3, "c"}], %{"a" => "b", 1 => [4.2, "b"]}, {}, []]
+      obj = Pythonx.Codec.Encoder.encode(value)
+      assert value == :erlang.binary_to_term(ETF.encode(obj))
+    end
+
+    test "encodes large tuples" do
+      value = List.to_tuple(Enum.to_list(1..300))
+      obj = Pythonx.Codec.Encoder.encode(value)
+      assert value == :erlang.binary_to_term(ETF.encode(obj))
+    end
+
+    test "encodes unsupported types as nil" do
+      obj = PyObject.type(PyLong.from_long(1))
+      assert nil == :erlang.binary_to_term(ETF.encode(obj))
+      assert [nil, %{"a" => nil}] == :erlang.binary_to_term(ETF.encode(eval("[b'x', {'a': frozenset()}]")))
+    end
+
+    test "returns PyErr on dict keys of unsupported types" do
+      assert %PyErr{} = ETF.encode(eval("{frozenset(): 1, b'x': 2}"))
+      assert %PyErr{} = ETF.encode(eval("{(1, b'x'): 1}"))
+      assert %{{1, "a"} => 1, nil => 2} == :erlang.binary_to_term(ETF.encode(eval("{(1, 'a'): 1, None: 2}")))
+    end
+  end
+
+  describe "decode/1" do
+    test "decodes scalars" do
+      assert 42 == PyLong.as_long(ETF.decode(:erlang.term_to_binary(42)))
+      assert -42 == PyLong.as_long(ETF.decode(:erlang.term_to_binary(-42)))
+      assert "héllo" == PyUnicode.as_utf8(ETF.decode(:erlang.term_to_binary("héllo")))
+      assert "elixir" == PyUnicode.as_utf8(ETF.decode(:erlang.term_to_binary(:elixir)))
+    end
+
+    test "round-trips through Python" do
+      for value <- [
+            2 ** 100,
+            -(2 ** 64),
+            -(2 ** 2100),
+            [1, 2, 3],
+            ~c"abc",
+            {1, "two", 3.0},
+            %{"a" => [1, %{"b" => {nil, true, false}}]}
+          ] do
+        assert value == :erlang.binary_to_term(ETF.encode(ETF.decode(:erlang.term_to_binary(value))))
+      end
+    end
+
+    test "returns PyErr on malformed or unsupported data" do
+      assert %PyErr{} = ETF.decode(<<131, 108, 0, 0, 0, 5>>)
+      assert %PyErr{} = ETF.decode(:erlang.term_to_binary(self()))
+      assert %PyErr{} = ETF.decode(:erlang.term_to_binary([1 | 2]))
+      assert %PyErr{} = ETF.decode(<<>>)
+    end
+  end
+end
@@ -0,0 +1,45 @@
+defmodule Pythonx.GC.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.GC
+
+  setup do
+    Pythonx.initialize_once()
+  end
+
+  test "collections are timed" do
+    :ok = GC.reset_stats()
+    Pythonx.inline("for _ in range(100):\n    a = []\n    a.append(a)")
+    assert is_integer(GC.collect())
+
+    %{generations: [_, _, gen2], pauses: pauses} = GC.stats()
+    assert gen2.collections >= 1
+    assert gen2.max_pause_us <= gen2.pause_us
+    assert Enum.sum(Enum.map(pauses, &elem(&1, 1))) >= 1
+  end
+
+  test "disables automatic collection temporarily" do
+    assert GC.stats().enabled
+    assert :done ==
+             GC.without_gc(fn ->
+               refute GC.stats().enabled
+               :done
+             end)
+
+    assert GC.stats().enabled
+  end
+
+  test "thresholds" do
+    {t0, t1, t2} = GC.threshold()
+    assert :ok == GC.set_threshold(10_000, t1, t2)
+    assert {10_000, ^t1, ^t2} = GC.threshold()
+    assert :ok == GC.set_threshold(t0, t1, t2)
+  end
+
+  test "freezes the heap" do
+    assert :ok == GC.freeze()
+    assert GC.stats().frozen > 0
+    assert :ok == GC.unfreeze()
+    assert GC.stats().frozen == 0
+  end
+end
@@ -0,0 +1,73 @@
+defmodule Pythonx.Handle.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.C.PyErr
+  alias Pythonx.Handle
+
+  setup do
+    Pythonx.initialize_once()
+  end
+
+  test "round trips objects through handles" do
+    handle = Handle.new(Pythonx.C.PyLong.from_long(42))
+    assert is_integer(handle)
+    assert 42 == Pythonx.C.PyLong.as_long(Handle.to_ref(handle))
+    assert 1 == Handle.release(handle)
+  end
+
+  test "number operations" do
+    a = Handle.from_long(6)
+    b = Handle.from_long(7)
+    product = Handle.number(:multiply, a, b)
+    zero = Handle.from_long(0)
+    assert 42 == Handle.as_long(product)
+    assert %PyErr{} = Handle.number(:true_divide, a, zero)
+    assert_raise ArgumentError, fn -> Handle.number(:no_such_op, a, b) end
+    assert 4 == Handle.release([a, b, product, zero])
+  end
+
+  test "released handles are detected" do
+    before = Handle.count()
+    handles = Enum.map(1..100, &Handle.from_long/1)
+    assert before + 100 == Handle.count()
+
+    assert 100 == Handle.release(handles)
+    assert before == Handle.count()
+    assert 0 == Handle.release(handles)
+
+    # the slots are reused, but the old handles still don't match
+    new = Enum.map(1..100, &Handle.from_long/1)
+    assert_raise ArgumentError, fn -> Handle.as_long(hd(handles)) end
+    assert_raise ArgumentError, fn -> Handle.to_ref(0) end
+    Handle.release(new)
+  end
+
+  test "bulk builders and extractors" do
+    items = Enum.map(1..5, &Handle.from_long/1)
+
+    list = Handle.list(items)
+    assert 5 == Pythonx.C.PyList.size(Handle.to_ref(list))
+
+    extracted = Handle.items(list)
+    assert [1, 2, 3, 4, 5] == Enum.map(extracted, &Handle.as_long/1)
+
+    tuple = Handle.tuple(items)
+    tuple_items = Handle.items(tuple)
+    assert 5 == length(tuple_items)
+
+    dict = Handle.dict(Enum.zip(items, Enum.reverse(items)))
+    pairs = Handle.items(dict)
+    assert [{1, 5}, {2, 4}, {3, 3}, {4, 2}, {5, 1}] ==
+             Enum.map(pairs, fn {k, v} -> {Handle.as_long(k), Handle.as_long(v)} end)
+
+    [real, imag] = Handle.get_attrs(hd(items), ["real", "imag"])
+    assert {1, 0} == {Handle.as_long(real), Handle.as_long(imag)}
+    assert %PyErr{} = Handle.get_attrs(hd(items), ["real", "no_such_attr"])
+    assert %PyErr{} = Handle.items(hd(items))
+
+    pair_handles = Enum.flat_map(pairs, &Tuple.to_list/1)
+    Handle.release(items ++ extracted ++ tuple_items ++ pair_handles ++ [list, tuple, dict, real, imag])
+    assert_raise ArgumentError, fn -> Handle.list(items) end
+    assert_raise ArgumentError, fn -> Handle.dict([{1, 2, 3}]) end
+  end
+end
@@ -21,4 +21,24 @@ defmodule Pythonx.Inline.Test do
 
     assert {"Elixir 🤝", "Elixir 🤝 Python!"} == {a, b}
   end
+
+  test "runs precompiled bytecode" do
+    code = "b = a * 2"
+    {:ok, %{bytecode: bytecode, magic: magic}} = Pythonx.Symtable.analyze(code)
+
+    assert {:ok, [42]} ==
+             Pythonx.inline(code, return: [:b], elixir_vars: [a: 21], bytecode: {magic, bytecode})
+  end
+
+  test "compiles the source when the bytecode magic number does not match" do
+    assert {:ok, [42]} ==
+             Pythonx.inline("b = a * 2", return: [:b], elixir_vars: [a: 21], bytecode: {0, "not bytecode"})
+  end
+
+  test "passes tuples as tuples" do
+    code = "kinds = [type(t).__name__, type(t[2]).__name__]\nsize = len(t)\nfirst = t[0]"
+
+    assert {:ok, [["tuple", "tuple"], 3, 1]} ==
+             Pythonx.inline(code, return: [:kinds, :size, :first], elixir_vars: [t: {1, 2, {3, 4}}])
+  end
 end
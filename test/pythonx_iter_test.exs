@@ -0,0 +1,53 @@
+defmodule Pythonx.Iter.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.C.{PyDict, PyEval, PyList, PyUnicode}
+  alias Pythonx.Call
+  alias Pythonx.Handle
+  alias Pythonx.Iter
+
+  setup do
+    Pythonx.initialize_once()
+  end
+
+  defp builtin(name), do: PyDict.get_item_string(PyEval.get_builtins(), name)
+
+  defp range(n), do: Call.call(builtin("range"), [n], [], into: :ref)
+
+  test "walks an iterable in chunks" do
+    assert Enum.to_list(0..999) == range(1000) |> Iter.stream(chunk_size: 7) |> Enum.to_list()
+    assert Enum.to_list(0..9) == range(10) |> Iter.stream(chunk_size: 10) |> Enum.to_list()
+    assert [] == range(0) |> Iter.stream() |> Enum.to_list()
+    assert 499_500 == Iter.reduce(range(1000), 0, &(&1 + &2), chunk_size: 64, max_ahead: 1)
+  end
+
+  test "maps over lists and handles" do
+    list = PyList.new(0)
+    for s <- ["a", "b", "c"], do: PyList.append(list, PyUnicode.from_string(s))
+
+    assert ["A", "B", "C"] == Iter.map(list, &String.upcase/1, chunk_size: 2)
+    assert ["A", "B", "C"] == Iter.map(Handle.new(list), &String.upcase/1)
+  end
+
+  test "stops the producer when halted early" do
+    assert [0, 1, 2] == range(1_000_000) |> Iter.stream(chunk_size: 2) |> Enum.take(3)
+    refute_received {_, {:chunk, _}}
+  end
+
+  test "raises the errors of the iterator" do
+    assert_raise RuntimeError, ~r/cannot iterate/, fn ->
+      Pythonx.C.PyLong.from_long(1) |> Iter.stream() |> Enum.to_list()
+    end
+
+    generator = Call.call(builtin("map"), [builtin("int"), ["1", "2", "x"]], [], into: :ref)
+
+    assert_raise RuntimeError, ~r/ValueError/, fn ->
+      generator |> Iter.stream() |> Enum.to_list()
+    end
+  end
+
+  test "validates options" do
+    assert_raise ArgumentError, fn -> Iter.stream(range(1), chunk_size: 0) end
+    assert_raise ArgumentError, fn -> Iter.stream(range(1), max_ahead: :infinity) end
+  end
+end
@@ -0,0 +1,40 @@
+defmodule Pythonx.LockProfiler.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.LockProfiler
+
+  setup do
+    Pythonx.initialize_once()
+  end
+
+  test "records waits and holds per site" do
+    :ok = LockProfiler.reset()
+
+    1..4
+    |> Enum.map(fn _ -> Task.async(fn -> Pythonx.inline("import time\ntime.sleep(0.01)") end) end)
+    |> Task.await_many()
+
+    %{max_queue_depth: depth, sites: %{inline: inline, precompile: precompile}} = LockProfiler.stats()
+    assert depth >= 1
+    assert inline.acquisitions == 4
+    assert inline.hold_ns >= 4 * 10_000_000
+    assert inline.max_hold_ns <= inline.hold_ns
+    assert 4 == inline.hold_histogram |> Enum.map(&elem(&1, 1)) |> Enum.sum()
+    assert precompile.acquisitions == 0
+    assert [] == precompile.wait_histogram
+  end
+
+  test "reports every site, and only the calls that lock" do
+    :ok = LockProfiler.reset()
+    Pythonx.Handle.count()
+    Pythonx.Census.count()
+
+    %{sites: sites} = LockProfiler.stats()
+
+    assert Enum.sort(Map.keys(sites)) ==
+             Enum.sort(~w(initialize inline preload_module precompile finalize pipeline call iter
+                          pickle arena gc profiler census vector handle output etf)a)
+
+    assert Enum.all?(sites, fn {_site, stats} -> stats.acquisitions == 0 end)
+  end
+end
@@ -0,0 +1,86 @@
+defmodule Pythonx.Memory.Test do
+  use ExUnit.Case, async: false
+
+  setup do
+    Pythonx.initialize_once()
+  end
+
+  # the allocator is fixed by the first initialization, so an instrumented one
+  # gets an interpreter of its own in a peer node
+  defp start_python(allocator) do
+    # over TCP rather than stdio, which Python may write to
+    peer =
+      case :peer.start_link(%{connection: 0}) do
+        {:ok, peer} -> peer
+        {:ok, peer, _node} -> peer
+      end
+
+    :ok = :peer.call(peer, :code, :add_pathsa, [:code.get_path()])
+    {:ok, _} = :peer.call(peer, :application, :ensure_all_started, [:pythonx])
+    :ok = :peer.call(peer, Pythonx, :initialize, [[allocator: allocator]], 60_000)
+    peer
+  end
+
+  defp remote(peer, fun, args), do: :peer.call(peer, Pythonx, fun, args, 60_000)
+
+  defp stats(peer), do: :peer.call(peer, Pythonx.Memory, :stats, [])
+
+  for allocator <- [:counting, :enif] do
+    @tag :peer
+    test "counts the blocks of each domain with the #{allocator} allocator" do
+      peer = start_python(unquote(allocator))
+      before = stats(peer)
+      assert %{allocator: unquote(allocator)} = before
+
+      keep = "import builtins\nbuiltins.kept = ([str(i) for i in range(10000)], bytearray(1000000))"
+      assert {:ok, []} == remote(peer, :inline, [keep])
+      held = stats(peer)
+
+      assert held.obj.blocks > before.obj.blocks + 5_000
+      assert held.obj.allocations > before.obj.allocations + 5_000
+      assert held.arenas.bytes > before.arenas.bytes
+      assert held.raw.bytes >= before.raw.bytes + 1_000_000
+      assert held.raw.blocks > before.raw.blocks
+
+      assert {:ok, []} == remote(peer, :inline, ["import builtins\ndel builtins.kept"])
+      released = stats(peer)
+
+      assert released.obj.blocks < held.obj.blocks - 5_000
+      assert released.raw.bytes <= held.raw.bytes - 1_000_000
+      assert released.raw.peak_bytes >= held.raw.bytes
+      assert released.obj.allocations >= held.obj.allocations
+    end
+  end
+
+  @tag :peer
+  test "stops the code that goes over its memory limit" do
+    peer = start_python(:counting)
+    limit = 10_000_000
+
+    assert {:error, %Pythonx.MemoryLimitError{limit: ^limit, peak_bytes: peak_bytes}} =
+             remote(peer, :inline, ["x = bytearray(50_000_000)", [memory_limit: limit]])
+
+    assert peak_bytes <= limit
+
+    assert {:ok, {[1_000_000], %{memory: %{peak_bytes: peak_bytes}}}} =
+             remote(peer, :inline, ["x = bytearray(1_000_000)\nn = len(x)", [return: [:n], memory_limit: limit]])
+
+    assert peak_bytes >= 1_000_000 and peak_bytes <= limit
+    assert {:ok, {[], %{memory: %{peak_bytes: _}}}} = remote(peer, :inline, ["del x", [memory_limit: :infinity]])
+  end
+
+  test "no statistics with the default allocator" do
+    assert nil == Pythonx.Memory.stats()
+    assert nil == Pythonx.Memory.total_bytes()
+  end
+
+  test "the allocator cannot be changed once Python is initialized" do
+    assert {:error, _} = Pythonx.initialize(allocator: :counting)
+    assert nil == Pythonx.Memory.stats()
+  end
+
+  test "memory limits need an instrumented allocator" do
+    assert {:error, "memory limits need" <> _} = Pythonx.inline("x = 1", return: [:x], memory_limit: 1_000_000)
+    assert_raise ArgumentError, fn -> Pythonx.inline("x = 1", memory_limit: -1) end
+  end
+end
@@ -0,0 +1,97 @@
+defmodule Pythonx.Output.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.Output
+
+  setup do
+    Pythonx.initialize_once()
+    on_exit(fn -> Output.release() end)
+  end
+
+  # collects the batches already sent, acknowledging each of them
+  defp receive_output(ref, acc \\ []) do
+    receive do
+      {:pythonx_output, ^ref, bytes, chunks} ->
+        Output.ack(ref, bytes)
+        receive_output(ref, acc ++ chunks)
+    after
+      0 -> acc
+    end
+  end
+
+  defp text(chunks, stream), do: for({^stream, binary} <- chunks, into: "", do: binary)
+
+  test "sends stdout, stderr and tracebacks to the subscriber" do
+    {:ok, ref} = Output.capture()
+    assert {:ok, []} == Pythonx.inline("import sys\nprint('héllo')\nsys.stderr.write('oops\\n')")
+    assert {:error, "python_error"} == Pythonx.inline("raise ValueError('bad value')")
+    assert :ok == Output.release()
+
+    chunks = receive_output(ref)
+    assert "héllo\n" == text(chunks, :stdout)
+    assert text(chunks, :stderr) =~ "oops\n"
+    assert text(chunks, :stderr) =~ "ValueError: bad value"
+    assert {:error, "output is not captured"} == Output.release()
+  end
+
+  test "drops what does not fit until it is acknowledged" do
+    {:ok, ref} = Output.capture(capacity: 16, batch: 16)
+    Pythonx.inline("print('x' * 16, end='')\nprint('y' * 8, end='')")
+    Output.release()
+
+    assert [stdout: String.duplicate("x", 16), dropped: 8] == receive_output(ref)
+  end
+
+  test "blocks until the subscriber makes room" do
+    parent = self()
+
+    subscriber =
+      spawn_link(fn ->
+        receive do
+          {:ref, ref} ->
+            collect = fn collect, acc ->
+              receive do
+                {:pythonx_output, ^ref, bytes, chunks} ->
+                  Output.ack(ref, bytes)
+                  collect.(collect, acc ++ chunks)
+
+                :done ->
+                  send(parent, {:chunks, acc})
+              end
+            end
+
+            collect.(collect, [])
+        end
+      end)
+
+    {:ok, ref} = Output.capture(to: subscriber, capacity: 16, batch: 4, when_full: :block)
+    send(subscriber, {:ref, ref})
+    Pythonx.inline("for i in range(100): print(i)")
+    Output.release()
+    send(subscriber, :done)
+
+    assert_receive {:chunks, chunks}, 5000
+    refute List.keymember?(chunks, :dropped, 0)
+    assert Enum.map_join(0..99, &"#{&1}\n") == text(chunks, :stdout)
+  end
+
+  test "does not block on the calling process" do
+    assert_raise ArgumentError, ~r/another process/, fn -> Output.capture(when_full: :block) end
+    assert_raise ArgumentError, fn -> Output.capture(to: self(), when_full: :block) end
+    assert {:error, "output is not captured"} == Output.release()
+
+    {:ok, ref} = Output.capture(capacity: 16, batch: 16)
+    Pythonx.inline("print('z' * 32, end='')")
+    Output.release()
+    assert [dropped: 32] == receive_output(ref)
+  end
+
+  test "restores the original streams" do
+    {:ok, _ref} = Output.capture()
+    assert {:error, "output is already captured"} == Output.capture()
+    Output.release()
+
+    assert {:ok, [false]} ==
+             Pythonx.inline("import sys\nwrapped = type(sys.stdout).__name__ == 'OutputWriter'", return: [:wrapped])
+  end
+end
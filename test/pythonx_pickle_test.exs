@@ -0,0 +1,61 @@
+defmodule Pythonx.Pickle.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.C
+  alias Pythonx.C.PyDict
+  alias Pythonx.C.PyErr
+  alias Pythonx.C.PyLong
+  alias Pythonx.C.PyObject
+  alias Pythonx.C.PyRun
+  alias Pythonx.Pickle
+
+  setup do
+    Pythonx.initialize_once()
+  end
+
+  defp eval(code) do
+    globals = PyDict.new()
+    PyRun.string(code, C.py_eval_input(), globals, globals)
+  end
+
+  test "round-trips in-band objects" do
+    obj = eval("{'a': [1, 2, 3], 'b': ('x', 4.2)}")
+    assert {data, []} = Pickle.dumps(obj)
+    assert is_binary(data)
+
+    loaded = Pickle.loads(data)
+    assert PyObject.print(obj) == PyObject.print(loaded)
+  end
+
+  test "returns out-of-band buffers separately" do
+    obj = eval("__import__('pickle').PickleBuffer(bytearray(b'abc' * 1000))")
+    assert {data, [buffer]} = Pickle.dumps(obj)
+    assert byte_size(data) < 100
+    assert String.duplicate("abc", 1000) == buffer
+
+    loaded = Pickle.loads([data], [buffer])
+    assert 3000 == PyObject.length(loaded)
+    assert "b'abcabc" <> _ = PyObject.print(PyObject.bytes(loaded))
+  end
+
+  test "copies writable out-of-band buffers" do
+    globals = PyDict.new()
+    code = "import pickle\nbuf = bytearray(b'abc')\npb = pickle.PickleBuffer(buf)"
+    PyRun.string(code, C.py_file_input(), globals, globals)
+
+    assert {_data, [buffer]} = Pickle.dumps(PyDict.get_item_string(globals, "pb"))
+    PyRun.string("buf[0] = ord('x')", C.py_file_input(), globals, globals)
+    assert "abc" == buffer
+  end
+
+  test "accepts iodata" do
+    {data, []} = Pickle.dumps(PyLong.from_long(42))
+    <<head::binary-size(2), rest::binary>> = data
+    assert 42 == PyLong.as_long(Pickle.loads([head, [rest]]))
+  end
+
+  test "returns PyErr on failure" do
+    assert %PyErr{} = Pickle.dumps(eval("lambda: 1"))
+    assert %PyErr{} = Pickle.loads("not a pickle")
+  end
+end
@@ -0,0 +1,75 @@
+defmodule Pythonx.Pipeline.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.C.PyErr
+  alias Pythonx.Handle
+  alias Pythonx.Pipeline
+
+  setup do
+    Pythonx.initialize_once()
+  end
+
+  test "runs arithmetic on loaded handles" do
+    a = Handle.from_long(6)
+    b = Handle.from_long(7)
+
+    assert {:ok, [product, 43]} =
+             Pipeline.run(
+               [
+                 {:load, 0, a},
+                 {:load, 1, b},
+                 {:number_multiply, 2, 0, 1},
+                 {:long, 3, 1},
+                 {:number_add, 4, 2, 3}
+               ],
+               [2, {:term, 4}]
+             )
+
+    assert 42 == Handle.as_long(product)
+    assert 3 == Handle.release([a, b, product])
+  end
+
+  test "builds containers" do
+    assert {:ok, [%{"a" => 1, "b" => [1, "x"]}, 2]} =
+             Pipeline.run(
+               [
+                 {:dict_new, 0},
+                 {:long, 1, 1},
+                 {:dict_set_item_string, 0, "a", 1},
+                 {:list_new, 2, 0},
+                 {:list_append, 2, 1},
+                 {:unicode, 3, "x"},
+                 {:list_append, 2, 3},
+                 {:dict_set_item_string, 0, "b", 2},
+                 {:object_length, 4, 0}
+               ],
+               [{:term, 0}, {:term, 4}]
+             )
+  end
+
+  test "loads run in instruction order" do
+    list = Pythonx.C.PyList.new(0)
+
+    assert {:ok, [1]} =
+             Pipeline.run(
+               [{:none, 0}, {:load, 1, list}, {:list_append, 1, 0}, {:object_length, 2, 1}],
+               [{:term, 2}]
+             )
+
+    assert 1 == Pythonx.C.PyList.size(list)
+  end
+
+  test "returns the index of the failing instruction" do
+    assert {:error, 2, %PyErr{}} =
+             Pipeline.run(
+               [{:long, 0, 1}, {:long, 1, 0}, {:number_true_divide, 2, 0, 1}, {:none, 3}],
+               [3]
+             )
+  end
+
+  test "rejects malformed batches before running them" do
+    assert_raise ArgumentError, fn -> Pipeline.run([{:number_add, 0, 1, 2}], [0]) end
+    assert_raise ArgumentError, fn -> Pipeline.run([{:no_such_op, 0}], []) end
+    assert_raise ArgumentError, fn -> Pipeline.run([{:long, 0, 1}], [1]) end
+  end
+end
@@ -0,0 +1,54 @@
+defmodule Pythonx.Profiler.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.Profiler
+
+  setup do
+    Pythonx.initialize_once()
+    on_exit(fn -> Profiler.stop() end)
+  end
+
+  @code """
+  def leaf(n):
+      return sum(i * i for i in range(n))
+
+  def hot():
+      for _ in range(200):
+          leaf(2000)
+
+  hot()
+  """
+
+  test "samples python stacks" do
+    {_, collapsed} = Profiler.profile(fn -> Pythonx.inline(@code) end, interval_us: 100)
+
+    stacks =
+      for line <- String.split(collapsed, "\n", trim: true) do
+        assert [stack, count] = Regex.run(~r/^(.+) (\d+)$/, line, capture: :all_but_first)
+        {stack, String.to_integer(count)}
+      end
+
+    assert stacks != []
+    assert Enum.any?(stacks, fn {stack, _} -> stack =~ ~r/^<module> \(<string>:1\);hot \(<string>:\d+\);leaf / end)
+
+    %{running: false, interval_us: 100, samples: samples} = Profiler.stats()
+    assert samples == Enum.sum(Enum.map(stacks, &elem(&1, 1)))
+  end
+
+  test "only one session runs at a time" do
+    assert :ok == Profiler.start()
+    assert {:error, "profiler is already running"} == Profiler.start()
+    assert Profiler.stats().running
+    assert :ok == Profiler.stop()
+    assert {:error, "profiler is not running"} == Profiler.stop()
+  end
+
+  test "a new session discards the previous one" do
+    Profiler.profile(fn -> Pythonx.inline(@code) end, interval_us: 100)
+    assert Profiler.stats().samples > 0
+
+    :ok = Profiler.start()
+    :ok = Profiler.stop()
+    assert %{samples: 0, collapsed: ""} = Profiler.stats()
+  end
+end
@@ -0,0 +1,26 @@
+defmodule Pythonx.Startup.Test do
+  use ExUnit.Case, async: false
+
+  setup do
+    Pythonx.initialize_once()
+  end
+
+  test "reports the startup phases" do
+    assert %{load_nif: load_nif, init: init, imports: [], precompile: []} = Pythonx.startup_report()
+    assert is_integer(load_nif)
+    assert is_integer(init)
+  end
+
+  test "preloads modules" do
+    assert {:ok, elapsed} = Pythonx.Nif.preload_module("json")
+    assert is_integer(elapsed)
+    assert %Pythonx.C.PyErr{} = Pythonx.Nif.preload_module("pythonx_no_such_module")
+  end
+
+  test "precompiled snippets are reused by inline" do
+    code = "b = a + 1"
+    assert {:ok, _} = Pythonx.Nif.precompile(code)
+    assert {:ok, [2]} == Pythonx.inline(code, return: [:b], elixir_vars: [a: 1])
+    assert %Pythonx.C.PyErr{} = Pythonx.Nif.precompile("b = (")
+  end
+end
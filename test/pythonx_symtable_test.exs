@@ -0,0 +1,63 @@
+defmodule Pythonx.Symtable.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.Symtable
+
+  setup do
+    cache_dir = Path.join(System.tmp_dir!(), "pythonx_symtable_test_#{System.unique_integer([:positive])}")
+    previous = Application.get_env(:pythonx, :symtable_cache)
+    Application.put_env(:pythonx, :symtable_cache, cache_dir)
+
+    on_exit(fn ->
+      File.rm_rf!(cache_dir)
+
+      if previous == nil do
+        Application.delete_env(:pythonx, :symtable_cache)
+      else
+        Application.put_env(:pythonx, :symtable_cache, previous)
+      end
+    end)
+
+    %{cache_dir: cache_dir}
+  end
+
+  test "returns the global names used by the code" do
+    assert {:ok, %{globals: globals}} = Symtable.analyze("c = a + b\ndef f():\n    return d\n")
+    assert MapSet.new(["a", "b", "d"]) == MapSet.new(globals) |> MapSet.delete("c") |> MapSet.delete("f")
+  end
+
+  test "reports syntax errors" do
+    assert {:error, %{"error" => _, "lineno" => 2}} = Symtable.analyze("a = 1\nb = (\n")
+  end
+
+  test "caches results on disk", %{cache_dir: cache_dir} do
+    code = "x = y * 2"
+    assert {:ok, analysis} = Symtable.analyze(code)
+    assert [_] = cache_dir |> File.ls!() |> List.delete("analyzer.json")
+    assert {:ok, ^analysis} = Symtable.analyze(code)
+
+    Symtable.clear_cache()
+    refute File.exists?(cache_dir)
+  end
+
+  defp stop_analyzer do
+    if pid = Process.whereis(Symtable), do: GenServer.stop(pid)
+    :persistent_term.erase({Symtable, :identity})
+  end
+
+  test "does not start the analyzer when the result is cached", %{cache_dir: cache_dir} do
+    stop_analyzer()
+    assert {:ok, analysis} = Symtable.analyze("a = b")
+    assert File.exists?(Path.join(cache_dir, "analyzer.json"))
+
+    stop_analyzer()
+    assert {:ok, ^analysis} = Symtable.analyze("a = b")
+    assert nil == Process.whereis(Symtable)
+  end
+
+  test "returns the marshalled code object" do
+    assert {:ok, %{bytecode: bytecode, magic: magic}} = Symtable.analyze("a = 1")
+    assert is_binary(bytecode) and byte_size(bytecode) > 0
+    assert is_integer(magic)
+  end
+end
@@ -0,0 +1,38 @@
+defmodule Pythonx.Telemetry.Test do
+  use ExUnit.Case, async: false
+
+  setup do
+    Pythonx.initialize_once()
+
+    test_pid = self()
+    handler_id = "pythonx-telemetry-test"
+
+    :telemetry.attach_many(
+      handler_id,
+      [[:pythonx, :inline, :start], [:pythonx, :inline, :stop]],
+      fn event, measurements, metadata, _ -> send(test_pid, {event, measurements, metadata}) end,
+      nil
+    )
+
+    on_exit(fn -> :telemetry.detach(handler_id) end)
+  end
+
+  test "inline calls emit a span with their phases" do
+    assert {:ok, [2]} == Pythonx.inline("b = a * 2", return: [:b], elixir_vars: [a: 1])
+
+    assert_receive {[:pythonx, :inline, :start], _, %{code: "b = a * 2"}}
+    assert_receive {[:pythonx, :inline, :stop], measurements, metadata}
+
+    for phase <- [:duration, :mutex_wait, :inject, :compile, :execute, :convert] do
+      assert is_integer(measurements[phase]) and measurements[phase] >= 0
+    end
+
+    assert %{code_bytes: 9, injected: 1, returned: 1} = measurements
+    assert %{compiled_from: :source, error: nil} = metadata
+  end
+
+  test "reports the python exception" do
+    assert {:error, _} = Pythonx.inline("1 / 0")
+    assert_receive {[:pythonx, :inline, :stop], _, %{error: "ZeroDivisionError"}}
+  end
+end
@@ -0,0 +1,52 @@
+defmodule Pythonx.Vector.Test do
+  use ExUnit.Case, async: false
+
+  alias Pythonx.C.PyErr
+  alias Pythonx.Handle
+  alias Pythonx.Vector
+
+  setup do
+    Pythonx.initialize_once()
+  end
+
+  test "broadcasts scalars over lists" do
+    assert {:ok, [2.5, 5.0, 7.5]} == Vector.number(:multiply, [1, 2, 3], 2.5)
+    assert {:ok, [9, 8, 7]} == Vector.number(:subtract, 10, [1, 2, 3])
+    assert {:ok, [3]} == Vector.number(:add, 1, 2)
+  end
+
+  test "packed binaries" do
+    a = Vector.pack([1, 2, 3], :s64)
+    b = Vector.pack([0.5, 0.25, 2.0], :f64)
+
+    assert {:ok, packed} = Vector.number(:true_divide, {:s64, a}, {:f64, b}, into: :f64)
+    assert [2.0, 8.0, 1.5] == Vector.unpack(packed, :f64)
+
+    assert {:ok, packed} = Vector.number(:xor, {:s64, a}, 1, into: :s64)
+    assert [0, 3, 2] == Vector.unpack(packed, :s64)
+  end
+
+  test "matches python beyond the native loops" do
+    max = 0x7FFFFFFFFFFFFFFF
+    assert {:ok, [0x8000000000000000]} == Vector.number(:add, [max], 1)
+    assert {:error, 0, %PyErr{}} = Vector.number(:add, {:s64, Vector.pack([max], :s64)}, 1, into: :s64)
+    assert {:ok, [0, 1.0, 1]} == Vector.number(:floor_divide, [1, 2.5, 3], 2)
+    assert {:error, 1, %PyErr{}} = Vector.number(:true_divide, 1, [1.0, 0.0])
+    assert {:error, 0, %PyErr{}} = Vector.number(:and, [1.5], 1)
+  end
+
+  test "handles" do
+    handles = Enum.map([1, 2, 3], &Handle.from_long/1)
+    assert {:ok, results} = Vector.number(:multiply, {:handles, handles}, {:handle, hd(handles)}, into: :handles)
+    assert [1, 2, 3] == Enum.map(results, &Handle.as_long/1)
+    assert 6 == Handle.release(handles ++ results)
+
+    assert_raise ArgumentError, fn -> Vector.number(:add, {:handles, handles}, 1) end
+  end
+
+  test "rejects mismatched operands" do
+    assert_raise ArgumentError, fn -> Vector.number(:add, [1, 2], [1, 2, 3]) end
+    assert_raise ArgumentError, fn -> Vector.number(:add, {:s64, <<1, 2, 3>>}, 1) end
+    assert_raise ArgumentError, fn -> Vector.number(:no_such_op, [1], 1) end
+  end
+end
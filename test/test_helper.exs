@@ -1,9 +1,13 @@
+# tests that need an interpreter of their own run it in a peer node, which needs OTP 25
+peer = not Code.ensure_loaded?(:peer)
+
 ExUnit.configure(
   exclude: [
     pyinline: true,
     pyeval: true,
     c_pyrun: true,
-    flaky: true
+    flaky: true,
+    peer: peer
   ]
 )
 